@@ -1,12 +1,34 @@
 #pragma once
+#include "path_arena.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
 namespace tp2 {
 
+class MetadataCache;
+class IoThrottle;
+class AdaptiveConcurrency;
+class DeviceProfiles;
+class Readahead;
+
 /** \brief Operações suportadas pelo sistema de sincronização. */
 enum class Operation { Backup, ///< Copia/atualiza de HD para PEN
-                       Restore ///< Copia/atualiza de PEN para HD
+                       Restore, ///< Copia/atualiza de PEN para HD
+                       Verify, ///< Confere os arquivos do PEN contra os checksums gravados
+                       Sync, ///< Copia em ambos os sentidos, sempre do lado mais novo
+                       Mirror, ///< Backup que também remove do PEN o que saiu do HD/da lista
+                       Snapshot, ///< Nova árvore datada no PEN; inalterados viram hard links da anterior
+                       Prune ///< Descarta snapshots fora da retenção e recupera espaço (chunks sem uso)
+};
+
+/** \brief Resultado de um dos PENs numa execução com vários PENs. */
+struct PenResult {
+    std::string pen;       ///< caminho base do PEN
+    int code = 0;          ///< mesmo significado de ActionResult::code
+    std::string message;
 };
 
 /** \brief Resultado de uma ação de sincronização.
@@ -17,18 +39,45 @@ enum class Operation { Backup, ///< Copia/atualiza de HD para PEN
  *  - 3: exceção/erro inesperado
  *  - 4: entradas ausentes na fonte (missing)
  *  - 5: falha de escrita (tem precedência sobre 4)
+ *  - 6: checksum divergente no PEN (modo Verify; precedência sobre 4), ou
+ *    receita ilegível no PEN (modo Prune)
  */
-
 struct ActionResult {
     int code;              ///< 0 sucesso; >0 conforme tabela acima
     std::string message;   ///< mensagem opcional de detalhe
+    std::vector<std::string> mismatched{}; ///< entradas com conteúdo divergente (modo Verify)
+    std::vector<std::string> removed{};    ///< arquivos retirados do PEN (modo Mirror)
+    std::vector<PenResult> pens{};         ///< situação de cada PEN (execute_backup_multi)
+};
+
+/** \brief Ajustes de execução (valores padrão reproduzem o comportamento sequencial). */
+struct BackupOptions {
+    unsigned jobs = 1;                          ///< arquivos processados em paralelo (com concurrency, o teto)
+    std::uint64_t max_read_bytes_per_sec = 0;   ///< limite de leitura do Verify (0 = sem limite)
+    bool quarantine = false;                    ///< Mirror move para <pen>/.tp2_quarantine em vez de apagar
+    bool dedup = false;                         ///< PEN como repositório de chunks deduplicados (ver ChunkStore)
+    bool compress = false;                      ///< comprime no PEN (LZ4); formatos já comprimidos vão como estão
+    unsigned compress_threads = 2;              ///< threads de compressão por arquivo (pipeline)
+    std::uint64_t pack_threshold = 0;           ///< arquivos até este tamanho vão para packs (0 = desligado)
+    std::string as_of;                          ///< Restore do snapshot mais novo até esta data (vazio = estado atual do PEN)
+    unsigned keep_last = 0;                     ///< Prune: mantém os N snapshots mais novos
+    unsigned keep_daily = 0;                    ///< Prune: mantém o mais novo de cada um dos N últimos dias
+    unsigned keep_weekly = 0;                   ///< Prune: mantém o mais novo de cada uma das N últimas semanas
+    unsigned time_budget_sec = 0;               ///< Prune: prazo da recuperação de espaço (0 = sem limite)
+    bool stripe = false;                        ///< vários PENs: cada arquivo vai para um só PEN (ver StripeLayout)
+    std::uint64_t split_size = 0;               ///< cópias no PEN maiores que isto vão em partes (0 = só em FAT32, acima de 4 GiB - 1; ver split_file.hpp)
+    MetadataCache* cache = nullptr;             ///< metadados em memória entre execuções (modo daemon; ver cache.hpp)
+    AdaptiveConcurrency* concurrency = nullptr; ///< --jobs auto: cópias simultâneas ajustadas por dispositivo (ver concurrency.hpp)
+    IoThrottle* throttle = nullptr;             ///< limites de E/S de leitura e gravação, comuns a todas as threads (ver throttle.hpp)
+    DeviceProfiles* profiles = nullptr;         ///< bloco, fsync e cache das cópias conforme o dispositivo de cada lado (ver device_profile.hpp)
+    Readahead* readahead = nullptr;             ///< lê os próximos arquivos enquanto as cópias gravam (ver readahead.hpp)
 };
 
 /** \brief Executa a sincronização conforme o modo e a lista do arquivo parm.
  *  \param hdPath Caminho base do HD
  *  \param penPath Caminho base do PEN
  *  \param paramFile Caminho para o arquivo de parâmetros (ex.: Backup.parm)
- *  \param op Modo de operação (Backup ou Restore)
+ *  \param op Modo de operação (Backup, Restore, Verify, Sync, Mirror, Snapshot ou Prune)
  *  \return ActionResult com código e mensagem
  *  \note O arquivo de parâmetros aceita:
  *    - Uma entrada por linha (relativa ao diretório base)
@@ -41,10 +90,98 @@ ActionResult execute_backup(const std::string& hdPath,
                            const std::string& paramFile,
                            Operation op);
 
+/** \brief Igual a execute_backup(), com ajustes de execução.
+ *  \details No Backup, cada arquivo copiado tem tamanho, mtime e hash
+ *  registrados no manifesto do PEN (.tp2_manifest). O Verify relê cada
+ *  arquivo listado no PEN, em até \c jobs threads e respeitando
+ *  \c max_read_bytes_per_sec, e compara com o manifesto: divergências vão
+ *  para ActionResult::mismatched (código 6); arquivos ausentes ou sem
+ *  checksum gravado resultam em código 4.
+ *  Backup, Restore e Sync fazem um único stat de cada lado por entrada; no
+ *  Sync, cada entrada é copiada do lado mais novo para o mais antigo (ou para
+ *  o lado onde falta), e o código 4 indica entradas ausentes nos dois lados.
+ *  As entradas são distribuídas entre \c jobs threads por uma fila comum.
+ *  O Mirror faz o Backup e depois remove do PEN os arquivos que não estão na
+ *  lista ou que sumiram do HD (ausência no HD não é erro nesse modo).
+ *  Internamente equivale a plan_backup() seguido de execute_plan() (plan.hpp).
+ *  O Snapshot cria <pen>/.tp2_snapshots/<data>: arquivos com o mesmo mtime
+ *  do snapshot anterior viram hard links para ele e os demais são copiados
+ *  (ver snapshot.hpp). Os diretórios são criados de uma vez, antes das cópias.
+ *  Com \c as_of, o Restore busca cada arquivo no catálogo dos snapshots
+ *  (SnapshotCatalog) e traz a versão do snapshot mais novo até essa data;
+ *  entradas que não estavam nesse snapshot resultam em código 4.
+ *  O Prune não usa o arquivo de parâmetros: retira do catálogo os snapshots
+ *  fora da retenção (sem política, mantém todos), e então, até esgotar
+ *  \c time_budget_sec, apaga as árvores descartadas e os chunks que nenhuma
+ *  receita referencia; o que sobrar fica para a próxima execução.
+ *  ActionResult::removed lista os snapshots descartados.
+ */
+ActionResult execute_backup(const std::string& hdPath,
+                           const std::string& penPath,
+                           const std::string& paramFile,
+                           Operation op,
+                           const BackupOptions& options);
+
+/** \brief Igual a execute_backup(), gravando em vários PENs.
+ *  \details No Backup e no Mirror cada arquivo do HD é lido uma única vez e
+ *  os mesmos blocos (já comprimidos, com \c compress) vão para todos os PENs
+ *  que precisam dele, cada um com a sua thread de escrita (FanoutSink). Cada
+ *  PEN tem o seu plano, manifesto e diário, e a sua situação em
+ *  ActionResult::pens; um PEN com erro não interrompe os outros. Com
+ *  \c dedup ou \c pack_threshold, e nos modos Verify, Snapshot e Prune, os
+ *  PENs são processados um após o outro. Restore e Sync (com mais de uma
+ *  fonte possível) retornam 2.
+ *  Com \c stripe, os arquivos são distribuídos entre os PENs em vez de
+ *  copiados para todos: o índice <pen>/.tp2_layout (StripeLayout) diz em
+ *  qual PEN está cada um, e cada PEN executa a sua parte como um plano comum,
+ *  todos ao mesmo tempo, no Backup, Mirror, Restore e Verify. Entradas fora do
+ *  índice no Restore e no Verify resultam em código 4. Sync, Snapshot e
+ *  Restore com \c as_of retornam 2; o Prune roda em cada PEN.
+ *  \return código do pior PEN (3, 5, 6, 4, 2, 1, nesta ordem); mismatched e
+ *  removed trazem os caminhos completos no PEN
+ */
+ActionResult execute_backup_multi(const std::string& hdPath,
+                                  const std::vector<std::string>& penPaths,
+                                  const std::string& paramFile,
+                                  Operation op,
+                                  const BackupOptions& options);
+
+/** \brief Ajustes do modo contínuo (watch_backup()). */
+struct WatchOptions {
+    unsigned debounce_ms = 500;                 ///< lote sai após este tempo sem eventos novos
+    unsigned max_delay_ms = 5000;               ///< ... ou no máximo este tempo após o primeiro evento
+    const std::atomic<bool>* stop = nullptr;    ///< encerra o laço quando verdadeiro (nullptr = nunca)
+    std::function<void(const ActionResult&, std::size_t)> on_batch; ///< resultado de cada lote e nº de entradas
+};
+
+/** \brief Backup contínuo: copia para o PEN só as entradas que mudaram.
+ *  \details Faz um Backup completo e depois observa as entradas da lista
+ *  (ChangeWatcher, inotify). Cada evento põe a entrada num conjunto de
+ *  alteradas; quando os eventos param por \c debounce_ms (ou após
+ *  \c max_delay_ms), o conjunto vira um plano só com essas entradas e é
+ *  executado como um Backup comum (manifesto, diário, dedup, packs). O
+ *  trabalho por lote é proporcional às mudanças, não ao tamanho da lista. Se
+ *  o kernel descartar eventos, o lote seguinte confere a lista inteira.
+ *  Apagar um arquivo do HD não o remove do PEN (o lote resulta em código 4).
+ *  \return resultado do último lote; 1 se o parm faltar; 2 sem inotify
+ */
+ActionResult watch_backup(const std::string& hdPath,
+                          const std::string& penPath,
+                          const std::string& paramFile,
+                          const BackupOptions& options,
+                          const WatchOptions& watch);
+
 /** \brief Lê a lista de entradas do arquivo de parâmetros.
  *  \param paramFile Caminho do arquivo de parâmetros
  *  \return Vetor de strings com as entradas normalizadas
  */
 std::vector<std::string> read_param_list(const std::string& paramFile);
 
+/** \brief Lê a lista de entradas direto para uma PathArena (mesmas regras de read_param_list()).
+ *  \details Usada internamente pelo motor: cada caminho é guardado uma única
+ *  vez, com front coding, em vez de uma std::string por entrada.
+ *  \return número de entradas lidas (0 se o arquivo faltar ou estiver vazio)
+ */
+std::size_t read_param_arena(const std::string& paramFile, PathArena& out);
+
 } // namespace tp2
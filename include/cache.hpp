@@ -0,0 +1,91 @@
+#pragma once
+#include "fsutil.hpp"
+#include "manifest.hpp"
+#include "path_arena.hpp"
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Metadados mantidos em memória entre execuções (modo daemon).
+ *  \details Guarda a lista do parm, o manifesto de cada PEN e o resultado
+ *  do stat das entradas do lado do PEN. Cada item vale enquanto o arquivo de
+ *  origem não mudar: o parm e o .tp2_manifest são conferidos por mtime e
+ *  tamanho a cada uso e relidos se mudaram, então editar o parm não exige
+ *  reiniciar o daemon. Os stats do PEN valem por até kStatTtl e só enquanto
+ *  o manifesto for o que a última execução gravou; as entradas que ela
+ *  copiou ou apagou são esquecidas e voltam a ser consultadas. Alterações
+ *  manuais no PEN que não passem pelo tp2 podem levar até kStatTtl para
+ *  serem vistas (ou clear()). Seguro para uso concorrente.
+ */
+class MetadataCache {
+public:
+    static constexpr std::chrono::seconds kStatTtl{300};
+    using StatMap = std::unordered_map<std::string, FileStat>;
+
+    /** \brief Lista do parm em \p out (mesmas regras de read_param_arena()), relida só se o arquivo mudou.
+     *  \return número de entradas (0 se o arquivo faltar ou estiver vazio)
+     */
+    std::size_t params(const std::string& paramFile, PathArena& out);
+
+    /** \brief Move para \p out o manifesto de \p penPath, se o arquivo não mudou desde put_manifest(). */
+    bool take_manifest(const std::string& penPath, Manifest& out);
+
+    /** \brief Guarda o manifesto que acabou de ser lido ou gravado em \p penPath. */
+    void put_manifest(const std::string& penPath, Manifest&& manifest);
+
+    /** \brief Stats do lado do PEN (raiz de dados \p penRoot) ainda válidos, ou nullptr. */
+    std::shared_ptr<const StatMap> pen_stats(const std::string& penPath, const std::string& penRoot);
+
+    /** \brief Registra os stats de um plano; só passam a valer em confirm_pen_stats().
+     *  \param reused o plano partiu de pen_stats() (mantém a idade dos stats reaproveitados)
+     */
+    void stage_pen_stats(const std::string& penRoot, std::shared_ptr<StatMap> stats, bool reused);
+
+    /** \brief Fim da execução: esquece as entradas de \p touched e valida o resto. */
+    void confirm_pen_stats(const std::string& penPath, const std::string& penRoot,
+                           const std::vector<std::string>& touched);
+
+    /** \brief Esquece tudo (ex.: SIGHUP no daemon). */
+    void clear();
+
+private:
+    struct Stamp {
+        bool exists = false;
+        std::int64_t mtime_ns = 0;
+        std::uint64_t size = 0;
+        bool operator==(const Stamp& o) const {
+            return exists == o.exists && mtime_ns == o.mtime_ns && size == o.size;
+        }
+    };
+    struct ParamList {
+        Stamp stamp;
+        PathArena paths;
+    };
+    struct CachedManifest {
+        Stamp stamp;
+        Manifest manifest;
+    };
+    struct PenStats {
+        Stamp manifest;                               ///< manifesto quando os stats foram validados
+        std::chrono::steady_clock::time_point taken;
+        bool confirmed = false;
+        std::shared_ptr<StatMap> stats;
+    };
+
+    static Stamp stamp_of(const std::string& file);
+    static std::string manifest_file(const std::string& penPath);
+
+    std::mutex mutex_;
+    std::map<std::string, ParamList> params_;
+    std::map<std::string, CachedManifest> manifests_;
+    std::map<std::string, PenStats> pen_stats_;
+};
+
+} // namespace tp2
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace tp2 {
+
+/** \brief Hash incremental de 64 bits (algoritmo XXH64).
+ *  \details Processa blocos de 32 bytes em quatro acumuladores independentes,
+ *  o que permite ao compilador/CPU executar as quatro faixas em paralelo.
+ *  Não é criptográfico: serve para detectar corrupção (bit rot) no PEN.
+ */
+class Hasher64 {
+public:
+    explicit Hasher64(std::uint64_t seed = 0);
+
+    /** \brief Acrescenta \p len bytes ao estado do hash. */
+    void update(const void* data, std::size_t len);
+
+    /** \brief Retorna o hash dos bytes acumulados (não altera o estado). */
+    std::uint64_t digest() const;
+
+private:
+    std::uint64_t seed_;
+    std::uint64_t total_ = 0;
+    std::uint64_t v_[4];
+    unsigned char buf_[32];
+    std::size_t buf_len_ = 0;
+};
+
+/** \brief Calcula o hash de 64 bits de um bloco de memória. */
+std::uint64_t hash64(const void* data, std::size_t len, std::uint64_t seed = 0);
+
+/** \brief Formata um hash como 16 dígitos hexadecimais minúsculos. */
+std::string hash_to_hex(std::uint64_t h);
+
+/** \brief Converte 16 dígitos hexadecimais em hash.
+ *  \return false se o texto não for um hash válido
+ */
+bool hash_from_hex(const std::string& text, std::uint64_t& out);
+
+} // namespace tp2
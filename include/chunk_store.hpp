@@ -0,0 +1,161 @@
+#pragma once
+#include "manifest.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+class IoThrottle;
+
+/** \brief Limites de tamanho dos chunks (em bytes). */
+struct ChunkParams {
+    std::uint32_t min_size = 16 * 1024;   ///< nenhum corte antes disto
+    std::uint32_t avg_size = 64 * 1024;   ///< tamanho médio desejado (potência de 2)
+    std::uint32_t max_size = 256 * 1024;  ///< corte forçado
+};
+
+/** \brief Ponto de corte do próximo chunk em \p data (algoritmo FastCDC).
+ *  \details Rolling hash "gear" (fp = (fp << 1) + Gear[byte]) testado contra
+ *  uma máscara mais exigente antes do tamanho médio e uma mais fraca depois
+ *  (normalized chunking), o que concentra os tamanhos perto da média. Como o
+ *  corte depende só do conteúdo, inserir bytes num arquivo desloca apenas os
+ *  chunks vizinhos e os demais continuam iguais.
+ *  \return tamanho do chunk, entre 1 e min(\p n, max_size); \p n se n <= min_size
+ */
+std::size_t fastcdc_cut(const std::uint8_t* data, std::size_t n, const ChunkParams& params);
+
+/** \brief Identificador de conteúdo de um chunk (128 bits: dois XXH64 com sementes distintas). */
+struct ChunkId {
+    std::uint64_t hi = 0;
+    std::uint64_t lo = 0;
+
+    /** \brief 32 dígitos hexadecimais minúsculos. */
+    std::string hex() const;
+    static bool from_hex(const std::string& text, ChunkId& out);
+
+    bool operator==(const ChunkId& o) const { return hi == o.hi && lo == o.lo; }
+    bool operator!=(const ChunkId& o) const { return !(*this == o); }
+};
+
+/** \brief Calcula o id de conteúdo de um bloco. */
+ChunkId chunk_id(const void* data, std::size_t len);
+
+/** \brief Receita de um arquivo: metadados e a sequência de chunks que o compõe. */
+struct Recipe {
+    struct Chunk {
+        ChunkId id;
+        std::uint32_t size = 0;
+    };
+    std::uint64_t size = 0;     ///< tamanho do arquivo remontado
+    std::int64_t mtime_ns = 0;  ///< mtime da fonte
+    std::uint64_t hash = 0;     ///< hash64 do arquivo inteiro
+    std::vector<Chunk> chunks;
+};
+
+/** \brief Grava a receita em \p path (temporário + rename) e aplica o mtime da fonte ao arquivo. */
+bool save_recipe(const Recipe& recipe, const std::string& path);
+
+/** \brief Lê uma receita gravada por save_recipe(). \return false se ausente ou inválida */
+bool load_recipe(const std::string& path, Recipe& recipe);
+
+/** \brief Resultado de uma passada de coleta de chunks sem uso. */
+struct GcResult {
+    std::uint64_t chunks_removed = 0;
+    std::uint64_t bytes_removed = 0;
+    bool complete = false;  ///< a varredura chegou ao último subdiretório
+    std::string unreadable; ///< receita que não pôde ser lida: a coleta parou sem apagar nada
+};
+
+/** \brief Armazenamento endereçado por conteúdo no PEN (modo dedup).
+ *  \details Cada chunk é gravado uma única vez em
+ *  <pen>/.tp2_chunks/<2 hex>/<32 hex>; arquivos iguais ou parecidos passam a
+ *  compartilhar chunks. Para cada arquivo do usuário há uma receita em
+ *  <pen>/.tp2_recipes/<caminho>, com o mesmo mtime da fonte, de modo que a
+ *  comparação por mtime do plano funciona sobre as receitas. Seguro para uso
+ *  concorrente: chunks são gravados em temporário único + rename.
+ */
+class ChunkStore {
+public:
+    static constexpr const char* kChunkDir = ".tp2_chunks";
+    static constexpr const char* kRecipeDir = ".tp2_recipes";
+
+    explicit ChunkStore(const std::string& penPath, ChunkParams params = {});
+
+    /** \brief Liga a compressão dos chunks novos (frame LZ4, ver compress.hpp).
+     *  \details A leitura reconhece chunks comprimidos ou não, então um mesmo
+     *  repositório pode misturar os dois.
+     */
+    void set_compression(bool enabled) { compress_ = enabled; }
+
+    /** \brief Cobra as leituras e gravações de arquivos e chunks em \p throttle (nulo = sem limite). */
+    void set_throttle(IoThrottle* throttle) { throttle_ = throttle; }
+
+    /** \brief Raiz das receitas (<pen>/.tp2_recipes). */
+    const std::string& recipe_root() const { return recipe_root_; }
+
+    /** \brief Caminho do arquivo de um chunk. */
+    std::string chunk_path(const ChunkId& id) const;
+
+    /** \brief Fatia \p src em chunks, grava só os novos e escreve a receita em \p recipe_path.
+     *  \param record recebe tamanho, mtime e hash64 do conteúdo lido (opcional)
+     */
+    bool store_file(const std::string& src, std::int64_t mtime_ns,
+                    const std::string& recipe_path, ManifestEntry* record = nullptr);
+
+    /** \brief Remonta o arquivo descrito por \p recipe_path em \p dst, com o mtime original.
+     *  \param bytes recebe o número de bytes escritos
+     */
+    bool restore_file(const std::string& recipe_path, const std::string& dst, std::uint64_t& bytes);
+
+    /** \brief Entrega o conteúdo remontado a \p sink, um chunk por chamada.
+     *  \details Cada chunk é conferido contra o seu id; retorna false se a
+     *  receita ou um chunk faltar, estiver corrompido, ou se \p sink retornar false.
+     */
+    bool read_file(const Recipe& recipe,
+                   const std::function<bool(const char*, std::size_t)>& sink) const;
+
+    /** \brief Apaga os chunks que nenhuma receita referencia (mark-sweep), até \p deadline.
+     *  \details Um ciclo de coleta pode se estender por várias chamadas, e as
+     *  duas fases contam no prazo. A marcação lê as receitas em ordem de
+     *  caminho e acrescenta os chunks delas a <pen>/.tp2_chunks/gc_live; a
+     *  varredura percorre os 256 subdiretórios apagando o que não está lá.
+     *  O ponto de parada de cada fase fica em <pen>/.tp2_chunks/gc_cursor, e
+     *  a chamada seguinte continua dali; toda chamada avança ao menos uma
+     *  receita ou um subdiretório. Enquanto um ciclo está em andamento,
+     *  store_file() também acrescenta ao gc_live os chunks das receitas que
+     *  grava, então backups entre duas chamadas não perdem chunks. Uma
+     *  receita ilegível (truncada, corrompida) interrompe a coleta antes da
+     *  varredura, já que os chunks dela pareceriam sem uso; sobras "*.tmp"
+     *  de um save_recipe() interrompido são ignoradas. Não deve rodar junto
+     *  com um backup no mesmo PEN.
+     */
+    GcResult collect_garbage(std::chrono::steady_clock::time_point deadline);
+
+    /** \brief Chunks efetivamente gravados por esta instância (os demais já existiam). */
+    std::uint64_t chunks_written() const { return chunks_written_; }
+    /** \brief Bytes de chunks efetivamente gravados por esta instância. */
+    std::uint64_t bytes_written() const { return bytes_written_; }
+
+private:
+    bool put_chunk(const ChunkId& id, const char* data, std::size_t len);
+    bool append_live(const std::vector<ChunkId>& ids);
+
+    std::string chunk_root_;
+    std::string recipe_root_;
+    ChunkParams params_;
+    bool compress_ = false;
+    IoThrottle* throttle_ = nullptr;
+    std::atomic<std::uint64_t> chunks_written_{0};
+    std::atomic<std::uint64_t> bytes_written_{0};
+    std::atomic<std::uint64_t> tmp_counter_{0};
+    bool gc_pending_ = false;  ///< havia uma coleta em andamento quando o repositório foi aberto
+    std::mutex gc_mutex_;      ///< serializa os acréscimos a gc_live
+};
+
+} // namespace tp2
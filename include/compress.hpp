@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Tamanho dos blocos independentes de um frame comprimido. */
+constexpr std::size_t kFrameBlockSize = 256 * 1024;
+
+/** \brief Pior caso de saída de lz4_compress() para \p n bytes de entrada. */
+std::size_t lz4_compress_bound(std::size_t n);
+
+/** \brief Maior tamanho possível do frame de \p n bytes (todos os blocos crus). */
+std::uint64_t frame_bound(std::uint64_t n);
+
+/** \brief Comprime um bloco no formato de bloco LZ4 (compressão gulosa, rápida).
+ *  \return bytes gravados em \p dst, ou 0 se não couber em \p capacity
+ */
+std::size_t lz4_compress(const char* src, std::size_t n, char* dst, std::size_t capacity);
+
+/** \brief Descomprime um bloco LZ4 com verificação de limites.
+ *  \return false se a entrada for inválida ou não produzir exatamente \p raw_len bytes
+ */
+bool lz4_decompress(const char* src, std::size_t n, char* dst, std::size_t raw_len);
+
+/** \brief Indica se o conteúdo já vem comprimido (jpg, png, zip, gz, xz, zstd, mp4...).
+ *  \details Decide pela extensão de \p name e pelos bytes mágicos de \p head;
+ *  esses arquivos são gravados como estão, sem frame.
+ */
+bool is_precompressed(const std::string& name, const char* head, std::size_t n);
+
+/** \brief Indica se \p data começa com a assinatura de frame do tp2. */
+bool is_framed(const char* data, std::size_t n);
+
+/** \brief Comprime um buffer inteiro num frame.
+ *  \return false (e \p out indefinido) se o frame não ficar menor que o original
+ */
+bool encode_frame(const char* data, std::size_t n, std::vector<char>& out);
+
+/** \brief Conteúdo original de um buffer: decodifica se for frame, senão copia. */
+bool decode_buffer(const char* data, std::size_t n, std::vector<char>& out);
+
+/** \brief Comprime \p in em \p out num pipeline: leitura, compressão em \p threads
+ *  threads e escrita na ordem original.
+ *  \details O arquivo é dividido em blocos de kFrameBlockSize comprimidos de
+ *  forma independente; blocos que não diminuem são gravados crus. No máximo
+ *  2 * threads blocos ficam em memória. \p on_raw recebe cada bloco original,
+ *  em ordem (ex.: para calcular o hash do conteúdo).
+ *  \return false em falha de leitura ou escrita
+ */
+bool compress_stream(std::istream& in, std::ostream& out, unsigned threads,
+                     const std::function<void(const char*, std::size_t)>& on_raw);
+
+/** \brief Lê um arquivo do PEN entregando o conteúdo original a \p sink.
+ *  \details Frames são descomprimidos; qualquer outro conteúdo é repassado
+ *  como está, então arquivos gravados sem compressão continuam legíveis.
+ *  Por isso conteúdo que já começa com a assinatura de frame é sempre
+ *  gravado no PEN dentro de um frame, com ou sem --compress.
+ *  \return false se o frame estiver truncado/corrompido ou se \p sink retornar false
+ */
+bool read_stored(std::istream& in, const std::function<bool(const char*, std::size_t)>& sink);
+
+} // namespace tp2
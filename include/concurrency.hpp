@@ -0,0 +1,120 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Limite adaptativo de cópias simultâneas num dispositivo (controle por gradiente).
+ *  \details A cada janela de cópias concluídas mede a vazão e a latência por
+ *  byte (tempo da cópia / (bytes + kItemOverhead), o que põe arquivos grandes
+ *  e pequenos na mesma escala). Enquanto a latência fica perto da menor já
+ *  vista, o dispositivo ainda tem folga e o limite cresce ~sqrt(limite) por
+ *  janela; perto do joelho cresce de um em um, e quando mais cópias só
+ *  aumentam a espera o gradiente (menor latência / latência atual) puxa o
+ *  limite de volta. O limite se acomoda no joelho da curva de vazão: 1 ou 2
+ *  num pendrive USB, bem mais num NVMe. A cada kProbeWindows janelas o
+ *  limite cai à metade e a menor latência é medida de novo, então uma
+ *  medição de sorte (ou um disco que ficou mais lento) não prende o limite.
+ */
+class AdaptiveLimit {
+public:
+    static constexpr std::uint64_t kItemOverhead = 64 * 1024;
+    static constexpr std::chrono::milliseconds kMinWindow{50};
+    static constexpr unsigned kProbeWindows = 200;
+
+    AdaptiveLimit(unsigned min_limit, unsigned max_limit, unsigned initial);
+
+    /** \brief Espera uma vaga (cópias em andamento < limite) e a ocupa. */
+    void acquire();
+
+    /** \brief Devolve a vaga de uma cópia de \p bytes bytes que levou \p seconds segundos.
+     *  \details Uma cópia que falhou entra com 0 bytes: libera a vaga sem virar amostra.
+     */
+    void release(std::uint64_t bytes, double seconds);
+
+    /** \brief Limite atual, arredondado. */
+    unsigned limit() const;
+    /** \brief Vazão (bytes/s) medida na última janela; 0 antes da primeira. */
+    double throughput() const;
+    /** \brief Maior número de cópias simultâneas já atingido. */
+    unsigned peak() const;
+
+private:
+    void adjust(std::chrono::steady_clock::time_point now);
+
+    const double min_, max_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    double limit_;
+    unsigned in_flight_ = 0;
+    unsigned peak_ = 0;
+    // Current window.
+    std::chrono::steady_clock::time_point window_start_;
+    std::uint64_t window_bytes_ = 0;
+    double window_cost_ = 0;    ///< soma dos tempos das cópias
+    double window_weight_ = 0;  ///< soma de bytes + kItemOverhead
+    unsigned window_samples_ = 0;
+    double min_latency_ = 0;    ///< menor latência por byte vista (0 = nenhuma)
+    unsigned windows_ = 0;
+    double throughput_ = 0;
+};
+
+/** \brief Um AdaptiveLimit por dispositivo (st_dev), criados conforme aparecem (modo --jobs auto).
+ *  \details Cada cópia ocupa uma vaga no dispositivo de origem e uma no de
+ *  destino, então uma execução HD NVMe -> pendrive USB acha o limite de cada
+ *  lado. Seguro para uso concorrente.
+ */
+class AdaptiveConcurrency {
+public:
+    static constexpr unsigned kMaxLimit = 16;  ///< teto por dispositivo (e threads do pool)
+
+    explicit AdaptiveConcurrency(unsigned max_limit = kMaxLimit, unsigned initial = 2)
+        : max_(max_limit == 0 ? 1 : max_limit), initial_(initial) {}
+
+    /** \brief Vagas de uma cópia nos dispositivos \p devices (iguais contam uma vez).
+     *  \details Ocupa as vagas na construção, em ordem crescente de
+     *  dispositivo (duas cópias nunca esperam uma pela outra em ciclo), e as
+     *  devolve na destruição. Com \p owner nulo não faz nada.
+     */
+    class Slot {
+    public:
+        Slot(AdaptiveConcurrency* owner, std::vector<std::uint64_t> devices);
+        ~Slot();
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+
+        /** \brief Marca a cópia como concluída com \p bytes bytes (sem isto, conta como falha). */
+        void done(std::uint64_t bytes) { bytes_ = bytes; }
+
+    private:
+        std::vector<AdaptiveLimit*> limits_;
+        std::chrono::steady_clock::time_point start_;
+        std::uint64_t bytes_ = 0;
+    };
+
+    /** \brief Situação de um dispositivo. */
+    struct DeviceState {
+        std::uint64_t device = 0;
+        unsigned limit = 0;
+        unsigned peak = 0;
+        double throughput = 0;  ///< bytes/s na última janela
+    };
+
+    /** \brief Situação de cada dispositivo visto, em ordem de dispositivo. */
+    std::vector<DeviceState> devices() const;
+
+private:
+    AdaptiveLimit& limit_for(std::uint64_t device);
+
+    unsigned max_, initial_;
+    mutable std::mutex mutex_;
+    std::map<std::uint64_t, std::unique_ptr<AdaptiveLimit>> limits_;
+};
+
+} // namespace tp2
@@ -0,0 +1,40 @@
+#pragma once
+#include "backup.hpp"
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Trata um pedido ao daemon: \p args como os do tp2_cli; saída e erros vão para \p out e \p err.
+ *  \return código de saída do pedido
+ */
+using RequestHandler =
+    std::function<int(const std::vector<std::string>& args, std::ostream& out, std::ostream& err)>;
+
+/** \brief Atende pedidos num socket UNIX local até \p stop ficar verdadeiro.
+ *  \details Um pedido por conexão. As execuções (\p handler) são atendidas
+ *  uma de cada vez, por ordem de chegada (duas execuções nunca disputam o
+ *  mesmo PEN); \p control, se houver, vê cada pedido antes e responde na
+ *  hora os que reconhecer, mesmo durante uma execução (ex.: mudar limites). Pedido: "tp2 1 <n>\n" seguido de \c n
+ *  argumentos terminados por '\\0'. Resposta: "<código> <bytes de saída>
+ *  <bytes de erro>\n" seguida dos dois textos. O socket é criado com
+ *  permissão 0600 (só o dono do daemon pode pedir execuções) e removido ao
+ *  final; um socket abandonado por um daemon que caiu é substituído. Ao
+ *  parar, as execuções já recebidas são concluídas.
+ *  \param control retorna o código de saída, ou -1 para repassar o pedido a \p handler
+ *  \return 0 ao encerrar; 1 se o caminho for inválido; 2 se outro daemon já
+ *  atende nesse socket; 5 se não for possível criar o socket
+ */
+ActionResult serve_requests(const std::string& socketPath, const RequestHandler& handler,
+                            const std::atomic<bool>& stop, const RequestHandler& control = nullptr);
+
+/** \brief Envia \p args ao daemon em \p socketPath e repassa a saída e os erros recebidos.
+ *  \return código de saída do pedido; 4 se nenhum daemon atender; 5 se a conexão cair
+ */
+ActionResult send_request(const std::string& socketPath, const std::vector<std::string>& args,
+                          std::ostream& out, std::ostream& err);
+
+} // namespace tp2
@@ -0,0 +1,129 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Classe do dispositivo de bloco onde está um caminho. */
+enum class DeviceClass { Generic,    ///< não identificado (tmpfs, rede, ...): ajustes fixos
+                         Rotational, ///< disco rígido
+                         Ssd,        ///< SSD/NVMe
+                         Removable   ///< pendrive USB, cartão, ou sistema FAT/exFAT
+};
+
+/** \brief Quando as cópias são levadas ao dispositivo (fsync). */
+enum class FsyncPolicy { None, ///< fica a cargo do kernel
+                         Run,  ///< um syncfs no fim da execução
+                         File  ///< fdatasync de cada arquivo copiado
+};
+
+/** \brief Ajustes de E/S para uma classe de dispositivo.
+ *  \details Os valores de Generic reproduzem o comportamento sem perfil.
+ *  \c direct_io tira do cache de páginas os arquivos copiados
+ *  (posix_fadvise DONTNEED): numa cópia grande para um pendrive lento, o
+ *  cache não se enche de páginas sujas que travam o resto do sistema.
+ *  Com \c erase_block, as cópias para o dispositivo gravam um arquivo por
+ *  vez, em blocos inteiros desse tamanho alinhados no arquivo, cada um
+ *  mandado ao dispositivo assim que fica pronto: o controlador de um
+ *  pendrive barato recebe blocos de apagamento inteiros em vez de pedaços
+ *  de vários arquivos intercalados.
+ */
+struct DeviceProfile {
+    DeviceClass device_class = DeviceClass::Generic;
+    std::string filesystem = "unknown";   ///< tipo do sistema de arquivos (statfs)
+    std::size_t buffer_size = 256 * 1024; ///< bloco de leitura/gravação das cópias
+    unsigned queue_depth = 1;             ///< cópias simultâneas sugeridas (--jobs, quando não dado)
+    FsyncPolicy fsync = FsyncPolicy::None;
+    bool direct_io = false;
+    std::size_t erase_block = 0;          ///< gravação agrupada em blocos deste tamanho (0 = desligada)
+};
+
+/** \brief Nome curto da classe ("generic", "hdd", "ssd", "usb"). */
+const char* device_class_name(DeviceClass cls);
+
+/** \brief Classe do dispositivo de \p path, lida de <sysfs>/dev/block/<maj>:<min>.
+ *  \details Partições e dispositivos dm/md contam como o disco por baixo
+ *  (o primeiro, se houver vários). Removível ou ligado por USB vira
+ *  Removable; senão queue/rotational decide entre Rotational e Ssd. Sem
+ *  dispositivo de bloco (tmpfs, overlay, rede) o resultado é Generic.
+ */
+DeviceClass detect_device_class(const std::string& path, const std::string& sysfs = "/sys");
+
+/** \brief Tipo do sistema de arquivos de \p path ("ext4", "vfat", ...; "unknown" se não reconhecido). */
+std::string detect_filesystem(const std::string& path);
+
+/** \brief Granularidade do mtime gravado por \p filesystem, em ns (0 = exato ou desconhecido).
+ *  \details FAT e exFAT guardam o mtime em passos de 2 s; o que volta de um
+ *  stat pode ficar até isso atrás do mtime que foi gravado.
+ */
+std::int64_t mtime_granularity_ns(const std::string& filesystem);
+
+/** \brief Perfil padrão para a classe \p cls e o sistema de arquivos \p filesystem.
+ *  \details Um sistema FAT/exFAT num dispositivo não identificado é tratado como removível.
+ */
+DeviceProfile profile_for(DeviceClass cls, const std::string& filesystem);
+
+/** \brief Perfil escolhido: "<classe>[,chave=valor...]".
+ *  \details A classe é "auto" (detectada), "generic", "hdd", "ssd" ou "usb";
+ *  as chaves sobrepõem o perfil da classe: buffer=<bytes, aceita K/M>,
+ *  queue=<n>, fsync=<none|run|file>, direct=<on|off>,
+ *  erase=<bytes, aceita K/M|off>. Ex.: "auto,fsync=none".
+ */
+struct ProfileSpec {
+    bool detect = true;                       ///< classe "auto"
+    DeviceClass device_class = DeviceClass::Generic;
+    std::size_t buffer_size = 0;              ///< 0 = o da classe
+    unsigned queue_depth = 0;                 ///< 0 = o da classe
+    int fsync = -1;                           ///< FsyncPolicy, ou -1 = o da classe
+    int direct_io = -1;                       ///< 0/1, ou -1 = o da classe
+    std::int64_t erase_block = -1;            ///< bytes (0 = off), ou -1 = o da classe
+};
+
+/** \brief Interpreta \p text (ver ProfileSpec). \return false com \p error preenchido se inválido. */
+bool parse_profile_spec(const std::string& text, ProfileSpec& spec, std::string& error);
+
+/** \brief Descrição de uma linha: "hdd, ext4: buffer 1024 KiB, queue 2, fsync run, direct off, erase off". */
+std::string describe_profile(const DeviceProfile& profile);
+
+/** \brief Perfil de cada dispositivo (st_dev) usado numa execução, detectado na primeira vez que aparece.
+ *  \details Seguro para uso concorrente; a referência devolvida por
+ *  for_path() vale enquanto o objeto existir.
+ */
+class DeviceProfiles {
+public:
+    explicit DeviceProfiles(ProfileSpec spec = {}, std::string sysfs = "/sys")
+        : spec_(spec), sysfs_(std::move(sysfs)) {}
+
+    /** \brief Perfil do dispositivo onde está \p path. */
+    const DeviceProfile& for_path(const std::string& path);
+
+    /** \brief Um dispositivo visto: o primeiro caminho pedido nele e o seu perfil. */
+    struct Device {
+        std::uint64_t device = 0;
+        std::string path;
+        DeviceProfile profile;
+    };
+
+    /** \brief Dispositivos vistos até agora, em ordem de dispositivo. */
+    std::vector<Device> devices() const;
+
+    /** \brief Trava de gravação do dispositivo de \p path: com erase_block, quem a
+     *  detém é o único arquivo sendo gravado nele.
+     */
+    std::mutex& write_gate(const std::string& path);
+
+private:
+    ProfileSpec spec_;
+    std::string sysfs_;
+    mutable std::mutex mutex_;
+    std::map<std::uint64_t, Device> devices_;
+    std::map<std::uint64_t, std::unique_ptr<std::mutex>> gates_;
+};
+
+} // namespace tp2
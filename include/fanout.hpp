@@ -0,0 +1,65 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Destino de escrita que replica os mesmos blocos em vários arquivos (fan-out).
+ *  \details A fonte é lida uma única vez: cada bloco entregue a write() é
+ *  compartilhado, sem cópias adicionais, pelas filas de todos os destinos.
+ *  No modo com threads, cada destino tem a sua thread de escrita, de modo que
+ *  um pendrive lento só segura os outros quando a sua fila enche
+ *  (kMaxQueued blocos). Um destino que falha é abandonado e os demais
+ *  continuam.
+ */
+class FanoutSink {
+public:
+    static constexpr std::size_t kMaxQueued = 8;
+
+    /** \brief Cria/trunca os arquivos de \p paths.
+     *  \param threaded false escreve tudo na thread chamadora (arquivos pequenos)
+     */
+    FanoutSink(const std::vector<std::string>& paths, bool threaded);
+    ~FanoutSink();
+    FanoutSink(const FanoutSink&) = delete;
+    FanoutSink& operator=(const FanoutSink&) = delete;
+
+    /** \brief Acrescenta \p n bytes a todos os destinos ainda válidos. */
+    void write(const char* data, std::size_t n);
+
+    /** \brief Espera as escritas pendentes e fecha os arquivos.
+     *  \return true se pelo menos um destino foi gravado por inteiro
+     */
+    bool finish();
+
+    /** \brief Indica se o destino \p i foi gravado sem erro (válido após finish()). */
+    bool ok(std::size_t i) const { return dests_[i].ok; }
+
+    std::size_t size() const { return dests_.size(); }
+
+private:
+    using Block = std::shared_ptr<const std::vector<char>>;
+    struct Dest {
+        int fd = -1;
+        bool ok = false;
+        std::deque<Block> queue;
+        std::thread writer;
+    };
+
+    void run_writer(std::size_t i);
+
+    std::vector<Dest> dests_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool threaded_;
+    bool closing_ = false;
+    bool finished_ = false;
+};
+
+} // namespace tp2
@@ -0,0 +1,46 @@
+#pragma once
+#include "backup.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Tabela de arquivos em layout struct-of-arrays para as fases de plano/comparação.
+ *  \details Cada coluna é um vetor contíguo indexado pela entrada: a linha i
+ *  corresponde ao id i da PathArena da execução (os caminhos ficam lá, uma
+ *  única vez) e os resultados de stat de cada lado ficam em vetores separados.
+ *  Assim a comparação percorre só as colunas que usa, sem um objeto
+ *  (string + dois fs::path) por entrada.
+ */
+struct FileTable {
+    enum Flag : std::uint8_t { HdExists = 1, HdDir = 2, PenExists = 4, PenDir = 8 };
+
+    std::vector<std::uint8_t> flags;        ///< combinação de Flag
+    std::vector<std::uint64_t> hd_size, pen_size;
+    std::vector<std::int64_t> hd_mtime, pen_mtime; ///< ns desde a época Unix
+
+    // Saídas de classify_table()
+    std::vector<std::uint8_t> action;       ///< valor de PlanAction
+    std::vector<std::uint8_t> to_hd;        ///< 1 = cópia PEN -> HD
+    std::vector<std::uint64_t> bytes;       ///< bytes a copiar
+
+    /** \brief Dimensiona as colunas de entrada para \p n linhas (zeradas). */
+    void resize(std::size_t n);
+
+    std::size_t size() const { return flags.size(); }
+};
+
+/** \brief Decide a ação de todas as entradas da tabela numa única passada.
+ *  \details Laço sem desvios por entrada (só máscaras e seleções aritméticas),
+ *  o que permite ao compilador vetorizá-lo. Regras iguais às da cópia
+ *  individual: fonte ausente = Missing; diretório = Skip; destino ausente =
+ *  Copy; fonte mais nova = Update; no Sync o sentido segue o lado mais novo.
+ *  Mirror classifica como Backup.
+ *  \param mtime_slack_ns Um lado só é "mais novo" se passar do outro por mais
+ *  que isto (a granularidade de mtime do sistema de arquivos, ex.: 2 s no
+ *  FAT). Dentro da janela, mtimes diferentes com tamanhos diferentes contam
+ *  como alteração (no Sync, vale o HD); mtimes iguais, nunca.
+ */
+void classify_table(FileTable& table, Operation op, std::int64_t mtime_slack_ns = 0);
+
+} // namespace tp2
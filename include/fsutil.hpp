@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace tp2 {
+
+/** \brief Resultado de um único stat(2) sobre um caminho. */
+struct FileStat {
+    bool exists = false;        ///< o caminho existe
+    bool is_dir = false;        ///< é diretório
+    std::uint64_t size = 0;     ///< tamanho em bytes
+    std::int64_t mtime_ns = 0;  ///< mtime em ns desde a época Unix
+};
+
+/** \brief Obtém existência, tipo, tamanho e mtime com uma única chamada de sistema. */
+FileStat stat_path(const std::string& path);
+
+/** \brief Dispositivo (st_dev) onde está \p path; 0 se o caminho não existir. */
+std::uint64_t device_of(const std::string& path);
+
+/** \brief Define o mtime (e o atime) de \p path com precisão de nanossegundos. */
+bool set_mtime_ns(const std::string& path, std::int64_t mtime_ns);
+
+/** \brief Leva ao dispositivo tudo o que está pendente no sistema de arquivos de \p path (syncfs). */
+bool sync_filesystem(const std::string& path);
+
+/** \brief Tira do cache de páginas o conteúdo de \p path (posix_fadvise DONTNEED; páginas sujas ficam). */
+void drop_page_cache(const std::string& path);
+
+/** \brief Descritor de arquivo fechado ao sair do escopo. */
+struct Fd {
+    int fd = -1;
+    explicit Fd(int f) : fd(f) {}
+    ~Fd();
+    Fd(const Fd&) = delete;
+    Fd& operator=(const Fd&) = delete;
+
+    /** \brief Fecha agora. \return false se o close falhar (num PEN, pode ser o erro de uma gravação adiada). */
+    bool close();
+};
+
+/** \brief Grava os \p len bytes de \p data em \p fd, repetindo escritas parciais. */
+bool write_all(int fd, const char* data, std::size_t len);
+
+/** \brief Igual a write_all(), a partir do deslocamento \p offset (pwrite). */
+bool pwrite_all(int fd, const char* data, std::size_t len, std::uint64_t offset);
+
+/** \brief Cria os diretórios pais de \p path, tolerando criação concorrente.
+ *  \return false se o diretório pai não existir ao final
+ */
+bool ensure_parent_dirs(const std::string& path);
+
+/** \brief Indica se \p rel é um arquivo de controle do tp2 no PEN.
+ *  \details Arquivos e diretórios na raiz do PEN com prefixo ".tp2" (manifesto,
+ *  quarentena, etc.) não são dados do usuário e ficam fora de listagens.
+ */
+bool is_internal_path(const std::string& rel);
+
+/** \brief Forma canônica de um caminho relativo (separador '/', sem "." nem "//"). */
+std::string normalize_rel(const std::string& rel);
+
+} // namespace tp2
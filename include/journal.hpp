@@ -0,0 +1,79 @@
+#pragma once
+#include "manifest.hpp"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace tp2 {
+
+/** \brief Situação de uma entrada segundo o diário da execução. */
+struct JournalEntry {
+    bool to_hd = false;             ///< sentido da cópia
+    bool done = false;              ///< cópia concluída (senão começou e não terminou)
+    std::int64_t src_mtime_ns = 0;  ///< mtime da fonte no início da cópia
+    std::uint64_t src_size = 0;     ///< tamanho da fonte no início da cópia
+    std::uint64_t offset = 0;       ///< bytes já gravados e sincronizados no destino
+    ManifestEntry record;           ///< registro do manifesto (cópias concluídas para o PEN)
+};
+
+/** \brief Diário de execução no PEN, só de acréscimo, para retomar após uma queda.
+ *  \details Persistido em <pen>/.tp2_journal, um registro por linha:
+ *  - "B <p|h> <mtime_ns> <tamanho> <offset> <caminho>": cópia começou
+ *  - "C <offset> <caminho>": primeiros \c offset bytes já sincronizados no destino
+ *  - "D <p|h> <hash hex> <tamanho> <mtime_ns> <caminho>": cópia concluída
+ *  Vale o último registro de cada caminho; uma linha incompleta (queda no
+ *  meio da escrita) é ignorada. Ao final de uma execução bem-sucedida o
+ *  diário é apagado; se sobrarem cópias inacabadas, só elas são mantidas.
+ *  Seguro para uso concorrente.
+ */
+class RunJournal {
+public:
+    static constexpr const char* kFileName = ".tp2_journal";
+
+    explicit RunJournal(const std::string& penPath);
+    ~RunJournal();
+    RunJournal(const RunJournal&) = delete;
+    RunJournal& operator=(const RunJournal&) = delete;
+
+    /** \brief Lê o diário deixado por uma execução interrompida. \return false se não houver */
+    bool load();
+
+    /** \brief Abre o diário para acréscimo (mantendo o que load() leu). \return false em falha */
+    bool open();
+
+    /** \brief Situação de \p rel. \return false se o caminho não aparece no diário */
+    bool find(const std::string& rel, JournalEntry& out) const;
+
+    /** \brief Cópia de todas as entradas, por caminho. */
+    std::map<std::string, JournalEntry> entries() const;
+
+    /** \brief Indica se há cópias começadas e não concluídas. */
+    bool has_pending() const;
+
+    void begin(const std::string& rel, bool to_hd, std::int64_t src_mtime_ns, std::uint64_t src_size,
+               std::uint64_t offset = 0);
+
+    /** \brief Registra (e sincroniza) que \p offset bytes de \p rel já estão no destino.
+     *  \details O chamador sincroniza o destino antes, para que o registro nunca
+     *  chegue ao disco antes dos dados.
+     */
+    void checkpoint(const std::string& rel, std::uint64_t offset);
+
+    void done(const std::string& rel, bool to_hd, const ManifestEntry& record);
+
+    /** \brief Encerra a execução: apaga o diário ou regrava só as cópias inacabadas.
+     *  \return false em falha de escrita
+     */
+    bool finish();
+
+private:
+    void append(const std::string& line);
+
+    std::string file_;
+    int fd_ = -1;
+    mutable std::mutex mutex_;
+    std::map<std::string, JournalEntry> entries_;
+};
+
+} // namespace tp2
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace tp2 {
+
+/** \brief Metadados gravados para cada arquivo copiado ao PEN. */
+struct ManifestEntry {
+    std::uint64_t size = 0;     ///< tamanho em bytes no momento da cópia
+    std::int64_t mtime_ns = 0;  ///< mtime exato da fonte (ns desde a época Unix)
+    std::uint64_t hash = 0;     ///< hash64 do conteúdo copiado
+};
+
+/** \brief Manifesto do PEN: caminho relativo -> metadados/checksum.
+ *  \details Persistido em <pen>/.tp2_manifest, uma entrada por linha:
+ *  "<hash hex> <tamanho> <mtime_ns> <caminho>". O caminho vem por último para
+ *  aceitar espaços. A gravação é atômica (arquivo temporário + rename).
+ */
+class Manifest {
+public:
+    static constexpr const char* kFileName = ".tp2_manifest";
+
+    /** \brief Carrega o manifesto de \p penPath.
+     *  \return false se o arquivo não existir (manifesto fica vazio)
+     */
+    bool load(const std::string& penPath);
+
+    /** \brief Grava o manifesto em \p penPath. \return false em falha de escrita */
+    bool save(const std::string& penPath) const;
+
+    /** \brief Busca a entrada de \p rel; nullptr se ausente. */
+    const ManifestEntry* find(const std::string& rel) const;
+
+    void set(const std::string& rel, const ManifestEntry& entry);
+    void erase(const std::string& rel);
+
+    std::size_t size() const { return entries_.size(); }
+
+    /** \brief Entradas ordenadas por caminho. */
+    const std::map<std::string, ManifestEntry>& entries() const { return entries_; }
+
+private:
+    std::map<std::string, ManifestEntry> entries_;
+};
+
+} // namespace tp2
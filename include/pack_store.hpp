@@ -0,0 +1,97 @@
+#pragma once
+#include "manifest.hpp"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+class IoThrottle;
+
+/** \brief Posição de um arquivo dentro de um pack. */
+struct PackEntry {
+    std::uint32_t pack = 0;     ///< número do pack (pack-NNNNNN.dat)
+    std::uint64_t offset = 0;   ///< início do conteúdo no pack
+    std::uint64_t length = 0;   ///< tamanho do conteúdo
+    std::int64_t mtime_ns = 0;  ///< mtime da fonte
+    std::uint64_t hash = 0;     ///< hash64 do conteúdo
+};
+
+/** \brief Contêiner de arquivos pequenos no PEN (modo pack).
+ *  \details Arquivos pequenos são acrescentados em sequência a arquivos
+ *  grandes <pen>/.tp2_packs/pack-NNNNNN.dat, trocando centenas de milhares de
+ *  criações de arquivo (e atualizações de diretório/FAT) por escritas
+ *  sequenciais. O índice <pen>/.tp2_packs/index guarda, por caminho, o pack,
+ *  o deslocamento, o tamanho, o mtime e o hash; é gravado de forma atômica ao
+ *  final da execução, então bytes acrescentados sem índice são apenas espaço
+ *  perdido. Versões antigas continuam no pack até uma compactação.
+ *  Seguro para uso concorrente (um mutex protege índice e pack aberto).
+ */
+class PackStore {
+public:
+    static constexpr const char* kDirName = ".tp2_packs";
+    static constexpr std::uint64_t kPackTargetSize = 256ULL * 1024 * 1024; ///< troca de pack acima disto
+
+    explicit PackStore(const std::string& penPath);
+    ~PackStore();
+    PackStore(const PackStore&) = delete;
+    PackStore& operator=(const PackStore&) = delete;
+
+    /** \brief Cobra as leituras e gravações de conteúdo em \p throttle (nulo = sem limite). */
+    void set_throttle(IoThrottle* throttle) { throttle_ = throttle; }
+
+    /** \brief Carrega o índice. \return false se não houver índice (fica vazio) */
+    bool load();
+
+    /** \brief Grava o índice (temporário + rename), depois de um fdatasync do
+     *  que foi acrescentado aos packs. \return false em falha de escrita
+     */
+    bool save() const;
+
+    /** \brief Busca a posição de \p rel. */
+    bool find(const std::string& rel, PackEntry& out) const;
+
+    /** \brief Acrescenta o conteúdo de \p src ao pack corrente e indexa como \p rel.
+     *  \param record recebe tamanho, mtime e hash64 do conteúdo (opcional)
+     */
+    bool append(const std::string& rel, const std::string& src, std::int64_t mtime_ns,
+                ManifestEntry* record = nullptr);
+
+    /** \brief Remove \p rel do índice. \return true se existia */
+    bool erase(const std::string& rel);
+
+    /** \brief Caminhos indexados, em ordem. */
+    std::vector<std::string> paths() const;
+
+    /** \brief Copia o trecho de \p e para \p dst direto no kernel (copy_file_range), com o mtime original.
+     *  \details Os bytes não passam pelo espaço do usuário; se o sistema de
+     *  arquivos não suportar, ou se houver limite de E/S, cai para pread/write.
+     */
+    bool extract(const PackEntry& e, const std::string& dst) const;
+
+    /** \brief Entrega o trecho de \p e a \p sink em blocos. */
+    bool read(const PackEntry& e, const std::function<bool(const char*, std::size_t)>& sink) const;
+
+    std::string pack_path(std::uint32_t pack) const;
+    std::size_t size() const;
+    /** \brief Indica se o índice mudou desde load()/save(). */
+    bool dirty() const;
+
+private:
+    bool open_current();
+
+    std::string dir_;
+    IoThrottle* throttle_ = nullptr;
+    mutable std::mutex mutex_;
+    std::map<std::string, PackEntry> index_;
+    mutable bool dirty_ = false;
+    int fd_ = -1;                  ///< pack aberto para acréscimo
+    std::uint32_t current_ = 0;    ///< número do pack aberto
+    std::uint64_t current_size_ = 0;
+    mutable bool unsynced_ = false; ///< acréscimos ao pack aberto ainda sem fdatasync
+};
+
+} // namespace tp2
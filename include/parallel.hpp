@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Executa fn(i) para i em [0, count) usando até \p jobs threads.
+ *  \details Os índices são distribuídos dinamicamente (fila compartilhada),
+ *  então arquivos grandes não travam os demais. A primeira exceção lançada
+ *  por fn é repassada ao chamador depois que todas as threads terminam.
+ */
+template <typename Fn>
+void parallel_for(std::size_t count, unsigned jobs, Fn&& fn) {
+    if (jobs <= 1 || count <= 1) {
+        for (std::size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        for (;;) {
+            std::size_t i = next.fetch_add(1);
+            if (i >= count) return;
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) error = std::current_exception();
+                next.store(count); // stop handing out work
+            }
+        }
+    };
+    std::size_t n = jobs < count ? jobs : count;
+    std::vector<std::thread> threads;
+    threads.reserve(n);
+    for (std::size_t t = 0; t < n; ++t) threads.emplace_back(worker);
+    for (auto& t : threads) t.join();
+    if (error) std::rethrow_exception(error);
+}
+
+} // namespace tp2
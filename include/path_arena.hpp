@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Arena de caminhos relativos com front coding.
+ *  \details Cada caminho é guardado uma única vez, como (tamanho do prefixo
+ *  comum com o caminho anterior, sufixo). Em listas de backup o prefixo comum
+ *  costuma ser o diretório, então a maior parte dos bytes some. A cada
+ *  kRestartInterval entradas o caminho é gravado inteiro (ponto de reinício),
+ *  o que limita a decodificação de um id a no máximo esse número de passos.
+ *  Os ids são sequenciais (0, 1, 2...) na ordem de inserção.
+ */
+class PathArena {
+public:
+    using Id = std::uint32_t;
+    static constexpr std::uint32_t kRestartInterval = 16;
+
+    /** \brief Acrescenta um caminho e devolve seu id. */
+    Id add(std::string_view path);
+
+    std::size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+
+    /** \brief Decodifica o caminho \p id em \p out (buffer reutilizável). */
+    void get(Id id, std::string& out) const;
+
+    /** \brief Monta "<base>/<caminho>" em \p out, sem alocar se o buffer já tiver capacidade. */
+    void join(std::string_view base, Id id, std::string& out) const;
+
+    /** \brief Cópia do caminho \p id (conveniência; aloca). */
+    std::string str(Id id) const;
+
+    /** \brief Bytes ocupados pela arena (dados codificados + pontos de reinício). */
+    std::size_t bytes_used() const;
+
+    /** \brief Libera a capacidade excedente dos vetores internos. */
+    void shrink_to_fit();
+
+private:
+    void decode_into(Id id, std::string& out, std::size_t offset) const;
+
+    std::vector<char> data_;
+    std::vector<std::uint64_t> restarts_;
+    std::string last_;
+    std::uint32_t count_ = 0;
+};
+
+} // namespace tp2
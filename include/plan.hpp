@@ -0,0 +1,88 @@
+#pragma once
+#include "backup.hpp"
+#include "path_arena.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Ação planejada para uma entrada. */
+enum class PlanAction { Copy,    ///< destino não existe: cópia nova
+                        Update,  ///< destino existe e é mais antigo: sobrescreve
+                        Skip,    ///< nada a fazer (igual, destino mais novo ou diretório)
+                        Missing, ///< entrada listada ausente na fonte
+                        Delete   ///< arquivo obsoleto no PEN (modo Mirror)
+};
+
+/** \brief Uma linha do plano. */
+struct PlanEntry {
+    PathArena::Id path = 0;    ///< id em BackupPlan::paths (como no parm, ou no PEN para Delete)
+    PlanAction action = PlanAction::Skip;
+    bool to_hd = false;        ///< sentido da cópia: false = HD -> PEN, true = PEN -> HD
+    std::uint64_t bytes = 0;   ///< bytes a copiar (0 para Skip/Missing/Delete)
+};
+
+/** \brief Plano de execução com custo estimado. */
+struct BackupPlan {
+    Operation op = Operation::Backup;
+    PathArena paths;                    ///< caminhos relativos das entradas
+    std::vector<PlanEntry> entries;
+    std::uint64_t bytes_to_pen = 0;     ///< total a escrever no PEN
+    std::uint64_t bytes_to_hd = 0;      ///< total a escrever no HD
+    double pen_write_bps = 0;           ///< vazão usada na estimativa (HD -> PEN)
+    double hd_write_bps = 0;            ///< vazão usada na estimativa (PEN -> HD)
+    double estimated_seconds = 0;       ///< duração estimada da execução
+
+    /** \brief Caminho relativo de uma entrada (aloca; para laços use paths.get()). */
+    std::string path_of(const PlanEntry& e) const { return paths.str(e.path); }
+};
+
+/** \brief Vazões medidas em execuções anteriores (persistidas em <pen>/.tp2_stats). */
+struct ThroughputStats {
+    double pen_write_bps = 0; ///< 0 = ainda não medido
+    double hd_write_bps = 0;
+};
+
+/** \brief Vazão assumida quando ainda não há medição (20 MiB/s, típico de pendrive USB 2). */
+constexpr double kDefaultThroughputBps = 20.0 * 1024 * 1024;
+
+/** \brief Fase de planejamento: lê o parm, faz um stat de cada lado e classifica cada entrada.
+ *  \details Não escreve nada. Suporta Backup, Restore, Sync e Mirror (código 2
+ *  para os demais). A estimativa usa as vazões de <pen>/.tp2_stats ou, na
+ *  falta delas, kDefaultThroughputBps.
+ *  \return código 0 em sucesso; 1 se o parm estiver vazio/ausente; 2 ou 3 como em execute_backup()
+ */
+ActionResult plan_backup(const std::string& hdPath,
+                         const std::string& penPath,
+                         const std::string& paramFile,
+                         Operation op,
+                         const BackupOptions& options,
+                         BackupPlan& plan);
+
+/** \brief Fase de execução: aplica um plano (recém-calculado ou carregado de arquivo).
+ *  \details Executa as ações do plano sem reclassificar as entradas; apenas a
+ *  fonte de cada cópia é consultada de novo. Mede a vazão obtida e atualiza
+ *  <pen>/.tp2_stats. Códigos de retorno iguais aos de execute_backup().
+ */
+ActionResult execute_plan(const std::string& hdPath,
+                          const std::string& penPath,
+                          const BackupPlan& plan,
+                          const BackupOptions& options);
+
+/** \brief Grava o plano em texto (uma ação por linha). \return false em falha de escrita */
+bool save_plan(const BackupPlan& plan, const std::string& file);
+
+/** \brief Lê um plano gravado por save_plan(). \return false se o arquivo for inválido */
+bool load_plan(const std::string& file, BackupPlan& plan);
+
+/** \brief Texto legível do plano (usado pelo --dry-run do CLI). */
+std::string format_plan(const BackupPlan& plan);
+
+/** \brief Recalcula totais e duração estimada a partir das entradas e das vazões. */
+void estimate_plan(BackupPlan& plan, const ThroughputStats& stats);
+
+ThroughputStats load_throughput_stats(const std::string& penPath);
+bool save_throughput_stats(const std::string& penPath, const ThroughputStats& stats);
+
+} // namespace tp2
@@ -0,0 +1,84 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Leitura antecipada entre arquivos: enquanto as cópias gravam um
+ *  arquivo, os próximos da fila já vêm do disco de origem.
+ *  \details Em cada passada (Pass), uma thread leitora percorre os arquivos
+ *  na ordem em que as cópias os pegam e pede cada um ao kernel com
+ *  readahead(2) (posix_fadvise WILLNEED onde não há suporte); as cópias
+ *  depois leem do cache de páginas, e o disco de origem e o de destino
+ *  trabalham ao mesmo tempo. Os bytes antecipados e ainda não copiados
+ *  formam a fila, limitada a \c budget bytes (somados entre as passadas em
+ *  andamento) e kMaxQueuedFiles arquivos; de um arquivo maior que o limite
+ *  só o começo é antecipado. Arquivos que uma cópia pegou antes da leitora
+ *  são pulados. Seguro para uso concorrente.
+ */
+class Readahead {
+public:
+    static constexpr std::size_t kMaxQueuedFiles = 256;
+
+    explicit Readahead(std::uint64_t budget) : budget_(budget) {}
+
+    /** \brief Um arquivo a antecipar (tamanho 0 = nada a ler). */
+    struct Item {
+        std::string path;
+        std::uint64_t size = 0;
+    };
+
+    /** \brief A leitora de uma lista de arquivos, parada na destruição.
+     *  \details As cópias avisam quando pegam (started()) e quando terminam
+     *  (finished()) o item i; só então os bytes dele saem da fila. Com
+     *  \p owner nulo não faz nada.
+     */
+    class Pass {
+    public:
+        Pass(Readahead* owner, std::vector<Item> items);
+        ~Pass();
+        Pass(const Pass&) = delete;
+        Pass& operator=(const Pass&) = delete;
+
+        void started(std::size_t i);
+        void finished(std::size_t i);
+
+    private:
+        void run();
+        void release(std::size_t i); // with the owner's mutex held
+
+        Readahead* owner_;
+        std::vector<Item> items_;
+        std::vector<std::uint64_t> held_;  ///< bytes de cada item na fila
+        std::vector<std::uint8_t> taken_;  ///< itens que uma cópia já pegou
+        bool stop_ = false;
+        std::thread thread_;
+    };
+
+    /** \brief Contadores acumulados de todas as passadas. */
+    struct Stats {
+        std::uint64_t files = 0;        ///< arquivos antecipados
+        std::uint64_t bytes = 0;        ///< bytes antecipados
+        std::uint64_t hits = 0;         ///< cópias que encontraram o arquivo já antecipado
+        std::size_t queued_files = 0;   ///< profundidade atual da fila, em arquivos
+        std::uint64_t queued_bytes = 0; ///< ... e em bytes
+        std::size_t peak_files = 0;     ///< maior profundidade vista
+        std::uint64_t peak_bytes = 0;
+    };
+
+    Stats stats() const;
+    std::uint64_t budget() const { return budget_; }
+
+private:
+    const std::uint64_t budget_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    Stats stats_;
+};
+
+} // namespace tp2
@@ -0,0 +1,110 @@
+#pragma once
+#include "backup.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Uma linha do arquivo de jobs: um trio (hd, pen, parm) com modo e peso. */
+struct Job {
+    std::string name;
+    Operation op = Operation::Backup;
+    std::string hd;
+    std::string pen;
+    std::string parm;
+    unsigned weight = 1;  ///< fatia relativa de banda quando há disputa
+};
+
+/** \brief Lê o arquivo de jobs.
+ *  \details Um job por linha: "<nome> <modo> <hd> <pen> <parm> [peso]".
+ *  Campos com espaços vão entre aspas duplas; linhas em branco e iniciadas
+ *  por # ou ; são ignoradas. Caminhos relativos partem do diretório do
+ *  próprio arquivo de jobs. Nomes e PENs não podem se repetir (dois jobs no
+ *  mesmo PEN disputariam o diário e o manifesto: junte as listas).
+ *  \param error recebe "linha N: motivo" quando o arquivo é inválido
+ *  \return false se o arquivo faltar, estiver vazio ou for inválido
+ */
+bool load_jobs(const std::string& file, std::vector<Job>& jobs, std::string& error);
+
+/** \brief Fila justa ponderada (WFQ) de cópias entre vários jobs, com limite por dispositivo.
+ *  \details Cada job é um fluxo com peso e com os dispositivos que usa
+ *  (o do HD e o do PEN). Cada item custa os seus bytes mais kItemOverhead
+ *  (criar um arquivo num pendrive custa mesmo quando ele é pequeno). next()
+ *  entrega o item do fluxo com o menor tempo virtual de término
+ *  (tempo virtual do fluxo + custo / peso) entre os fluxos cujos
+ *  dispositivos têm vaga, de modo que, com disputa, cada job recebe banda
+ *  proporcional ao peso; um job cujo pendrive está ocupado não segura os
+ *  outros. Cada dispositivo atende no máximo \c device_limit itens ao mesmo
+ *  tempo (0 = sem limite), o que evita o vaivém de várias cópias
+ *  concorrentes no mesmo disco. Seguro para uso concorrente.
+ */
+class FairScheduler {
+public:
+    static constexpr std::uint64_t kItemOverhead = 64 * 1024;
+
+    explicit FairScheduler(unsigned device_limit) : device_limit_(device_limit) {}
+
+    /** \brief Registra um fluxo. \return id do fluxo (0, 1, 2...) */
+    std::size_t add_flow(unsigned weight, const std::vector<std::uint64_t>& devices);
+
+    /** \brief Enfileira o item \p item, de \p bytes bytes, no fluxo \p flow (ordem de chegada). */
+    void push(std::size_t flow, std::size_t item, std::uint64_t bytes);
+
+    /** \brief Espera um item elegível e o reserva.
+     *  \return false quando não há mais itens na fila
+     */
+    bool next(std::size_t& flow, std::size_t& item);
+
+    /** \brief Devolve as vagas de dispositivo de um item entregue por next(). */
+    void done(std::size_t flow);
+
+    /** \brief Tempo entre o primeiro item entregue e o último concluído do fluxo (0 se nenhum). */
+    double busy_seconds(std::size_t flow) const;
+
+private:
+    struct Item {
+        std::size_t id;
+        std::uint64_t cost;
+    };
+    struct Flow {
+        unsigned weight = 1;
+        std::vector<std::uint64_t> devices;
+        std::deque<Item> queue;
+        double vtime = 0;  ///< tempo virtual de término do último item entregue
+        bool started = false;
+        std::chrono::steady_clock::time_point first, last;
+    };
+
+    bool devices_free(const Flow& f) const;
+
+    unsigned device_limit_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Flow> flows_;
+    std::map<std::uint64_t, unsigned> busy_;  ///< dispositivo -> itens em andamento
+    double vclock_ = 0;                        ///< tempo virtual de início do último item entregue
+    std::size_t queued_ = 0;
+};
+
+/** \brief Executa vários jobs num só processo, com um pool comum de \c options.jobs threads.
+ *  \details Backup, Restore, Sync e Mirror são planejados primeiro (cada job
+ *  com o seu plano, manifesto e diário, como em execute_backup()) e as
+ *  cópias de todos os jobs passam por um FairScheduler com
+ *  \c device_limit vagas por dispositivo. Os demais modos (Verify,
+ *  Snapshot, Prune) rodam em seguida, um job por vez. As opções valem para
+ *  todos os jobs.
+ *  \param per_job recebe o resultado de cada job, na ordem de \p jobs
+ *  \return código do pior job (3, 5, 6, 4, 2, 1, nesta ordem); removed e
+ *  mismatched trazem os caminhos completos no PEN
+ */
+ActionResult execute_jobs(const std::vector<Job>& jobs, const BackupOptions& options, unsigned device_limit,
+                          std::vector<ActionResult>& per_job);
+
+} // namespace tp2
@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Diretório dos snapshots no PEN (um subdiretório datado por execução). */
+constexpr const char* kSnapshotDir = ".tp2_snapshots";
+
+/** \brief Sufixo do snapshot em construção; só vira snapshot após o rename final. */
+constexpr const char* kSnapshotPartialSuffix = ".partial";
+
+/** \brief Sufixo de um snapshot descartado pelo Prune, ainda sendo apagado. */
+constexpr const char* kSnapshotPruneSuffix = ".prune";
+
+/** \brief Rótulos (YYYYmmdd-HHMMSS[-n]) dos snapshots completos do PEN, do mais antigo ao mais novo. */
+std::vector<std::string> list_snapshots(const std::string& penPath);
+
+/** \brief Rótulo de um novo snapshot, sempre depois de \p newest (o mais novo existente, ou vazio).
+ *  \details \p stamp é a hora atual em UTC (YYYYmmdd-HHMMSS), então a volta
+ *  do horário de verão não põe um snapshot antes do anterior. Se o relógio
+ *  estiver atrás de \p newest, ou no mesmo segundo, o rótulo é a data de
+ *  \p newest com um sufixo de três dígitos (-002, -003, ...), que ordena
+ *  certo como texto.
+ */
+std::string next_snapshot_label(const std::string& stamp, const std::string& newest);
+
+/** \brief Caminho da árvore de um snapshot: <pen>/.tp2_snapshots/<label>. */
+std::string snapshot_path(const std::string& penPath, const std::string& label);
+
+/** \brief Snapshots mantidos por uma política de retenção, em ordem.
+ *  \details Mantém os \p keep_last mais novos, o mais novo de cada um dos
+ *  \p keep_daily últimos dias com snapshot e o mais novo de cada uma das
+ *  \p keep_weekly últimas semanas (segunda a domingo) com snapshot; um
+ *  snapshot escolhido por qualquer regra fica.
+ */
+std::vector<std::string> select_retained(const std::vector<std::string>& labels, unsigned keep_last,
+                                         unsigned keep_daily, unsigned keep_weekly);
+
+/** \brief Uma versão de um arquivo no catálogo: presente, sem mudar, de \c first a \c last. */
+struct CatalogRow {
+    std::string path;           ///< caminho relativo
+    std::string first;          ///< primeiro snapshot com esta versão
+    std::string last;           ///< último snapshot com esta versão
+    std::int64_t mtime_ns = 0;  ///< mtime da versão
+    std::uint64_t size = 0;     ///< tamanho da versão
+};
+
+/** \brief Catálogo dos snapshots: (caminho, data) -> snapshot que contém a versão.
+ *  \details Persistido em <pen>/.tp2_snapshots/catalog, uma versão por linha
+ *  ("<caminho>\\0<first> <last> <mtime_ns> <tamanho>"), ordenado por caminho e
+ *  \c first; cada snapshot também tem uma linha de caminho vazio. Como o
+ *  arquivo é ordenado, resolve() e find() fazem busca binária direto no disco
+ *  (O(log n) leituras), sem carregar o catálogo nem percorrer as árvores: um
+ *  restore "na data X" custa proporcional aos arquivos pedidos, não ao
+ *  histórico. Uma versão inalterada entre snapshots consecutivos ocupa uma
+ *  única linha. Datas são rótulos completos (YYYYmmdd-HHMMSS[-n],
+ *  comparados exatamente) ou prefixos deles ("20240131" = até o fim do dia).
+ */
+class SnapshotCatalog {
+public:
+    static constexpr const char* kFileName = "catalog";
+
+    explicit SnapshotCatalog(const std::string& penPath);
+    ~SnapshotCatalog();
+    SnapshotCatalog(const SnapshotCatalog&) = delete;
+    SnapshotCatalog& operator=(const SnapshotCatalog&) = delete;
+
+    /** \brief Registra o snapshot \p label (mais novo que os já catalogados) com os arquivos \p files.
+     *  \details Usa path, mtime_ns e size de cada item; versões iguais às do
+     *  snapshot anterior só estendem a linha existente. Reescreve o catálogo
+     *  de forma atômica (temporário + rename).
+     *  \return false em falha de escrita
+     */
+    bool add_snapshot(const std::string& label, std::vector<CatalogRow> files);
+
+    /** \brief Retira \p labels do catálogo.
+     *  \details As faixas das versões encolhem para os snapshots que sobram;
+     *  versões que só existiam nos retirados somem.
+     *  \return false em falha de escrita
+     */
+    bool remove_snapshots(const std::vector<std::string>& labels);
+
+    /** \brief Snapshot mais novo com data até \p as_of. \return false se não houver */
+    bool resolve(const std::string& as_of, std::string& label) const;
+
+    /** \brief Versão de \p rel contida no snapshot \p label. \return false se o arquivo não estava nele */
+    bool find(const std::string& rel, const std::string& label, CatalogRow& out) const;
+
+    /** \brief Todas as linhas do catálogo, em ordem. */
+    std::vector<CatalogRow> rows() const;
+
+private:
+    void reopen();
+    bool write(const std::vector<CatalogRow>& rows);
+    bool last_at_or_before(const std::string& rel, const std::string& label, bool prefix, CatalogRow& out) const;
+    bool read_line(std::uint64_t offset, std::string& line, std::uint64_t& next) const;
+
+    std::string file_;
+    int fd_ = -1;                ///< aberto para pread (leituras concorrentes são seguras)
+    std::uint64_t size_ = 0;
+};
+
+} // namespace tp2
@@ -0,0 +1,73 @@
+#pragma once
+#include "manifest.hpp"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+class IoThrottle;
+
+/** \brief Maior arquivo que o FAT32 aceita (4 GiB - 1). */
+constexpr std::uint64_t kFat32MaxFile = (1ULL << 32) - 1;
+
+/** \brief Arquivo do PEN guardado em partes (ver split_copy()).
+ *  \details No lugar do arquivo fica um descritor de uma linha,
+ *  "tp2-split v1 <tamanho> <tamanho da parte>", com o mtime da fonte; as
+ *  partes ficam ao lado, em "<arquivo>.tp2-part-NNN", e não aparecem nas
+ *  listagens do PEN.
+ */
+struct SplitDescriptor {
+    std::uint64_t size = 0;       ///< tamanho do arquivo original
+    std::uint64_t part_size = 0;  ///< tamanho de cada parte (a última pode ser menor)
+
+    std::size_t parts() const {
+        return part_size == 0 ? 0 : static_cast<std::size_t>((size + part_size - 1) / part_size);
+    }
+};
+
+/** \brief Lê o descritor em \p path. \return false se \p path não for um descritor. */
+bool read_split_descriptor(const std::string& path, SplitDescriptor& out);
+
+/** \brief Caminho da parte \p k do arquivo \p path. */
+std::string split_part_path(const std::string& path, std::size_t k);
+
+/** \brief Indica se \p rel é uma parte de arquivo dividido (fica fora das listagens). */
+bool is_split_part(const std::string& rel);
+
+/** \brief Partes de \p path que existem no disco, a partir da parte \p from. */
+std::vector<std::string> split_parts_on_disk(const std::string& path, std::size_t from = 0);
+
+/** \brief Gravação agrupada das partes (ver DeviceProfile::erase_block). */
+struct SplitWrite {
+    std::size_t erase_block = 0;  ///< > 0: uma parte por vez, em blocos inteiros deste tamanho
+    std::mutex* gate = nullptr;   ///< trava de gravação do PEN, mantida enquanto as partes são gravadas
+    bool sync = false;            ///< fdatasync de cada parte antes de soltar a trava
+};
+
+/** \brief Copia \p src para \p dst em partes de até \p part_size bytes.
+ *  \details As partes são gravadas em paralelo, cada uma com
+ *  copy_file_range a partir do seu deslocamento na fonte (com \p throttle,
+ *  ou onde o kernel não suporta, por pread/write cobrados do limite); uma
+ *  thread à parte lê a fonte em ordem para o hash de \p record. Com
+ *  \c write.erase_block, uma única leitura em ordem grava as partes uma
+ *  após a outra, bloco a bloco, segurando \c write.gate. O descritor é
+ *  gravado por último, então uma cópia interrompida não passa por
+ *  completa, e partes de uma versão anterior maior são apagadas.
+ */
+bool split_copy(const std::string& src, const std::string& dst, std::uint64_t part_size, std::int64_t mtime_ns,
+                IoThrottle* throttle, ManifestEntry* record, const SplitWrite& write = {});
+
+/** \brief Remonta em \p dst o arquivo dividido descrito em \p path (partes em paralelo).
+ *  \param bytes recebe o tamanho remontado
+ */
+bool join_copy(const std::string& path, const SplitDescriptor& split, const std::string& dst,
+               std::int64_t mtime_ns, IoThrottle* throttle, std::uint64_t& bytes);
+
+/** \brief Entrega o conteúdo original de um arquivo dividido, em ordem, a \p sink. */
+bool read_split(const std::string& path, const SplitDescriptor& split,
+                const std::function<bool(const char*, std::size_t)>& sink);
+
+} // namespace tp2
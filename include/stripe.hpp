@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Índice de distribuição dos arquivos entre os PENs no modo stripe.
+ *  \details Cada arquivo fica inteiro em um único PEN, identificado pela sua
+ *  posição (0 a pens()-1). O índice é gravado igual em todos os PENs, em
+ *  <pen>/.tp2_layout, uma entrada por linha: "<posição> <tamanho> <caminho>".
+ *  O cabeçalho traz a posição do próprio PEN, o total de PENs e uma geração
+ *  que cresce a cada gravação, de modo que a ordem dos --pen na linha de
+ *  comando não importa e um PEN com índice desatualizado é reconhecido.
+ */
+class StripeLayout {
+public:
+    static constexpr const char* kFileName = ".tp2_layout";
+    static constexpr std::uint64_t kLargeFile = 64ULL * 1024 * 1024; ///< acima disto vai para o PEN menos ocupado
+
+    explicit StripeLayout(std::size_t pens = 0) : loads_(pens, 0) {}
+
+    /** \brief Carrega o índice de \p penPath.
+     *  \param slot recebe a posição desse PEN no conjunto
+     *  \return false se não houver índice ou o cabeçalho for inválido
+     */
+    bool load(const std::string& penPath, std::size_t& slot);
+
+    /** \brief Grava o índice em \p penPath como o PEN da posição \p slot (temporário + rename).
+     *  \details Grava com a geração seguinte à carregada; todos os PENs de uma
+     *  mesma execução recebem a mesma geração.
+     */
+    bool save(const std::string& penPath, std::size_t slot) const;
+
+    /** \brief PEN de \p rel. \return false se o caminho não está no índice */
+    bool find(const std::string& rel, std::size_t& slot) const;
+
+    /** \brief PEN de \p rel, registrando-o com \p size se ainda não estiver no índice.
+     *  \details Um arquivo já distribuído nunca muda de PEN (só o tamanho é
+     *  atualizado). Um arquivo novo é dividido por hash do caminho entre dois
+     *  PENs candidatos e vai para o que tiver menos bytes; a partir de
+     *  kLargeFile, vai para o PEN com menos bytes entre todos.
+     */
+    std::size_t assign(const std::string& rel, std::uint64_t size);
+
+    /** \brief PEN que assign() escolheria para \p rel, sem registrar nada. */
+    std::size_t pick(const std::string& rel, std::uint64_t size) const;
+
+    /** \brief Mantém só as entradas de \p live (ordenado). \return número de entradas removidas */
+    std::size_t retain(const std::vector<std::string>& live);
+
+    std::size_t pens() const { return loads_.size(); }
+    std::size_t size() const { return entries_.size(); }
+    std::uint64_t generation() const { return generation_; }
+    /** \brief Bytes distribuídos em cada PEN. */
+    const std::vector<std::uint64_t>& loads() const { return loads_; }
+
+private:
+    struct Slot {
+        std::size_t pen = 0;
+        std::uint64_t size = 0;
+    };
+
+    std::map<std::string, Slot> entries_;
+    std::vector<std::uint64_t> loads_;
+    std::uint64_t generation_ = 0;
+};
+
+} // namespace tp2
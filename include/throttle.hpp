@@ -0,0 +1,69 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace tp2 {
+
+/** \brief Limitador de taxa (token bucket) compartilhado entre threads.
+ *  \details Cada chamada a acquire() reserva unidades (ex.: bytes) e dorme o
+ *  tempo necessário para que a taxa média não passe de \c rate por segundo.
+ *  A rajada máxima é de um segundo de tokens. Taxa 0 significa sem limite.
+ *  As reservas são atendidas na ordem de chegada, e quem está esperando
+ *  passa a seguir a taxa nova assim que set_rate() é chamado.
+ */
+class RateLimiter {
+public:
+    explicit RateLimiter(std::uint64_t rate_per_sec = 0);
+
+    /** \brief Reserva \p amount unidades, bloqueando se o balde estiver vazio. */
+    void acquire(std::uint64_t amount);
+
+    /** \brief Altera a taxa (0 = sem limite). Seguro para chamar durante o uso. */
+    void set_rate(std::uint64_t rate_per_sec);
+
+    std::uint64_t rate() const;
+
+private:
+    void refill(std::chrono::steady_clock::time_point now);
+
+    mutable std::mutex mutex_;
+    std::uint64_t rate_;
+    double issued_ = 0;    ///< unidades já reservadas, desde o início
+    double supplied_;      ///< unidades já liberadas (rajada inicial + reposição)
+    std::chrono::steady_clock::time_point last_;
+};
+
+/** \brief Limites de E/S: bytes e operações por segundo, de leitura e de escrita (0 = sem limite). */
+struct IoLimits {
+    std::uint64_t read_bytes_per_sec = 0;
+    std::uint64_t write_bytes_per_sec = 0;
+    std::uint64_t read_ops_per_sec = 0;
+    std::uint64_t write_ops_per_sec = 0;
+
+    bool any() const { return read_bytes_per_sec || write_bytes_per_sec || read_ops_per_sec || write_ops_per_sec; }
+};
+
+/** \brief Os quatro limites de IoLimits, compartilhados por todas as threads de uma execução.
+ *  \details Cada bloco lido ou gravado conta uma operação e os seus bytes;
+ *  como os baldes são comuns, o total respeita os limites com qualquer
+ *  número de threads. set_limits() vale também para as esperas em curso.
+ */
+class IoThrottle {
+public:
+    explicit IoThrottle(const IoLimits& limits = {});
+
+    /** \brief Cobra a leitura de um bloco de \p bytes bytes. */
+    void read(std::uint64_t bytes);
+    /** \brief Cobra a gravação de um bloco de \p bytes bytes. */
+    void write(std::uint64_t bytes);
+
+    /** \brief Troca os limites. Seguro para chamar durante o uso. */
+    void set_limits(const IoLimits& limits);
+    IoLimits limits() const;
+
+private:
+    RateLimiter read_bytes_, write_bytes_, read_ops_, write_ops_;
+};
+
+} // namespace tp2
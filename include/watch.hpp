@@ -0,0 +1,50 @@
+#pragma once
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace tp2 {
+
+/** \brief Observa, via inotify, as entradas de uma lista e acumula as que mudaram.
+ *  \details Observa o diretório pai de cada entrada (não a entrada em si), o
+ *  que pega também gravações por "arquivo temporário + rename" e arquivos que
+ *  ainda não existem. Um diretório pai ausente é observado assim que aparecer;
+ *  um diretório observado que for apagado ou movido marca todas as suas
+ *  entradas como alteradas. Eventos de nomes fora da lista são descartados.
+ */
+class ChangeWatcher {
+public:
+    explicit ChangeWatcher(const std::string& root);
+    ~ChangeWatcher();
+    ChangeWatcher(const ChangeWatcher&) = delete;
+    ChangeWatcher& operator=(const ChangeWatcher&) = delete;
+
+    /** \brief Indica se o inotify está disponível. */
+    bool ok() const { return fd_ >= 0; }
+
+    /** \brief Passa a observar a entrada \p rel (relativa à raiz, como no parm). */
+    void add(const std::string& rel);
+
+    /** \brief Espera até \p timeout_ms por eventos e acrescenta a \p dirty as entradas alteradas.
+     *  \return número de eventos relevantes, ou -1 se a fila do kernel
+     *  transbordou (eventos perdidos: o chamador deve conferir a lista inteira)
+     */
+    int wait(int timeout_ms, std::set<std::string>& dirty);
+
+    /** \brief Diretórios pais ainda não observados (ausentes). */
+    std::size_t unwatched() const;
+
+private:
+    void watch_dir(const std::string& dir, std::set<std::string>* dirty);
+    void lose(int wd, std::set<std::string>& dirty);
+    void mark_all(const std::string& dir, std::set<std::string>& dirty) const;
+
+    int fd_ = -1;
+    std::string root_;
+    std::map<int, std::string> dirs_;                                      ///< watch -> diretório
+    std::map<std::string, int> watches_;                                   ///< diretório -> watch (-1 = ausente)
+    std::map<std::string, std::map<std::string, std::vector<std::string>>> listed_; ///< diretório -> nome -> entradas
+};
+
+} // namespace tp2
@@ -0,0 +1,90 @@
+#include "cache.hpp"
+#include "backup.hpp"
+#include <filesystem>
+#include <utility>
+
+namespace tp2 {
+
+MetadataCache::Stamp MetadataCache::stamp_of(const std::string& file) {
+    FileStat st = stat_path(file);
+    return Stamp{st.exists, st.mtime_ns, st.size};
+}
+
+std::string MetadataCache::manifest_file(const std::string& penPath) {
+    return (std::filesystem::path(penPath) / Manifest::kFileName).string();
+}
+
+std::size_t MetadataCache::params(const std::string& paramFile, PathArena& out) {
+    const Stamp stamp = stamp_of(paramFile);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = params_.find(paramFile);
+    if (it == params_.end() || !(it->second.stamp == stamp)) {
+        ParamList fresh;
+        fresh.stamp = stamp;
+        read_param_arena(paramFile, fresh.paths);
+        it = params_.insert_or_assign(paramFile, std::move(fresh)).first;
+    }
+    out = it->second.paths;
+    return out.size();
+}
+
+bool MetadataCache::take_manifest(const std::string& penPath, Manifest& out) {
+    const Stamp stamp = stamp_of(manifest_file(penPath));
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = manifests_.find(penPath);
+    if (it == manifests_.end()) return false;
+    const bool fresh = it->second.stamp == stamp;
+    if (fresh) out = std::move(it->second.manifest);
+    manifests_.erase(it); // taken (or stale) either way
+    return fresh;
+}
+
+void MetadataCache::put_manifest(const std::string& penPath, Manifest&& manifest) {
+    const Stamp stamp = stamp_of(manifest_file(penPath));
+    std::lock_guard<std::mutex> lock(mutex_);
+    manifests_.insert_or_assign(penPath, CachedManifest{stamp, std::move(manifest)});
+}
+
+std::shared_ptr<const MetadataCache::StatMap> MetadataCache::pen_stats(const std::string& penPath,
+                                                                     const std::string& penRoot) {
+    const Stamp stamp = stamp_of(manifest_file(penPath));
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pen_stats_.find(penRoot);
+    if (it == pen_stats_.end()) return nullptr;
+    const PenStats& entry = it->second;
+    // Someone else wrote to the pen, or the snapshot is too old to trust.
+    if (!entry.confirmed || !(entry.manifest == stamp) ||
+        std::chrono::steady_clock::now() - entry.taken > kStatTtl) {
+        return nullptr;
+    }
+    return entry.stats;
+}
+
+void MetadataCache::stage_pen_stats(const std::string& penRoot, std::shared_ptr<StatMap> stats, bool reused) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PenStats& entry = pen_stats_[penRoot];
+    // Entries reused from the last snapshot were not stat'ed again, so it keeps its age.
+    if (!reused) entry.taken = std::chrono::steady_clock::now();
+    entry.confirmed = false;
+    entry.stats = std::move(stats);
+}
+
+void MetadataCache::confirm_pen_stats(const std::string& penPath, const std::string& penRoot,
+                                      const std::vector<std::string>& touched) {
+    const Stamp stamp = stamp_of(manifest_file(penPath));
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pen_stats_.find(penRoot);
+    if (it == pen_stats_.end() || !it->second.stats) return;
+    for (const auto& rel : touched) it->second.stats->erase(rel);
+    it->second.manifest = stamp;
+    it->second.confirmed = true;
+}
+
+void MetadataCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    params_.clear();
+    manifests_.clear();
+    pen_stats_.clear();
+}
+
+} // namespace tp2
@@ -0,0 +1,142 @@
+#include "checksum.hpp"
+#include <cstring>
+
+namespace tp2 {
+
+namespace {
+constexpr std::uint64_t P1 = 11400714785074694791ULL;
+constexpr std::uint64_t P2 = 14029467366897019727ULL;
+constexpr std::uint64_t P3 = 1609587929392839161ULL;
+constexpr std::uint64_t P4 = 9650029242287828579ULL;
+constexpr std::uint64_t P5 = 2870177450012600261ULL;
+
+inline std::uint64_t rotl(std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+// Little-endian loads; memcpy keeps them alignment-safe.
+inline std::uint64_t read64(const unsigned char* p) { std::uint64_t v; std::memcpy(&v, p, 8); return v; }
+inline std::uint32_t read32(const unsigned char* p) { std::uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+inline std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+inline std::uint64_t merge_round(std::uint64_t acc, std::uint64_t val) {
+    acc ^= round(0, val);
+    return acc * P1 + P4;
+}
+
+// Consume whole 32-byte stripes; the four lanes are independent so they pipeline/vectorize.
+inline const unsigned char* consume_stripes(std::uint64_t v[4], const unsigned char* p, const unsigned char* end) {
+    std::uint64_t a = v[0], b = v[1], c = v[2], d = v[3];
+    while (p + 32 <= end) {
+        a = round(a, read64(p));
+        b = round(b, read64(p + 8));
+        c = round(c, read64(p + 16));
+        d = round(d, read64(p + 24));
+        p += 32;
+    }
+    v[0] = a; v[1] = b; v[2] = c; v[3] = d;
+    return p;
+}
+}
+
+Hasher64::Hasher64(std::uint64_t seed) : seed_(seed) {
+    v_[0] = seed + P1 + P2;
+    v_[1] = seed + P2;
+    v_[2] = seed;
+    v_[3] = seed - P1;
+}
+
+void Hasher64::update(const void* data, std::size_t len) {
+    auto p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + len;
+    total_ += len;
+
+    if (buf_len_ + len < 32) {
+        if (len) std::memcpy(buf_ + buf_len_, p, len);
+        buf_len_ += len;
+        return;
+    }
+    if (buf_len_ > 0) {
+        std::size_t fill = 32 - buf_len_;
+        std::memcpy(buf_ + buf_len_, p, fill);
+        consume_stripes(v_, buf_, buf_ + 32);
+        p += fill;
+        buf_len_ = 0;
+    }
+    p = consume_stripes(v_, p, end);
+    if (p < end) {
+        buf_len_ = static_cast<std::size_t>(end - p);
+        std::memcpy(buf_, p, buf_len_);
+    }
+}
+
+std::uint64_t Hasher64::digest() const {
+    std::uint64_t h;
+    if (total_ >= 32) {
+        h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+        for (auto v : v_) h = merge_round(h, v);
+    } else {
+        h = seed_ + P5;
+    }
+    h += total_;
+
+    const unsigned char* p = buf_;
+    const unsigned char* end = buf_ + buf_len_;
+    while (p + 8 <= end) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * P1 + P4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<std::uint64_t>(read32(p)) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * P5;
+        h = rotl(h, 11) * P1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+std::uint64_t hash64(const void* data, std::size_t len, std::uint64_t seed) {
+    Hasher64 h(seed);
+    h.update(data, len);
+    return h.digest();
+}
+
+std::string hash_to_hex(std::uint64_t h) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out(16, '0');
+    for (int i = 15; i >= 0; --i) {
+        out[i] = digits[h & 0xF];
+        h >>= 4;
+    }
+    return out;
+}
+
+bool hash_from_hex(const std::string& text, std::uint64_t& out) {
+    if (text.size() != 16) return false;
+    std::uint64_t v = 0;
+    for (char c : text) {
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= static_cast<std::uint64_t>(c - '0');
+        else if (c >= 'a' && c <= 'f') v |= static_cast<std::uint64_t>(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v |= static_cast<std::uint64_t>(c - 'A' + 10);
+        else return false;
+    }
+    out = v;
+    return true;
+}
+
+} // namespace tp2
@@ -0,0 +1,444 @@
+#include "chunk_store.hpp"
+#include "checksum.hpp"
+#include "compress.hpp"
+#include "fsutil.hpp"
+#include "throttle.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <unistd.h>
+
+namespace tp2 {
+
+namespace {
+struct GearTable {
+    std::uint64_t v[256];
+};
+
+// 256 pseudo-random 64-bit values (splitmix64), fixed at compile time so cut
+// points are identical across runs and machines.
+constexpr GearTable make_gear_table() {
+    GearTable t{};
+    std::uint64_t state = 0x7470325F67656172ULL; // "tp2_gear"
+    for (int i = 0; i < 256; ++i) {
+        state += 0x9E3779B97F4A7C15ULL;
+        std::uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        t.v[i] = z ^ (z >> 31);
+    }
+    return t;
+}
+
+constexpr GearTable kGear = make_gear_table();
+constexpr std::uint64_t kSecondSeed = 0x9E3779B97F4A7C15ULL;
+
+// Mask over the top bits of the fingerprint: with the left-shifting gear hash
+// those are the bits that depend on the most recent bytes.
+std::uint64_t high_mask(unsigned bits) {
+    return bits == 0 ? 0 : ~std::uint64_t{0} << (64 - bits);
+}
+
+unsigned log2_floor(std::uint32_t v) {
+    unsigned bits = 0;
+    while (v >>= 1) ++bits;
+    return bits;
+}
+}
+
+std::size_t fastcdc_cut(const std::uint8_t* data, std::size_t n, const ChunkParams& params) {
+    if (n <= params.min_size) return n;
+    const std::size_t end = std::min<std::size_t>(n, params.max_size);
+    const std::size_t normal = std::min<std::size_t>(params.avg_size, end);
+    // Normalized chunking: two extra bits before the average size, two fewer after it.
+    const unsigned bits = log2_floor(params.avg_size);
+    const std::uint64_t mask_small = high_mask(bits + 2);
+    const std::uint64_t mask_large = high_mask(bits > 2 ? bits - 2 : 1);
+    std::uint64_t fp = 0;
+    std::size_t i = params.min_size;
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + kGear.v[data[i]];
+        if (!(fp & mask_small)) return i + 1;
+    }
+    for (; i < end; ++i) {
+        fp = (fp << 1) + kGear.v[data[i]];
+        if (!(fp & mask_large)) return i + 1;
+    }
+    return end;
+}
+
+std::string ChunkId::hex() const {
+    return hash_to_hex(hi) + hash_to_hex(lo);
+}
+
+bool ChunkId::from_hex(const std::string& text, ChunkId& out) {
+    if (text.size() != 32) return false;
+    return hash_from_hex(text.substr(0, 16), out.hi) && hash_from_hex(text.substr(16), out.lo);
+}
+
+namespace {
+constexpr const char* kGcCursor = "gc_cursor"; // "mark <last recipe>" or "sweep <shard>" during a cycle
+constexpr const char* kGcLive = "gc_live";     // chunk ids marked so far, one per line
+
+// Call visit(rel, path) for each file under dir in path order (names sorted at every level),
+// starting after the file whose path components are after[depth..] (empty: from the first).
+// Returns false as soon as visit does.
+bool walk_recipes(const std::filesystem::path& dir, const std::string& prefix, const std::vector<std::string>& after,
+                  std::size_t depth, const std::function<bool(const std::string&, const std::string&)>& visit) {
+    namespace fs = std::filesystem;
+    std::vector<std::pair<std::string, bool>> entries; // name, is a directory
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::error_code type_ec;
+        entries.emplace_back(it->path().filename().string(), it->is_directory(type_ec));
+    }
+    std::sort(entries.begin(), entries.end());
+    const std::vector<std::string> none;
+    const bool resuming = depth < after.size();
+    for (const auto& entry : entries) {
+        if (resuming && entry.first < after[depth]) continue;
+        const bool on_cursor = resuming && entry.first == after[depth];
+        const std::string rel = prefix + entry.first;
+        if (entry.second) {
+            if (!walk_recipes(dir / entry.first, rel + "/", on_cursor ? after : none, depth + 1, visit)) return false;
+        } else if (!on_cursor && !visit(rel, (dir / entry.first).string())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<ChunkId> load_live(const std::string& path) {
+    std::vector<ChunkId> live;
+    std::ifstream in(path);
+    std::string line;
+    ChunkId id;
+    while (std::getline(in, line)) {
+        if (ChunkId::from_hex(line, id)) live.push_back(id);
+    }
+    return live;
+}
+}
+
+ChunkId chunk_id(const void* data, std::size_t len) {
+    return {hash64(data, len, 0), hash64(data, len, kSecondSeed)};
+}
+
+bool save_recipe(const Recipe& recipe, const std::string& path) {
+    namespace fs = std::filesystem;
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        out << "# tp2 recipe v1\n";
+        out << "file " << recipe.size << ' ' << recipe.mtime_ns << ' ' << hash_to_hex(recipe.hash) << '\n';
+        for (const auto& c : recipe.chunks) out << c.id.hex() << ' ' << c.size << '\n';
+        out.flush();
+        if (!out.good()) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) return false;
+    return set_mtime_ns(path, recipe.mtime_ns);
+}
+
+bool load_recipe(const std::string& path, Recipe& recipe) {
+    std::ifstream in(path);
+    if (!in.is_open()) return false;
+    Recipe loaded;
+    bool have_header = false;
+    std::uint64_t total = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream ss(line);
+        std::string word;
+        ss >> word;
+        if (word == "file") {
+            std::string hex;
+            if (!(ss >> loaded.size >> loaded.mtime_ns >> hex) || !hash_from_hex(hex, loaded.hash)) return false;
+            have_header = true;
+        } else {
+            Recipe::Chunk c;
+            if (!ChunkId::from_hex(word, c.id) || !(ss >> c.size) || c.size == 0) return false;
+            total += c.size;
+            loaded.chunks.push_back(c);
+        }
+    }
+    if (!have_header || total != loaded.size) return false;
+    recipe = std::move(loaded);
+    return true;
+}
+
+ChunkStore::ChunkStore(const std::string& penPath, ChunkParams params)
+    : chunk_root_((std::filesystem::path(penPath) / kChunkDir).string()),
+      recipe_root_((std::filesystem::path(penPath) / kRecipeDir).string()),
+      params_(params) {
+    std::ifstream cursor(chunk_root_ + "/" + kGcCursor);
+    std::string phase;
+    gc_pending_ = (cursor >> phase) && (phase == "mark" || phase == "sweep");
+}
+
+bool ChunkStore::append_live(const std::vector<ChunkId>& ids) {
+    if (ids.empty()) return true;
+    std::lock_guard<std::mutex> lock(gc_mutex_);
+    std::ofstream out(chunk_root_ + "/" + kGcLive, std::ios::app);
+    for (const auto& id : ids) out << id.hex() << '\n';
+    out.close();
+    return !out.fail();
+}
+
+std::string ChunkStore::chunk_path(const ChunkId& id) const {
+    std::string hex = id.hex();
+    std::string path;
+    path.reserve(chunk_root_.size() + hex.size() + 4);
+    path.append(chunk_root_).append(1, '/').append(hex, 0, 2).append(1, '/').append(hex);
+    return path;
+}
+
+bool ChunkStore::put_chunk(const ChunkId& id, const char* data, std::size_t len) {
+    namespace fs = std::filesystem;
+    const std::string path = chunk_path(id);
+    if (stat_path(path).exists) return true; // already stored: deduplicated
+    if (!ensure_parent_dirs(path)) return false;
+    // A chunk that happens to start like a frame is always framed, so reads stay unambiguous.
+    std::vector<char> frame;
+    if ((compress_ && !is_precompressed({}, data, len)) || is_framed(data, len)) {
+        if (encode_frame(data, len, frame) || is_framed(data, len)) {
+            data = frame.data();
+            len = frame.size();
+        }
+    }
+    // Unique temporary name, so concurrent writers of the same chunk never share a file.
+    const std::string tmp = path + ".tmp" + std::to_string(::getpid()) + "_" + std::to_string(tmp_counter_++);
+    if (throttle_) throttle_->write(len);
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(data, static_cast<std::streamsize>(len));
+        out.flush();
+        if (!out.good()) {
+            out.close();
+            std::error_code ec;
+            fs::remove(tmp, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        return false;
+    }
+    ++chunks_written_;
+    bytes_written_ += len; // bytes that actually hit the pen
+    return true;
+}
+
+bool ChunkStore::store_file(const std::string& src, std::int64_t mtime_ns,
+                            const std::string& recipe_path, ManifestEntry* record) {
+    std::ifstream in(src, std::ios::binary);
+    if (!in) return false;
+    // Room for several maximal chunks, so cut points are only decided with a full window ahead.
+    std::vector<char> buf(static_cast<std::size_t>(params_.max_size) * 4);
+    std::size_t len = 0;
+    bool eof = false;
+    Recipe recipe;
+    recipe.mtime_ns = mtime_ns;
+    Hasher64 hasher;
+    while (true) {
+        if (!eof) {
+            in.read(buf.data() + len, static_cast<std::streamsize>(buf.size() - len));
+            if (throttle_ && in.gcount() > 0) throttle_->read(static_cast<std::uint64_t>(in.gcount()));
+            len += static_cast<std::size_t>(in.gcount());
+            if (in.bad()) return false;
+            if (!in) eof = true;
+        }
+        std::size_t pos = 0;
+        while (len - pos >= params_.max_size || (eof && pos < len)) {
+            const char* chunk = buf.data() + pos;
+            std::size_t cut = fastcdc_cut(reinterpret_cast<const std::uint8_t*>(chunk), len - pos, params_);
+            ChunkId id = chunk_id(chunk, cut);
+            if (!put_chunk(id, chunk, cut)) return false;
+            hasher.update(chunk, cut);
+            recipe.chunks.push_back({id, static_cast<std::uint32_t>(cut)});
+            recipe.size += cut;
+            pos += cut;
+        }
+        std::memmove(buf.data(), buf.data() + pos, len - pos);
+        len -= pos;
+        if (eof) break;
+    }
+    recipe.hash = hasher.digest();
+    if (!ensure_parent_dirs(recipe_path) || !save_recipe(recipe, recipe_path)) return false;
+    if (gc_pending_) { // a collection cycle is under way: keep these chunks out of its sweep
+        std::vector<ChunkId> ids;
+        for (const auto& c : recipe.chunks) ids.push_back(c.id);
+        if (!append_live(ids)) return false;
+    }
+    if (record) *record = {recipe.size, mtime_ns, recipe.hash};
+    return true;
+}
+
+bool ChunkStore::read_file(const Recipe& recipe,
+                           const std::function<bool(const char*, std::size_t)>& sink) const {
+    std::vector<char> buf, raw;
+    for (const auto& c : recipe.chunks) {
+        const std::string path = chunk_path(c.id);
+        FileStat st = stat_path(path);
+        if (!st.exists || st.size > lz4_compress_bound(c.size) + 64) return false;
+        buf.resize(st.size);
+        if (throttle_) throttle_->read(st.size);
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+        if (static_cast<std::uint64_t>(in.gcount()) != st.size) return false;
+        const std::vector<char>* content = &buf;
+        if (is_framed(buf.data(), buf.size())) {
+            if (!decode_buffer(buf.data(), buf.size(), raw)) return false;
+            content = &raw;
+        }
+        if (content->size() != c.size || chunk_id(content->data(), c.size) != c.id) return false; // corrupted chunk
+        if (!sink(content->data(), c.size)) return false;
+    }
+    return true;
+}
+
+bool ChunkStore::restore_file(const std::string& recipe_path, const std::string& dst, std::uint64_t& bytes) {
+    Recipe recipe;
+    if (!load_recipe(recipe_path, recipe)) return false;
+    std::ofstream out(dst, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    bytes = 0;
+    bool ok = read_file(recipe, [&](const char* data, std::size_t len) {
+        if (throttle_) throttle_->write(len);
+        out.write(data, static_cast<std::streamsize>(len));
+        bytes += len;
+        return out.good();
+    });
+    out.flush();
+    out.close();
+    if (!ok || out.fail() || bytes != recipe.size) return false;
+    return set_mtime_ns(dst, recipe.mtime_ns);
+}
+
+GcResult ChunkStore::collect_garbage(std::chrono::steady_clock::time_point deadline) {
+    namespace fs = std::filesystem;
+    GcResult result;
+    auto less = [](const ChunkId& a, const ChunkId& b) { return a.hi != b.hi ? a.hi < b.hi : a.lo < b.lo; };
+    // Every run does at least one step (a recipe or a shard), so any budget moves the cycle on.
+    bool progressed = false;
+    auto expired = [&] { return progressed && std::chrono::steady_clock::now() >= deadline; };
+    const std::string cursor_file = chunk_root_ + "/" + kGcCursor;
+    const std::string live_file = chunk_root_ + "/" + kGcLive;
+    auto save_cursor = [&](const std::string& phase, const std::string& position) {
+        std::ofstream out(cursor_file, std::ios::trunc);
+        out << phase << ' ' << position << '\n';
+        out.close();
+        return !out.fail();
+    };
+
+    std::string phase, position;
+    {
+        std::ifstream in(cursor_file);
+        in >> phase;
+        in.get();
+        std::getline(in, position);
+    }
+    std::error_code ec;
+    if (!fs::exists(live_file, ec)) phase.clear(); // the marks are gone: only a new cycle is safe
+    if (phase != "mark" && phase != "sweep") { // no cycle under way: start one
+        std::ofstream live(live_file, std::ios::trunc);
+        live.close();
+        if (live.fail() || !save_cursor("mark", "")) return result;
+        phase = "mark";
+        position.clear();
+    }
+
+    if (phase == "mark") {
+        // Mark: the chunks of every recipe go to the live file, recipes in path order from the
+        // saved cursor on. Recipes saved meanwhile add theirs through store_file().
+        std::vector<std::string> after;
+        for (std::size_t pos = 0; !position.empty();) {
+            const std::size_t slash = position.find('/', pos);
+            after.push_back(position.substr(pos, slash == std::string::npos ? std::string::npos : slash - pos));
+            if (slash == std::string::npos) break;
+            pos = slash + 1;
+        }
+        std::vector<ChunkId> marked;
+        Recipe recipe;
+        const bool done = walk_recipes(recipe_root_, "", after, 0, [&](const std::string& rel, const std::string& path) {
+            if (expired()) return false;
+            if (!load_recipe(path, recipe)) {
+                if (path.size() > 4 && path.compare(path.size() - 4, 4, ".tmp") == 0) return true; // interrupted save
+                result.unreadable = path; // its chunks would look unused: stop before the sweep
+                return false;
+            }
+            for (const auto& c : recipe.chunks) marked.push_back(c.id);
+            position = rel;
+            progressed = true;
+            return true;
+        });
+        std::sort(marked.begin(), marked.end(), less);
+        marked.erase(std::unique(marked.begin(), marked.end()), marked.end());
+        if (!append_live(marked)) return result;
+        if (!done) {
+            save_cursor("mark", position);
+            return result;
+        }
+        // Compact the live set once, for the sweep runs to load.
+        std::vector<ChunkId> live = load_live(live_file);
+        std::sort(live.begin(), live.end(), less);
+        live.erase(std::unique(live.begin(), live.end()), live.end());
+        {
+            const std::string tmp = live_file + ".tmp";
+            std::ofstream out(tmp, std::ios::trunc);
+            for (const auto& id : live) out << id.hex() << '\n';
+            out.close();
+            std::error_code ec;
+            if (out.fail() || (fs::rename(tmp, live_file, ec), ec)) return result;
+        }
+        if (!save_cursor("sweep", "0")) return result;
+        phase = "sweep";
+        position = "0";
+    }
+
+    // Sweep: one two-hex-digit shard at a time from the saved cursor, against the live set.
+    std::vector<ChunkId> live = load_live(live_file);
+    std::sort(live.begin(), live.end(), less);
+    unsigned shard = 0;
+    if (std::sscanf(position.c_str(), "%u", &shard) != 1 || shard > 255) shard = 0;
+    for (; shard < 256 && !expired(); ++shard) {
+        progressed = true;
+        char name[3];
+        std::snprintf(name, sizeof(name), "%02x", shard);
+        const fs::path dir = fs::path(chunk_root_) / name;
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            ChunkId id;
+            if (!ChunkId::from_hex(it->path().filename().string(), id)) continue; // temp files and strays
+            if (std::binary_search(live.begin(), live.end(), id, less)) continue;
+            std::error_code size_ec;
+            std::uintmax_t size = it->file_size(size_ec);
+            if (fs::remove(it->path(), ec)) {
+                ++result.chunks_removed;
+                if (!size_ec) result.bytes_removed += size;
+            }
+            ec.clear();
+        }
+        ec.clear();
+    }
+    result.complete = shard == 256;
+    if (!result.complete) {
+        save_cursor("sweep", std::to_string(shard));
+    } else {
+        fs::remove(cursor_file, ec); // the cycle is over
+        fs::remove(live_file, ec);
+    }
+    return result;
+}
+
+} // namespace tp2
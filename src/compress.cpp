@@ -0,0 +1,375 @@
+#include "compress.hpp"
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+
+namespace tp2 {
+
+namespace {
+constexpr char kMagic[8] = {'\x89', 'T', 'P', '2', 'Z', '\r', '\n', '\x1a'};
+constexpr std::uint32_t kRawFlag = 0x80000000u;  // block stored uncompressed
+constexpr std::uint32_t kMaxBlock = 16u << 20;   // sanity bound when reading
+constexpr std::size_t kMinMatch = 4;
+constexpr std::size_t kLastLiterals = 5;         // LZ4: the last 5 bytes are always literals
+constexpr std::size_t kMatchFindLimit = 12;      // LZ4: no match may start in the last 12 bytes
+constexpr unsigned kHashLog = 14;
+
+std::uint32_t read32(const std::uint8_t* p) {
+    std::uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+std::uint32_t hash4(std::uint32_t v) { return (v * 2654435761u) >> (32 - kHashLog); }
+
+void put_le32(char* p, std::uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+std::uint32_t get_le32(const char* p) {
+    std::uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<std::uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    return v;
+}
+
+// LZ4 length continuation: runs of 255 then the remainder.
+bool put_length(std::uint8_t*& op, const std::uint8_t* oend, std::size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op >= oend) return false;
+        *op++ = 255;
+    }
+    if (op >= oend) return false;
+    *op++ = static_cast<std::uint8_t>(len);
+    return true;
+}
+
+// Append one frame block (header + payload) to out; blocks that do not shrink are stored raw.
+void append_block(const char* data, std::size_t n, std::vector<char>& out) {
+    const std::size_t header = out.size();
+    const std::size_t bound = lz4_compress_bound(n);
+    out.resize(header + 8 + bound);
+    std::size_t packed = lz4_compress(data, n, out.data() + header + 8, bound);
+    std::uint32_t stored = static_cast<std::uint32_t>(packed);
+    if (packed == 0 || packed >= n) {
+        std::memcpy(out.data() + header + 8, data, n);
+        packed = n;
+        stored = static_cast<std::uint32_t>(n) | kRawFlag;
+    }
+    put_le32(out.data() + header, static_cast<std::uint32_t>(n));
+    put_le32(out.data() + header + 4, stored);
+    out.resize(header + 8 + packed);
+}
+
+// Read-only streambuf over a memory range, so buffers reuse the stream decoder.
+struct MemoryBuf : std::streambuf {
+    MemoryBuf(const char* data, std::size_t n) {
+        char* p = const_cast<char*>(data);
+        setg(p, p, p + n);
+    }
+};
+
+std::string lower_extension(const std::string& name) {
+    auto slash = name.find_last_of('/');
+    auto dot = name.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return {};
+    std::string ext = name.substr(dot + 1);
+    for (auto& c : ext) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return ext;
+}
+
+bool starts_with(const char* head, std::size_t n, const char* magic, std::size_t len) {
+    return n >= len && std::memcmp(head, magic, len) == 0;
+}
+}
+
+std::size_t lz4_compress_bound(std::size_t n) { return n + n / 255 + 16; }
+
+std::size_t lz4_compress(const char* src_chars, std::size_t n, char* dst_chars, std::size_t capacity) {
+    const auto* src = reinterpret_cast<const std::uint8_t*>(src_chars);
+    auto* const dst = reinterpret_cast<std::uint8_t*>(dst_chars);
+    std::uint8_t* op = dst;
+    const std::uint8_t* const oend = dst + capacity;
+    std::uint32_t table[1u << kHashLog] = {}; // position + 1 of the last 4-byte sequence; 0 = empty
+    std::size_t anchor = 0;
+
+    // One sequence: literals [anchor, lit_end), then an optional match.
+    auto emit = [&](std::size_t lit_end, std::size_t offset, std::size_t match_len) {
+        const std::size_t lit = lit_end - anchor;
+        const std::size_t ml = match_len ? match_len - kMinMatch : 0;
+        if (op >= oend) return false;
+        std::uint8_t* token = op++;
+        *token = static_cast<std::uint8_t>((std::min<std::size_t>(lit, 15) << 4) | std::min<std::size_t>(ml, 15));
+        if (lit >= 15 && !put_length(op, oend, lit - 15)) return false;
+        if (static_cast<std::size_t>(oend - op) < lit) return false;
+        std::memcpy(op, src + anchor, lit);
+        op += lit;
+        if (!match_len) return true;
+        if (oend - op < 2) return false;
+        *op++ = static_cast<std::uint8_t>(offset & 0xFF);
+        *op++ = static_cast<std::uint8_t>(offset >> 8);
+        return ml < 15 || put_length(op, oend, ml - 15);
+    };
+
+    if (n > kMatchFindLimit) {
+        const std::size_t match_start_limit = n - kMatchFindLimit;
+        const std::size_t match_end_limit = n - kLastLiterals;
+        std::size_t ip = 0;
+        while (ip < match_start_limit) {
+            const std::uint32_t seq = read32(src + ip);
+            const std::uint32_t h = hash4(seq);
+            const std::size_t ref = table[h];
+            table[h] = static_cast<std::uint32_t>(ip + 1);
+            if (ref && ip - (ref - 1) <= 0xFFFF && read32(src + ref - 1) == seq) {
+                const std::size_t from = ref - 1;
+                std::size_t len = kMinMatch;
+                while (ip + len < match_end_limit && src[from + len] == src[ip + len]) ++len;
+                if (!emit(ip, ip - from, len)) return 0;
+                ip += len;
+                anchor = ip;
+            } else {
+                ip += 1 + ((ip - anchor) >> 6); // skip faster through incompressible data
+            }
+        }
+    }
+    if (!emit(n, 0, 0)) return 0;
+    return static_cast<std::size_t>(op - dst);
+}
+
+bool lz4_decompress(const char* src_chars, std::size_t n, char* dst_chars, std::size_t raw_len) {
+    const auto* ip = reinterpret_cast<const std::uint8_t*>(src_chars);
+    const std::uint8_t* const iend = ip + n;
+    auto* const dst = reinterpret_cast<std::uint8_t*>(dst_chars);
+    std::uint8_t* op = dst;
+    std::uint8_t* const oend = dst + raw_len;
+    auto get_length = [&](std::size_t& len) {
+        std::uint8_t b;
+        do {
+            if (ip >= iend) return false;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    while (ip < iend) {
+        const std::uint8_t token = *ip++;
+        std::size_t lit = token >> 4;
+        if (lit == 15 && !get_length(lit)) return false;
+        if (static_cast<std::size_t>(iend - ip) < lit || static_cast<std::size_t>(oend - op) < lit) return false;
+        std::memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) break; // last sequence has no match
+        if (iend - ip < 2) return false;
+        const std::size_t offset = ip[0] | (static_cast<std::size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<std::size_t>(op - dst)) return false;
+        std::size_t ml = token & 15;
+        if (ml == 15 && !get_length(ml)) return false;
+        ml += kMinMatch;
+        if (static_cast<std::size_t>(oend - op) < ml) return false;
+        const std::uint8_t* match = op - offset;
+        for (std::size_t k = 0; k < ml; ++k) op[k] = match[k]; // may overlap: byte by byte
+        op += ml;
+    }
+    return op == oend;
+}
+
+bool is_precompressed(const std::string& name, const char* head, std::size_t n) {
+    static const char* const kExtensions[] = {
+        "jpg", "jpeg", "png", "gif", "webp", "heic", "mp3", "m4a", "aac", "ogg", "flac", "opus",
+        "mp4", "m4v", "mkv", "mov", "avi", "webm", "zip", "gz", "tgz", "bz2", "xz", "txz", "zst",
+        "lz4", "7z", "rar", "jar", "apk", "docx", "xlsx", "pptx", "odt", "ods", "epub"};
+    const std::string ext = lower_extension(name);
+    for (const char* known : kExtensions) {
+        if (ext == known) return true;
+    }
+    return starts_with(head, n, "\xFF\xD8\xFF", 3)                  // JPEG
+        || starts_with(head, n, "\x89PNG", 4)                       // PNG
+        || starts_with(head, n, "PK\x03\x04", 4)                    // ZIP and derived formats
+        || starts_with(head, n, "\x1F\x8B", 2)                      // gzip
+        || starts_with(head, n, "\xFD" "7zXZ", 5)                   // xz
+        || starts_with(head, n, "\x28\xB5\x2F\xFD", 4)              // zstd
+        || starts_with(head, n, "7z\xBC\xAF\x27\x1C", 6)            // 7-Zip
+        || starts_with(head, n, "BZh", 3)                           // bzip2
+        || starts_with(head, n, "Rar!", 4);                         // RAR
+}
+
+std::uint64_t frame_bound(std::uint64_t n) {
+    const std::uint64_t blocks = (n + kFrameBlockSize - 1) / kFrameBlockSize;
+    return sizeof(kMagic) + blocks * 8 + n + 4;
+}
+
+bool is_framed(const char* data, std::size_t n) {
+    return starts_with(data, n, kMagic, sizeof(kMagic));
+}
+
+bool encode_frame(const char* data, std::size_t n, std::vector<char>& out) {
+    out.assign(kMagic, kMagic + sizeof(kMagic));
+    for (std::size_t pos = 0; pos < n; pos += kFrameBlockSize) {
+        append_block(data + pos, std::min(kFrameBlockSize, n - pos), out);
+    }
+    out.insert(out.end(), 4, '\0'); // end of frame
+    return out.size() < n;
+}
+
+bool decode_buffer(const char* data, std::size_t n, std::vector<char>& out) {
+    out.clear();
+    MemoryBuf buf(data, n);
+    std::istream in(&buf);
+    return read_stored(in, [&](const char* p, std::size_t len) {
+        out.insert(out.end(), p, p + len);
+        return true;
+    });
+}
+
+bool compress_stream(std::istream& in, std::ostream& out, unsigned threads,
+                     const std::function<void(const char*, std::size_t)>& on_raw) {
+    struct Slot {
+        std::vector<char> raw;
+        std::vector<char> block;
+        bool done = false;
+    };
+    const std::size_t window = std::max<std::size_t>(2, 2 * static_cast<std::size_t>(threads));
+    std::vector<Slot> slots(window);
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::size_t> queue; // sequence numbers waiting for a worker
+    bool stop = false;
+
+    std::vector<std::thread> workers;
+    auto worker = [&]() {
+        for (;;) {
+            std::size_t seq;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return stop || !queue.empty(); });
+                if (queue.empty()) return;
+                seq = queue.front();
+                queue.pop_front();
+            }
+            Slot& s = slots[seq % window];
+            s.block.clear();
+            append_block(s.raw.data(), s.raw.size(), s.block);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                s.done = true;
+            }
+            cv.notify_all();
+        }
+    };
+    // Stops and joins the workers on every exit path.
+    struct Shutdown {
+        std::mutex& mutex;
+        std::condition_variable& cv;
+        std::deque<std::size_t>& queue;
+        bool& stop;
+        std::vector<std::thread>& workers;
+        ~Shutdown() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+                queue.clear();
+            }
+            cv.notify_all();
+            for (auto& t : workers) t.join();
+        }
+    } shutdown{mutex, cv, queue, stop, workers};
+    if (threads > 1) {
+        workers.reserve(threads);
+        for (unsigned t = 0; t < threads; ++t) workers.emplace_back(worker);
+    }
+
+    out.write(kMagic, sizeof(kMagic));
+    std::size_t next_read = 0, next_write = 0;
+    bool eof = false;
+    for (;;) {
+        // Keep the window full: reading runs ahead while workers compress.
+        while (!eof && next_read - next_write < window) {
+            Slot& s = slots[next_read % window];
+            s.raw.resize(kFrameBlockSize);
+            in.read(s.raw.data(), static_cast<std::streamsize>(s.raw.size()));
+            const auto n = static_cast<std::size_t>(in.gcount());
+            if (in.bad()) return false;
+            if (n < kFrameBlockSize) eof = true;
+            if (n == 0) break;
+            s.raw.resize(n);
+            on_raw(s.raw.data(), n);
+            if (workers.empty()) {
+                s.block.clear();
+                append_block(s.raw.data(), n, s.block);
+                s.done = true;
+            } else {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    s.done = false;
+                    queue.push_back(next_read);
+                }
+                cv.notify_one();
+            }
+            ++next_read;
+        }
+        if (next_write == next_read) break;
+        // Write strictly in order.
+        Slot& s = slots[next_write % window];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return s.done; });
+        }
+        out.write(s.block.data(), static_cast<std::streamsize>(s.block.size()));
+        if (!out.good()) return false;
+        ++next_write;
+    }
+    char end[4] = {0, 0, 0, 0};
+    out.write(end, sizeof(end));
+    return out.good();
+}
+
+bool read_stored(std::istream& in, const std::function<bool(const char*, std::size_t)>& sink) {
+    char head[sizeof(kMagic)];
+    in.read(head, sizeof(head));
+    const auto got = static_cast<std::size_t>(in.gcount());
+    if (in.bad()) return false;
+    if (!is_framed(head, got)) {
+        // Stored as-is: pass everything through.
+        if (got > 0 && !sink(head, got)) return false;
+        std::vector<char> buf(kFrameBlockSize);
+        while (in) {
+            in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+            const auto n = static_cast<std::size_t>(in.gcount());
+            if (n == 0) break;
+            if (!sink(buf.data(), n)) return false;
+        }
+        return !in.bad();
+    }
+    std::vector<char> packed, raw;
+    for (;;) {
+        char header[8];
+        in.read(header, 4);
+        if (in.gcount() != 4) return false; // truncated
+        const std::uint32_t raw_len = get_le32(header);
+        if (raw_len == 0) return true;      // end of frame
+        in.read(header + 4, 4);
+        if (in.gcount() != 4) return false;
+        const std::uint32_t stored = get_le32(header + 4);
+        const bool is_raw = (stored & kRawFlag) != 0;
+        const std::uint32_t len = stored & ~kRawFlag;
+        if (raw_len > kMaxBlock || len > lz4_compress_bound(raw_len) || (is_raw && len != raw_len)) return false;
+        packed.resize(len);
+        in.read(packed.data(), static_cast<std::streamsize>(len));
+        if (static_cast<std::size_t>(in.gcount()) != len) return false;
+        if (is_raw) {
+            if (!sink(packed.data(), len)) return false;
+            continue;
+        }
+        raw.resize(raw_len);
+        if (!lz4_decompress(packed.data(), len, raw.data(), raw_len)) return false;
+        if (!sink(raw.data(), raw_len)) return false;
+    }
+}
+
+} // namespace tp2
@@ -0,0 +1,111 @@
+#include "concurrency.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace tp2 {
+
+AdaptiveLimit::AdaptiveLimit(unsigned min_limit, unsigned max_limit, unsigned initial)
+    : min_(std::max(1u, min_limit)),
+      max_(std::max(std::max(1u, min_limit), max_limit)),
+      limit_(std::min(max_, std::max(min_, static_cast<double>(initial)))),
+      window_start_(std::chrono::steady_clock::now()) {}
+
+void AdaptiveLimit::acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return in_flight_ < static_cast<unsigned>(std::lround(limit_)); });
+    if (in_flight_ == 0 && window_samples_ == 0) window_start_ = std::chrono::steady_clock::now(); // idle time is not measured
+    ++in_flight_;
+    peak_ = std::max(peak_, in_flight_);
+}
+
+void AdaptiveLimit::release(std::uint64_t bytes, double seconds) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --in_flight_;
+        if (bytes > 0 && seconds > 0) {
+            window_bytes_ += bytes;
+            window_cost_ += seconds;
+            window_weight_ += static_cast<double>(bytes + kItemOverhead);
+            ++window_samples_;
+            adjust(std::chrono::steady_clock::now());
+        }
+    }
+    cv_.notify_all();
+}
+
+// Close the window once it holds enough copies to say something, and move the limit.
+void AdaptiveLimit::adjust(std::chrono::steady_clock::time_point now) {
+    const auto elapsed = now - window_start_;
+    const unsigned wanted = std::max(4u, static_cast<unsigned>(std::ceil(limit_)));
+    if (window_samples_ < wanted || elapsed < kMinWindow) return;
+    const double latency = window_cost_ / window_weight_;
+    throughput_ = static_cast<double>(window_bytes_) / std::chrono::duration<double>(elapsed).count();
+    if (min_latency_ == 0 || latency < min_latency_) min_latency_ = latency;
+    const double gradient = std::min(1.0, std::max(0.5, min_latency_ / latency));
+    // While the latency holds at the baseline the device has room, and the limit grows by
+    // sqrt(limit); near the knee it creeps by one, and past it the gradient pulls it back. The
+    // new value is smoothed, so one noisy window moves the limit only a little.
+    const double headroom = gradient > 0.95 ? std::sqrt(limit_) : 1.0;
+    const double target = limit_ * gradient + headroom;
+    limit_ = std::min(max_, std::max(min_, 0.5 * limit_ + 0.5 * target));
+    if (++windows_ % kProbeWindows == 0) {
+        // Re-learn the baseline at half the concurrency: the device may have become faster or slower.
+        min_latency_ = 0;
+        limit_ = std::max(min_, limit_ / 2);
+    }
+    window_start_ = now;
+    window_bytes_ = 0;
+    window_cost_ = 0;
+    window_weight_ = 0;
+    window_samples_ = 0;
+}
+
+unsigned AdaptiveLimit::limit() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<unsigned>(std::lround(limit_));
+}
+
+double AdaptiveLimit::throughput() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return throughput_;
+}
+
+unsigned AdaptiveLimit::peak() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+}
+
+AdaptiveLimit& AdaptiveConcurrency::limit_for(std::uint64_t device) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& slot = limits_[device];
+    if (!slot) slot = std::make_unique<AdaptiveLimit>(1, max_, initial_);
+    return *slot;
+}
+
+std::vector<AdaptiveConcurrency::DeviceState> AdaptiveConcurrency::devices() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<DeviceState> out;
+    for (const auto& kv : limits_) {
+        out.push_back({kv.first, kv.second->limit(), kv.second->peak(), kv.second->throughput()});
+    }
+    return out;
+}
+
+AdaptiveConcurrency::Slot::Slot(AdaptiveConcurrency* owner, std::vector<std::uint64_t> devices) {
+    if (!owner) return;
+    std::sort(devices.begin(), devices.end());
+    devices.erase(std::unique(devices.begin(), devices.end()), devices.end());
+    for (auto dev : devices) {
+        AdaptiveLimit& limit = owner->limit_for(dev);
+        limit.acquire();
+        limits_.push_back(&limit);
+    }
+    start_ = std::chrono::steady_clock::now();
+}
+
+AdaptiveConcurrency::Slot::~Slot() {
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    for (auto* limit : limits_) limit->release(bytes_, seconds);
+}
+
+} // namespace tp2
@@ -0,0 +1,250 @@
+#include "daemon.hpp"
+#include "fsutil.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace tp2 {
+
+namespace {
+constexpr const char* kMagic = "tp2 1";
+constexpr std::size_t kMaxRequestBytes = 1024 * 1024;
+constexpr int kAcceptPollMs = 200; // how often the stop flag is looked at while idle
+constexpr int kPeerTimeoutSec = 10; // a client that stops sending mid-request is dropped
+
+bool make_address(const std::string& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+int connect_to(const sockaddr_un& addr) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool send_all(int fd, const char* data, std::size_t len) {
+    while (len > 0) {
+        ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+// Read up to and including the first '\n'; whatever came after it stays in rest.
+bool read_header(int fd, std::string& header, std::string& rest) {
+    char buf[4096];
+    std::string data;
+    for (;;) {
+        auto nl = data.find('\n');
+        if (nl != std::string::npos) {
+            header = data.substr(0, nl);
+            rest = data.substr(nl + 1);
+            return true;
+        }
+        if (data.size() > 256) return false;
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data.append(buf, static_cast<std::size_t>(n));
+    }
+}
+
+bool read_exact(int fd, std::string& data, std::size_t want) {
+    char buf[64 * 1024];
+    while (data.size() < want) {
+        std::size_t chunk = std::min(sizeof(buf), want - data.size());
+        ssize_t n = ::recv(fd, buf, chunk, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data.append(buf, static_cast<std::size_t>(n));
+    }
+    return true;
+}
+
+// Parse one request off a connection; false if it is malformed or the client went away.
+bool read_request(int fd, std::vector<std::string>& args) {
+    std::string header, data;
+    if (!read_header(fd, header, data)) return false;
+    std::istringstream ss(header);
+    std::string magic, version;
+    std::size_t count = 0;
+    if (!(ss >> magic >> version >> count) || magic + " " + version != kMagic) return false;
+    char buf[64 * 1024];
+    std::size_t nuls = static_cast<std::size_t>(std::count(data.begin(), data.end(), '\0'));
+    while (nuls < count) {
+        if (data.size() > kMaxRequestBytes) return false;
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        nuls += static_cast<std::size_t>(std::count(buf, buf + n, '\0'));
+        data.append(buf, static_cast<std::size_t>(n));
+    }
+    args.clear();
+    std::size_t start = 0;
+    for (std::size_t k = 0; k < count; ++k) {
+        std::size_t end = data.find('\0', start);
+        args.push_back(data.substr(start, end - start));
+        start = end + 1;
+    }
+    return true;
+}
+
+// Run one request through handler and send the reply; -1 from the handler means "not mine"
+// and nothing is sent.
+int answer(int fd, const RequestHandler& handler, const std::vector<std::string>& args) {
+    std::ostringstream out, err;
+    int code;
+    try {
+        code = handler(args, out, err);
+    } catch (const std::exception& e) {
+        err << "exception: " << e.what() << '\n';
+        code = 3;
+    }
+    if (code < 0) return code;
+    const std::string out_text = out.str(), err_text = err.str();
+    std::string reply = std::to_string(code) + ' ' + std::to_string(out_text.size()) + ' ' +
+                        std::to_string(err_text.size()) + '\n';
+    reply += out_text;
+    reply += err_text;
+    send_all(fd, reply.data(), reply.size()); // a client that left no longer cares
+    return code;
+}
+
+// Runs accepted requests one at a time, in arrival order, on its own thread, so the accept
+// loop stays free for control requests. Owns the queued descriptors.
+class RunQueue {
+public:
+    explicit RunQueue(const RequestHandler& handler) : handler_(handler), worker_([this] { loop(); }) {}
+    ~RunQueue() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+        }
+        cv_.notify_one();
+        worker_.join();
+    }
+
+    void push(int fd, std::vector<std::string> args) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.emplace_back(fd, std::move(args));
+        }
+        cv_.notify_one();
+    }
+
+private:
+    void loop() {
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return closing_ || !queue_.empty(); });
+            if (queue_.empty()) return; // closing, and every request received was served
+            auto job = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            Fd client(job.first);
+            answer(client.fd, handler_, job.second);
+        }
+    }
+
+    const RequestHandler& handler_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::pair<int, std::vector<std::string>>> queue_;
+    bool closing_ = false;
+    std::thread worker_; // last: starts once the rest is ready
+};
+}
+
+ActionResult serve_requests(const std::string& socketPath, const RequestHandler& handler,
+                            const std::atomic<bool>& stop, const RequestHandler& control) {
+    sockaddr_un addr;
+    if (!make_address(socketPath, addr)) return {1, "invalid socket path: " + socketPath};
+    {
+        Fd probe(connect_to(addr));
+        if (probe.fd >= 0) return {2, "a daemon is already listening on " + socketPath};
+    }
+    ::unlink(socketPath.c_str()); // left behind by a daemon that died
+    Fd listener(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (listener.fd < 0) return {5, "cannot create socket " + socketPath + ": " + std::strerror(errno)};
+    // Every request runs with the daemon's rights: only its owner may send them. The socket is
+    // created owner-only (umask), so no other user can connect between bind and chmod.
+    const mode_t old_mask = ::umask(0177);
+    const bool bound = ::bind(listener.fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+    const int bind_errno = errno;
+    ::umask(old_mask);
+    if (!bound) return {5, "cannot create socket " + socketPath + ": " + std::strerror(bind_errno)};
+    if (::chmod(socketPath.c_str(), 0600) != 0 || ::listen(listener.fd, 16) != 0) {
+        ActionResult res{5, "cannot listen on " + socketPath + ": " + std::strerror(errno)};
+        ::unlink(socketPath.c_str());
+        return res;
+    }
+    {
+        RunQueue runs(handler);
+        while (!stop.load()) {
+            pollfd pfd{listener.fd, POLLIN, 0};
+            if (::poll(&pfd, 1, kAcceptPollMs) <= 0) continue; // timeout or EINTR (signal)
+            Fd client(::accept4(listener.fd, nullptr, nullptr, SOCK_CLOEXEC));
+            if (client.fd < 0) continue;
+            timeval timeout{kPeerTimeoutSec, 0};
+            ::setsockopt(client.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            std::vector<std::string> args;
+            if (!read_request(client.fd, args)) continue;
+            if (control && answer(client.fd, control, args) >= 0) continue;
+            runs.push(client.fd, std::move(args));
+            client.fd = -1; // the queue closes it once answered
+        }
+    } // finishes the runs already received
+    ::unlink(socketPath.c_str());
+    return {0, "ok"};
+}
+
+ActionResult send_request(const std::string& socketPath, const std::vector<std::string>& args,
+                          std::ostream& out, std::ostream& err) {
+    sockaddr_un addr;
+    if (!make_address(socketPath, addr)) return {1, "invalid socket path: " + socketPath};
+    Fd fd(connect_to(addr));
+    if (fd.fd < 0) return {4, "no daemon listening on " + socketPath};
+    std::string request = std::string(kMagic) + ' ' + std::to_string(args.size()) + '\n';
+    for (const auto& arg : args) {
+        request += arg;
+        request.push_back('\0');
+    }
+    std::string header, data;
+    if (!send_all(fd.fd, request.data(), request.size()) || !read_header(fd.fd, header, data)) {
+        return {5, "connection to the daemon lost"};
+    }
+    std::istringstream ss(header);
+    int code = 0;
+    std::size_t out_len = 0, err_len = 0;
+    if (!(ss >> code >> out_len >> err_len) || !read_exact(fd.fd, data, out_len + err_len)) {
+        return {5, "connection to the daemon lost"};
+    }
+    out << data.substr(0, out_len) << std::flush;
+    err << data.substr(out_len, err_len) << std::flush;
+    return {code, ""};
+}
+
+} // namespace tp2
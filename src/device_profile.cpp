@@ -0,0 +1,256 @@
+#include "device_profile.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/sysmacros.h>
+
+namespace tp2 {
+
+namespace {
+namespace fs = std::filesystem;
+
+// st_dev of path, or of its nearest existing ancestor (a pen subdirectory may not exist yet).
+bool existing_device(const std::string& path, dev_t& dev) {
+    fs::path p = fs::absolute(path).lexically_normal();
+    while (true) {
+        struct stat st;
+        if (::stat(p.c_str(), &st) == 0) {
+            dev = st.st_dev;
+            return true;
+        }
+        if (!p.has_relative_path()) return false;
+        p = p.parent_path();
+    }
+}
+
+std::string read_line(const fs::path& file) {
+    std::ifstream in(file);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+// A partition's attributes live on the whole disk, one directory up.
+fs::path whole_disk(const fs::path& dir) {
+    std::error_code ec;
+    return fs::exists(dir / "partition", ec) ? dir.parent_path() : dir;
+}
+
+bool parse_count(const std::string& text, std::uint64_t& value, std::uint64_t unit_k) {
+    if (text.empty() || text[0] == '-') return false;
+    std::size_t pos = 0;
+    try {
+        value = std::stoull(text, &pos);
+    } catch (const std::exception&) {
+        return false;
+    }
+    const std::string suffix = text.substr(pos);
+    if (suffix.empty()) return true;
+    if (unit_k == 0) return false;
+    if (suffix == "K" || suffix == "k") value *= unit_k;
+    else if (suffix == "M" || suffix == "m") value *= unit_k * unit_k;
+    else return false;
+    return true;
+}
+}
+
+const char* device_class_name(DeviceClass cls) {
+    switch (cls) {
+    case DeviceClass::Rotational: return "hdd";
+    case DeviceClass::Ssd: return "ssd";
+    case DeviceClass::Removable: return "usb";
+    default: return "generic";
+    }
+}
+
+DeviceClass detect_device_class(const std::string& path, const std::string& sysfs) {
+    dev_t dev = 0;
+    if (!existing_device(path, dev) || major(dev) == 0) return DeviceClass::Generic; // tmpfs, overlay, nfs
+    std::error_code ec;
+    const fs::path link = fs::path(sysfs) / "dev" / "block" /
+                          (std::to_string(major(dev)) + ":" + std::to_string(minor(dev)));
+    fs::path dir = fs::canonical(link, ec);
+    if (ec) return DeviceClass::Generic;
+    dir = whole_disk(dir);
+    // dm (LVM, LUKS) and md sit on other disks: follow the first one down.
+    for (int depth = 0; depth < 4; ++depth) {
+        std::vector<std::string> slaves;
+        for (fs::directory_iterator it(dir / "slaves", ec), end; !ec && it != end; it.increment(ec)) {
+            slaves.push_back(it->path().filename().string());
+        }
+        if (slaves.empty()) break;
+        std::sort(slaves.begin(), slaves.end());
+        fs::path next = fs::canonical(dir / "slaves" / slaves.front(), ec);
+        if (ec) break;
+        dir = whole_disk(next);
+    }
+    if (read_line(dir / "removable") == "1" || dir.string().find("/usb") != std::string::npos) {
+        return DeviceClass::Removable;
+    }
+    const std::string rotational = read_line(dir / "queue" / "rotational");
+    if (rotational == "1") return DeviceClass::Rotational;
+    if (rotational == "0") return DeviceClass::Ssd;
+    return DeviceClass::Generic;
+}
+
+std::string detect_filesystem(const std::string& path) {
+    struct statfs st;
+    fs::path p = fs::absolute(path).lexically_normal();
+    while (::statfs(p.c_str(), &st) != 0) {
+        if (!p.has_relative_path()) return "unknown";
+        p = p.parent_path();
+    }
+    switch (static_cast<std::uint32_t>(st.f_type)) {
+    case 0xEF53: return "ext4"; // also ext2/ext3
+    case 0x58465342: return "xfs";
+    case 0x9123683E: return "btrfs";
+    case 0xF2F52010: return "f2fs";
+    case 0x4D44: return "vfat";
+    case 0x2011BAB0: return "exfat";
+    case 0x5346544E: return "ntfs";
+    case 0x65735546: return "fuse";
+    case 0x01021994: return "tmpfs";
+    case 0x794C7630: return "overlay";
+    case 0x6969: return "nfs";
+    default: return "unknown";
+    }
+}
+
+std::int64_t mtime_granularity_ns(const std::string& filesystem) {
+    if (filesystem == "vfat" || filesystem == "exfat") return 2000000000LL;
+    if (filesystem == "fuse") return 2000000000LL; // exfat-fuse and friends: assume the worst
+    if (filesystem == "ntfs") return 100;
+    return 0;
+}
+
+DeviceProfile profile_for(DeviceClass cls, const std::string& filesystem) {
+    const bool fat = filesystem == "vfat" || filesystem == "exfat";
+    if (cls == DeviceClass::Generic && fat) cls = DeviceClass::Removable;
+    DeviceProfile p;
+    p.device_class = cls;
+    p.filesystem = filesystem;
+    switch (cls) {
+    case DeviceClass::Rotational:
+        // Large sequential blocks and little seeking; one sync at the end costs less than per file.
+        p.buffer_size = 1024 * 1024;
+        p.queue_depth = 2;
+        p.fsync = FsyncPolicy::Run;
+        break;
+    case DeviceClass::Ssd:
+        p.buffer_size = 256 * 1024;
+        p.queue_depth = 4;
+        p.fsync = FsyncPolicy::Run;
+        break;
+    case DeviceClass::Removable:
+        // Slow flash that may be pulled out: one copy at a time, each on the device before the
+        // next starts, and no gigabytes of dirty pages waiting for it.
+        p.buffer_size = 1024 * 1024;
+        p.queue_depth = 1;
+        p.fsync = FsyncPolicy::File;
+        p.direct_io = true;
+        // Cheap flash erases 4 MiB at a time (the usual SD/USB allocation unit).
+        p.erase_block = 4 * 1024 * 1024;
+        break;
+    default:
+        break;
+    }
+    return p;
+}
+
+bool parse_profile_spec(const std::string& text, ProfileSpec& spec, std::string& error) {
+    spec = ProfileSpec{};
+    std::stringstream ss(text);
+    std::string item;
+    bool first = true;
+    while (std::getline(ss, item, ',')) {
+        if (first) {
+            first = false;
+            if (item == "auto") continue;
+            spec.detect = false;
+            if (item == "generic") spec.device_class = DeviceClass::Generic;
+            else if (item == "hdd") spec.device_class = DeviceClass::Rotational;
+            else if (item == "ssd") spec.device_class = DeviceClass::Ssd;
+            else if (item == "usb") spec.device_class = DeviceClass::Removable;
+            else {
+                error = "unknown device class: " + item + " (expected auto, generic, hdd, ssd or usb)";
+                return false;
+            }
+            continue;
+        }
+        const auto eq = item.find('=');
+        const std::string key = item.substr(0, eq);
+        const std::string value = eq == std::string::npos ? std::string() : item.substr(eq + 1);
+        std::uint64_t n = 0;
+        if (key == "buffer" && parse_count(value, n, 1024) && n >= 4096 && n <= 64ULL * 1024 * 1024) {
+            spec.buffer_size = static_cast<std::size_t>(n);
+        } else if (key == "queue" && parse_count(value, n, 0) && n >= 1 && n <= 1024) {
+            spec.queue_depth = static_cast<unsigned>(n);
+        } else if (key == "fsync" && (value == "none" || value == "run" || value == "file")) {
+            spec.fsync = static_cast<int>(value == "none" ? FsyncPolicy::None
+                                          : value == "run" ? FsyncPolicy::Run : FsyncPolicy::File);
+        } else if (key == "direct" && (value == "on" || value == "off")) {
+            spec.direct_io = value == "on";
+        } else if (key == "erase" && value == "off") {
+            spec.erase_block = 0;
+        } else if (key == "erase" && parse_count(value, n, 1024) && n >= 64 * 1024 && n <= 64ULL * 1024 * 1024 &&
+                   n % 4096 == 0) {
+            spec.erase_block = static_cast<std::int64_t>(n);
+        } else {
+            error = "invalid profile setting: " + item;
+            return false;
+        }
+    }
+    if (first) {
+        error = "empty profile";
+        return false;
+    }
+    return true;
+}
+
+std::string describe_profile(const DeviceProfile& profile) {
+    static const char* const kFsync[] = {"none", "run", "file"};
+    std::ostringstream out;
+    out << device_class_name(profile.device_class) << ", " << profile.filesystem << ": buffer "
+        << profile.buffer_size / 1024 << " KiB, queue " << profile.queue_depth << ", fsync "
+        << kFsync[static_cast<int>(profile.fsync)] << ", direct " << (profile.direct_io ? "on" : "off") << ", erase ";
+    if (profile.erase_block) out << profile.erase_block / 1024 << " KiB";
+    else out << "off";
+    return out.str();
+}
+
+const DeviceProfile& DeviceProfiles::for_path(const std::string& path) {
+    dev_t dev = 0;
+    const std::uint64_t key = existing_device(path, dev) ? static_cast<std::uint64_t>(dev) : 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = devices_.find(key);
+    if (it != devices_.end()) return it->second.profile;
+    const std::string filesystem = detect_filesystem(path);
+    DeviceProfile p = profile_for(spec_.detect ? detect_device_class(path, sysfs_) : spec_.device_class, filesystem);
+    if (spec_.buffer_size) p.buffer_size = spec_.buffer_size;
+    if (spec_.queue_depth) p.queue_depth = spec_.queue_depth;
+    if (spec_.fsync >= 0) p.fsync = static_cast<FsyncPolicy>(spec_.fsync);
+    if (spec_.direct_io >= 0) p.direct_io = spec_.direct_io == 1;
+    if (spec_.erase_block >= 0) p.erase_block = static_cast<std::size_t>(spec_.erase_block);
+    return devices_.emplace(key, Device{key, path, p}).first->second.profile;
+}
+
+std::vector<DeviceProfiles::Device> DeviceProfiles::devices() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Device> out;
+    for (const auto& kv : devices_) out.push_back(kv.second);
+    return out;
+}
+
+std::mutex& DeviceProfiles::write_gate(const std::string& path) {
+    dev_t dev = 0;
+    const std::uint64_t key = existing_device(path, dev) ? static_cast<std::uint64_t>(dev) : 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& gate = gates_[key];
+    if (!gate) gate = std::make_unique<std::mutex>();
+    return *gate;
+}
+
+} // namespace tp2
@@ -0,0 +1,98 @@
+#include "fanout.hpp"
+#include "fsutil.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace tp2 {
+
+FanoutSink::FanoutSink(const std::vector<std::string>& paths, bool threaded)
+    : dests_(paths.size()), threaded_(threaded && paths.size() > 1) {
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        dests_[i].fd = ::open(paths[i].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        dests_[i].ok = dests_[i].fd >= 0;
+    }
+    if (!threaded_) return;
+    for (std::size_t i = 0; i < dests_.size(); ++i) {
+        if (dests_[i].ok) dests_[i].writer = std::thread(&FanoutSink::run_writer, this, i);
+    }
+}
+
+FanoutSink::~FanoutSink() {
+    finish();
+}
+
+void FanoutSink::run_writer(std::size_t i) {
+    Dest& d = dests_[i];
+    for (;;) {
+        Block block;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&] { return !d.queue.empty() || closing_; });
+            if (d.queue.empty()) return;
+            block = std::move(d.queue.front());
+            d.queue.pop_front();
+        }
+        cv_.notify_all(); // room in this queue for the reader
+        if (!write_all(d.fd, block->data(), block->size())) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                d.ok = false;
+                d.queue.clear(); // the failed destination no longer holds the others back
+            }
+            cv_.notify_all(); // the reader may be waiting on this queue
+        }
+    }
+}
+
+void FanoutSink::write(const char* data, std::size_t n) {
+    if (n == 0) return;
+    if (!threaded_) {
+        for (auto& d : dests_) {
+            if (d.ok && !write_all(d.fd, data, n)) d.ok = false;
+        }
+        return;
+    }
+    auto block = std::make_shared<const std::vector<char>>(data, data + n);
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] {
+        for (const auto& d : dests_) {
+            if (d.ok && d.queue.size() >= kMaxQueued) return false;
+        }
+        return true;
+    });
+    for (auto& d : dests_) {
+        if (d.ok) d.queue.push_back(block);
+    }
+    lock.unlock();
+    cv_.notify_all();
+}
+
+bool FanoutSink::finish() {
+    if (finished_) {
+        for (const auto& d : dests_) {
+            if (d.ok) return true;
+        }
+        return false;
+    }
+    finished_ = true;
+    if (threaded_) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+        }
+        cv_.notify_all();
+        for (auto& d : dests_) {
+            if (d.writer.joinable()) d.writer.join();
+        }
+    }
+    bool any = false;
+    for (auto& d : dests_) {
+        if (d.fd >= 0 && ::close(d.fd) != 0) d.ok = false;
+        d.fd = -1;
+        any |= d.ok;
+    }
+    return any;
+}
+
+} // namespace tp2
@@ -0,0 +1,77 @@
+#include "file_table.hpp"
+#include "plan.hpp"
+
+namespace tp2 {
+
+void FileTable::resize(std::size_t n) {
+    flags.assign(n, 0);
+    hd_size.assign(n, 0);
+    pen_size.assign(n, 0);
+    hd_mtime.assign(n, 0);
+    pen_mtime.assign(n, 0);
+}
+
+namespace {
+constexpr std::uint64_t kCopy = static_cast<std::uint64_t>(PlanAction::Copy);
+constexpr std::uint64_t kUpdate = static_cast<std::uint64_t>(PlanAction::Update);
+constexpr std::uint64_t kSkip = static_cast<std::uint64_t>(PlanAction::Skip);
+constexpr std::uint64_t kMissing = static_cast<std::uint64_t>(PlanAction::Missing);
+static_assert(kCopy == 0 && kUpdate == 1 && kSkip == 2 && kMissing == 3,
+              "the arithmetic below relies on this ordering");
+
+// Kept on raw restrict pointers so the compiler sees plain independent columns.
+// All lane arithmetic is 64-bit (comparisons become sign-bit shifts of the mtime difference,
+// exact while mtimes are less than ~292 years apart), which gives the
+// loop a single element width next to the size/mtime columns and lets it vectorize.
+// A side is newer only past slack; inside it, differing mtimes count when the sizes differ too.
+void classify_columns(const std::uint8_t* __restrict flags,
+                      const std::int64_t* __restrict hd_m, const std::int64_t* __restrict pen_m,
+                      const std::uint64_t* __restrict hd_s, const std::uint64_t* __restrict pen_s,
+                      std::uint8_t* __restrict action, std::uint8_t* __restrict to_hd,
+                      std::uint64_t* __restrict bytes, std::size_t n,
+                      std::uint64_t restore, std::uint64_t sync, std::int64_t slack) {
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::uint64_t f = flags[i];
+        const std::uint64_t hd_e = f & 1;
+        const std::uint64_t pen_e = (f >> 2) & 1;
+        const std::uint64_t dir = ((f >> 1) | (f >> 3)) & 1;
+        const std::uint64_t pen_newer = static_cast<std::uint64_t>(hd_m[i] + slack - pen_m[i]) >> 63;
+        const std::uint64_t hd_newer = static_cast<std::uint64_t>(pen_m[i] + slack - hd_m[i]) >> 63;
+        const std::uint64_t m_diff = static_cast<std::uint64_t>(hd_m[i] - pen_m[i]);
+        const std::uint64_t s_diff = hd_s[i] ^ pen_s[i];
+        const std::uint64_t close = (hd_newer ^ 1) & (pen_newer ^ 1) & ((m_diff | (0 - m_diff)) >> 63) &
+                                    ((s_diff | (0 - s_diff)) >> 63);
+
+        // r = 1 when this entry flows PEN -> HD
+        const std::uint64_t r = restore | (sync & ((hd_e ^ 1) | (pen_e & pen_newer)));
+        const std::uint64_t src_e = (r & pen_e) | ((r ^ 1) & hd_e);
+        const std::uint64_t dst_e = (r & hd_e) | ((r ^ 1) & pen_e);
+        const std::uint64_t newer = (r & pen_newer) | ((r ^ 1) & hd_newer) | close;
+
+        const std::uint64_t missing = src_e ^ 1;
+        const std::uint64_t live = src_e & (dir ^ 1);
+        const std::uint64_t copy = live & (dst_e ^ 1);
+        const std::uint64_t update = live & dst_e & newer;
+
+        action[i] = static_cast<std::uint8_t>(kSkip - 2 * copy - update + missing);
+        to_hd[i] = static_cast<std::uint8_t>(r);
+        const std::uint64_t size_mask = 0 - (copy | update);
+        const std::uint64_t r_mask = 0 - r;
+        bytes[i] = ((pen_s[i] & r_mask) | (hd_s[i] & ~r_mask)) & size_mask;
+    }
+}
+}
+
+void classify_table(FileTable& t, Operation op, std::int64_t mtime_slack_ns) {
+    const std::size_t n = t.size();
+    t.action.resize(n);
+    t.to_hd.resize(n);
+    t.bytes.resize(n);
+    // Per-run constants: Restore always copies towards the HD, Sync decides per entry.
+    classify_columns(t.flags.data(), t.hd_mtime.data(), t.pen_mtime.data(),
+                     t.hd_size.data(), t.pen_size.data(),
+                     t.action.data(), t.to_hd.data(), t.bytes.data(), n,
+                     op == Operation::Restore, op == Operation::Sync, mtime_slack_ns);
+}
+
+} // namespace tp2
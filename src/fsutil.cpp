@@ -0,0 +1,103 @@
+#include "fsutil.hpp"
+#include <cerrno>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tp2 {
+
+FileStat stat_path(const std::string& path) {
+    FileStat fst;
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return fst;
+    fst.exists = true;
+    fst.is_dir = S_ISDIR(st.st_mode);
+    fst.size = static_cast<std::uint64_t>(st.st_size);
+    fst.mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    return fst;
+}
+
+std::uint64_t device_of(const std::string& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return 0;
+    return static_cast<std::uint64_t>(st.st_dev);
+}
+
+bool set_mtime_ns(const std::string& path, std::int64_t mtime_ns) {
+    struct timespec ts[2];
+    ts[0].tv_sec = static_cast<time_t>(mtime_ns / 1000000000LL);
+    ts[0].tv_nsec = static_cast<long>(mtime_ns % 1000000000LL);
+    if (ts[0].tv_nsec < 0) { ts[0].tv_nsec += 1000000000L; ts[0].tv_sec -= 1; }
+    ts[1] = ts[0];
+    return ::utimensat(AT_FDCWD, path.c_str(), ts, 0) == 0;
+}
+
+bool sync_filesystem(const std::string& path) {
+    Fd f(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (f.fd < 0) return false;
+    bool ok = ::syncfs(f.fd) == 0;
+    return f.close() && ok;
+}
+
+void drop_page_cache(const std::string& path) {
+    Fd f(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (f.fd < 0) return;
+    ::posix_fadvise(f.fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+Fd::~Fd() {
+    if (fd >= 0) ::close(fd);
+}
+
+bool Fd::close() {
+    const int f = fd;
+    fd = -1;
+    return f < 0 || ::close(f) == 0;
+}
+
+bool write_all(int fd, const char* data, std::size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+bool pwrite_all(int fd, const char* data, std::size_t len, std::uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = ::pwrite(fd, data, len, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        offset += static_cast<std::uint64_t>(n);
+        len -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+bool ensure_parent_dirs(const std::string& path) {
+    namespace fs = std::filesystem;
+    fs::path parent = fs::path(path).parent_path();
+    if (parent.empty()) return true;
+    std::error_code ec;
+    fs::create_directories(parent, ec); // another worker may win the race; checked below
+    return fs::is_directory(parent, ec);
+}
+
+bool is_internal_path(const std::string& rel) {
+    return rel.compare(0, 4, ".tp2") == 0;
+}
+
+std::string normalize_rel(const std::string& rel) {
+    return std::filesystem::path(rel).lexically_normal().generic_string();
+}
+
+} // namespace tp2
@@ -0,0 +1,167 @@
+#include "journal.hpp"
+#include "checksum.hpp"
+#include "fsutil.hpp"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace tp2 {
+
+namespace {
+const char* side(bool to_hd) { return to_hd ? "h" : "p"; }
+
+void write_begin(std::ostream& out, const std::string& rel, const JournalEntry& e) {
+    out << "B " << side(e.to_hd) << ' ' << e.src_mtime_ns << ' ' << e.src_size << ' ' << e.offset << ' '
+        << rel << '\n';
+}
+}
+
+RunJournal::RunJournal(const std::string& penPath)
+    : file_((std::filesystem::path(penPath) / kFileName).string()) {}
+
+RunJournal::~RunJournal() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+bool RunJournal::load() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    std::ifstream in(file_, std::ios::binary);
+    if (!in.is_open()) return false;
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::size_t pos = 0;
+    // Only newline-terminated lines count: a torn tail is what the crash interrupted.
+    for (std::size_t nl; (nl = text.find('\n', pos)) != std::string::npos; pos = nl + 1) {
+        std::istringstream ss(text.substr(pos, nl - pos));
+        std::string kind, dir, hex, rel;
+        JournalEntry e;
+        if (!(ss >> kind)) continue;
+        if (kind == "B") {
+            if (!(ss >> dir >> e.src_mtime_ns >> e.src_size >> e.offset)) continue;
+            e.to_hd = dir == "h";
+        } else if (kind == "C") {
+            std::uint64_t offset = 0;
+            if (!(ss >> offset)) continue;
+            ss.get();
+            std::getline(ss, rel);
+            auto it = entries_.find(rel);
+            if (it != entries_.end() && !it->second.done) it->second.offset = offset;
+            continue;
+        } else if (kind == "D") {
+            if (!(ss >> dir >> hex >> e.record.size >> e.record.mtime_ns)) continue;
+            if (!hash_from_hex(hex, e.record.hash)) continue;
+            e.to_hd = dir == "h";
+            e.done = true;
+            e.src_mtime_ns = e.record.mtime_ns;
+            e.src_size = e.record.size;
+        } else {
+            continue; // skip malformed lines
+        }
+        ss.get(); // single separator before the path
+        std::getline(ss, rel);
+        if (!rel.empty()) entries_[rel] = e;
+    }
+    return true;
+}
+
+bool RunJournal::open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) fd_ = ::open(file_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+    return fd_ >= 0;
+}
+
+bool RunJournal::find(const std::string& rel, JournalEntry& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(rel);
+    if (it == entries_.end()) return false;
+    out = it->second;
+    return true;
+}
+
+std::map<std::string, JournalEntry> RunJournal::entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_;
+}
+
+bool RunJournal::has_pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& kv : entries_) {
+        if (!kv.second.done) return true;
+    }
+    return false;
+}
+
+// One write(2) per record: with O_APPEND, concurrent records never interleave.
+void RunJournal::append(const std::string& line) {
+    // Best effort: a lost record only costs a recopy.
+    if (fd_ >= 0) write_all(fd_, line.data(), line.size());
+}
+
+void RunJournal::begin(const std::string& rel, bool to_hd, std::int64_t src_mtime_ns, std::uint64_t src_size,
+                       std::uint64_t offset) {
+    JournalEntry e;
+    e.to_hd = to_hd;
+    e.src_mtime_ns = src_mtime_ns;
+    e.src_size = src_size;
+    e.offset = offset;
+    std::ostringstream line;
+    write_begin(line, rel, e);
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[rel] = e;
+    append(line.str());
+}
+
+void RunJournal::checkpoint(const std::string& rel, std::uint64_t offset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[rel].offset = offset;
+    append("C " + std::to_string(offset) + ' ' + rel + '\n');
+    if (fd_ >= 0) ::fdatasync(fd_);
+}
+
+void RunJournal::done(const std::string& rel, bool to_hd, const ManifestEntry& record) {
+    JournalEntry e;
+    e.to_hd = to_hd;
+    e.done = true;
+    e.record = record;
+    e.src_mtime_ns = record.mtime_ns;
+    e.src_size = record.size;
+    std::ostringstream line;
+    line << "D " << side(to_hd) << ' ' << hash_to_hex(record.hash) << ' ' << record.size << ' '
+         << record.mtime_ns << ' ' << rel << '\n';
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[rel] = e;
+    append(line.str());
+}
+
+bool RunJournal::finish() {
+    namespace fs = std::filesystem;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    std::error_code ec;
+    bool pending = false;
+    for (const auto& kv : entries_) pending |= !kv.second.done;
+    if (!pending) {
+        fs::remove(file_, ec);
+        return !ec;
+    }
+    const std::string tmp = file_ + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        for (const auto& kv : entries_) {
+            if (!kv.second.done) write_begin(out, kv.first, kv.second);
+        }
+        out.flush();
+        if (!out.good()) return false;
+    }
+    fs::rename(tmp, file_, ec);
+    return !ec;
+}
+
+} // namespace tp2
@@ -1,29 +1,117 @@
 #include "backup.hpp"
+#include "cache.hpp"
+#include "concurrency.hpp"
+#include "daemon.hpp"
+#include "device_profile.hpp"
+#include "plan.hpp"
+#include "readahead.hpp"
+#include "scheduler.hpp"
+#include "throttle.hpp"
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <ostream>
 #include <string>
+#include <vector>
+#include <sys/sysmacros.h>
 
 using tp2::ActionResult;
+using tp2::BackupOptions;
+using tp2::BackupPlan;
 using tp2::Operation;
 using tp2::execute_backup;
 
-static void print_usage() {
-    std::cerr << "Usage: tp2_cli --mode <backup|restore> --hd <path> --pen <path> [--parm <file>]" << std::endl;
+static void print_usage(std::ostream& err) {
+    err << "Usage: tp2_cli --mode <backup|restore|verify|sync|mirror|snapshot|prune> --hd <path> --pen <path> [--pen <path>... [--stripe]] [--parm <file>]"
+                 " [--jobs <n|auto>] [--profile <spec>] [--readahead <size>] [--bwlimit <bytes/s>] [--write-limit <bytes/s>] [--read-iops <n>] [--write-iops <n>]"
+                 " [--quarantine] [--dedup]"
+                 " [--compress [--compress-threads <n>]] [--pack <size>] [--split <size>] [--as-of <date>]"
+                 " [--keep-last <n>] [--keep-daily <n>] [--keep-weekly <n>] [--time-budget <s>]"
+                 " [--dry-run [--plan-out <file>] | --plan <file> | --watch [--debounce <ms>]] [--socket <path>]\n"
+           "       tp2_cli --job-file <file> [--device-limit <n>] [--jobs <n>] [other run options]\n"
+           "       tp2_cli --daemon <path>\n"
+           "       tp2_cli --socket <path> --throttle [--bwlimit <bytes/s>] [--write-limit <bytes/s>] [--read-iops <n>] [--write-iops <n>]"
+        << std::endl;
 }
 
 struct CliOptions {
     std::string mode;
     std::string hd;
-    std::string pen;
+    std::vector<std::string> pens; // --pen may repeat
+    bool stripe = false;
     std::string parm = "Backup.parm";
+    std::string jobs;
+    std::string profile; // device class and overrides (see device_profile.hpp); empty = auto, quiet
+    std::string readahead = "0"; // cap on source bytes read ahead of the copies (0 = off, the default)
+    std::string bwlimit;     // read bytes/s
+    std::string write_limit; // write bytes/s
+    std::string read_iops;
+    std::string write_iops;
+    bool throttle = false;   // only change the daemon's limits
+    bool quarantine = false;
+    bool dedup = false;
+    bool compress = false;
+    std::string compress_threads;
+    std::string pack;
+    std::string split;       // part size for large pen copies (default: only on FAT32)
+    std::string as_of;
+    std::string keep_last;
+    std::string keep_daily;
+    std::string keep_weekly;
+    std::string time_budget;
+    bool dry_run = false;
+    std::string plan_out;
+    std::string plan_in;
+    bool watch = false;
+    std::string debounce;
+    std::string daemon; // serve runs on this socket
+    std::string socket; // send this run to the daemon on this socket
+    std::string job_file;
+    std::string device_limit;
 };
 
-static bool parse_args(int argc, char** argv, CliOptions& opts) {
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
+static std::atomic<bool> g_stop{false};
+static std::atomic<bool> g_reload{false};
+
+static void request_stop(int) {
+    g_stop.store(true);
+}
+
+static void request_reload(int) {
+    g_reload.store(true);
+}
+
+// Parse a non-negative size with optional K/M/G suffix (powers of 1024).
+static bool parse_size(const std::string& text, std::uint64_t& out) {
+    if (text.empty()) return false;
+    std::size_t pos = 0;
+    unsigned long long value = 0;
+    try {
+        if (text[0] == '-') return false;
+        value = std::stoull(text, &pos);
+    } catch (const std::exception&) {
+        return false;
+    }
+    std::string suffix = text.substr(pos);
+    std::uint64_t mult = 1;
+    if (suffix == "K" || suffix == "k") mult = 1024ULL;
+    else if (suffix == "M" || suffix == "m") mult = 1024ULL * 1024;
+    else if (suffix == "G" || suffix == "g") mult = 1024ULL * 1024 * 1024;
+    else if (!suffix.empty()) return false;
+    out = static_cast<std::uint64_t>(value) * mult;
+    return true;
+}
+
+static bool parse_args(const std::vector<std::string>& args, CliOptions& opts, std::ostream& err) {
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
         auto next = [&](const char* name) -> std::string {
-            if (i + 1 < argc) return std::string(argv[++i]);
-            std::cerr << "Missing value for " << name << std::endl;
-            print_usage();
+            if (i + 1 < args.size()) return args[++i];
+            err << "Missing value for " << name << std::endl;
+            print_usage(err);
             return std::string();
         };
 
@@ -32,58 +120,504 @@ static bool parse_args(int argc, char** argv, CliOptions& opts) {
         } else if (arg == "--hd") {
             opts.hd = next("--hd");
         } else if (arg == "--pen") {
-            opts.pen = next("--pen");
+            std::string pen = next("--pen");
+            if (!pen.empty()) opts.pens.push_back(pen);
+        } else if (arg == "--stripe") {
+            opts.stripe = true;
         } else if (arg == "--parm") {
             opts.parm = next("--parm");
+        } else if (arg == "--jobs") {
+            opts.jobs = next("--jobs");
+        } else if (arg == "--profile") {
+            opts.profile = next("--profile");
+        } else if (arg == "--readahead") {
+            opts.readahead = next("--readahead");
+        } else if (arg == "--bwlimit") {
+            opts.bwlimit = next("--bwlimit");
+        } else if (arg == "--write-limit") {
+            opts.write_limit = next("--write-limit");
+        } else if (arg == "--read-iops") {
+            opts.read_iops = next("--read-iops");
+        } else if (arg == "--write-iops") {
+            opts.write_iops = next("--write-iops");
+        } else if (arg == "--throttle") {
+            opts.throttle = true;
+        } else if (arg == "--quarantine") {
+            opts.quarantine = true;
+        } else if (arg == "--dedup") {
+            opts.dedup = true;
+        } else if (arg == "--compress") {
+            opts.compress = true;
+        } else if (arg == "--compress-threads") {
+            opts.compress_threads = next("--compress-threads");
+        } else if (arg == "--pack") {
+            opts.pack = next("--pack");
+        } else if (arg == "--split") {
+            opts.split = next("--split");
+        } else if (arg == "--as-of") {
+            opts.as_of = next("--as-of");
+        } else if (arg == "--keep-last") {
+            opts.keep_last = next("--keep-last");
+        } else if (arg == "--keep-daily") {
+            opts.keep_daily = next("--keep-daily");
+        } else if (arg == "--keep-weekly") {
+            opts.keep_weekly = next("--keep-weekly");
+        } else if (arg == "--time-budget") {
+            opts.time_budget = next("--time-budget");
+        } else if (arg == "--dry-run") {
+            opts.dry_run = true;
+        } else if (arg == "--plan-out") {
+            opts.plan_out = next("--plan-out");
+        } else if (arg == "--plan") {
+            opts.plan_in = next("--plan");
+        } else if (arg == "--watch") {
+            opts.watch = true;
+        } else if (arg == "--debounce") {
+            opts.debounce = next("--debounce");
+        } else if (arg == "--daemon") {
+            opts.daemon = next("--daemon");
+        } else if (arg == "--socket") {
+            opts.socket = next("--socket");
+        } else if (arg == "--job-file") {
+            opts.job_file = next("--job-file");
+        } else if (arg == "--device-limit") {
+            opts.device_limit = next("--device-limit");
         } else if (arg == "-h" || arg == "--help") {
-            print_usage();
+            print_usage(err);
             return false; // signal "handled" (no error)
         } else {
-            std::cerr << "Unknown option: " << arg << std::endl;
-            print_usage();
+            err << "Unknown option: " << arg << std::endl;
+            print_usage(err);
             return false;
         }
     }
     return true;
 }
 
-int main(int argc, char** argv) {
+// Fill limits from the --bwlimit/--write-limit/--read-iops/--write-iops given; the others keep
+// their value. given tells whether any was.
+static bool parse_limits(const CliOptions& opts, tp2::IoLimits& limits, bool& given, std::ostream& err) {
+    struct { const char* name; const std::string& text; std::uint64_t& value; } fields[] = {
+        {"--bwlimit", opts.bwlimit, limits.read_bytes_per_sec},
+        {"--write-limit", opts.write_limit, limits.write_bytes_per_sec},
+        {"--read-iops", opts.read_iops, limits.read_ops_per_sec},
+        {"--write-iops", opts.write_iops, limits.write_ops_per_sec},
+    };
+    given = false;
+    for (auto& f : fields) {
+        if (f.text.empty()) continue;
+        if (!parse_size(f.text, f.value)) {
+            err << "Invalid value for " << f.name << ": " << f.text << std::endl;
+            print_usage(err);
+            return false;
+        }
+        given = true;
+    }
+    return true;
+}
+
+// --jobs auto: where each device's limit settled.
+static void print_concurrency(const tp2::AdaptiveConcurrency& concurrency, std::ostream& err) {
+    for (const auto& d : concurrency.devices()) {
+        const auto dev = static_cast<dev_t>(d.device);
+        err << "jobs auto: device " << major(dev) << ':' << minor(dev) << ": " << d.limit << " in flight (peak "
+            << d.peak << "), " << static_cast<std::uint64_t>(d.throughput / (1024 * 1024)) << " MiB/s" << std::endl;
+    }
+}
+
+// How far the source reads ran ahead of the copies.
+static void print_readahead(const tp2::Readahead& readahead, std::ostream& err) {
+    const auto s = readahead.stats();
+    err << "readahead: " << s.files << " files, " << s.bytes / (1024 * 1024) << " MiB ahead of the copies ("
+        << s.hits << " found ready), peak queue " << s.peak_files << " files / " << s.peak_bytes / (1024 * 1024)
+        << " MiB of " << readahead.budget() / (1024 * 1024) << " MiB" << std::endl;
+}
+
+// The tuning profile picked for each device the run touched.
+static void print_profiles(const tp2::DeviceProfiles& profiles, std::ostream& err) {
+    for (const auto& d : profiles.devices()) {
+        const auto dev = static_cast<dev_t>(d.device);
+        err << "profile: device " << major(dev) << ':' << minor(dev) << " (" << d.path
+            << "): " << tp2::describe_profile(d.profile) << std::endl;
+    }
+}
+
+static int report(const ActionResult& res, std::ostream& err) {
+    if (!res.message.empty()) {
+        err << res.message << std::endl;
+    }
+    for (const auto& name : res.mismatched) {
+        err << "mismatch: " << name << std::endl;
+    }
+    for (const auto& name : res.removed) {
+        err << "removed: " << name << std::endl;
+    }
+    for (const auto& pen : res.pens) {
+        err << "pen " << pen.pen << ": " << pen.code << ' ' << pen.message << std::endl;
+    }
+    return res.code;
+}
+
+// One run of the command line. The daemon calls this for every request, with its cache and
+// its throttle (used by runs that set no limits of their own).
+static int run_cli(const std::vector<std::string>& args, std::ostream& out, std::ostream& err,
+                   tp2::MetadataCache* cache, tp2::IoThrottle* shared_throttle) {
     CliOptions opts;
-    if (!parse_args(argc, argv, opts)) {
+    if (!parse_args(args, opts, err)) {
         // If help was shown, exit 0; otherwise treat as error 1
         // We can't distinguish easily here, keep previous behavior: non-recognized option -> 1
         // For simplicity, return 0 only when explicitly -h/--help was passed (handled inside parse_args)
         return 0;
     }
 
-    Operation op;
-    if (opts.mode == "backup") op = Operation::Backup;
+    if (cache && (opts.watch || !opts.daemon.empty() || !opts.socket.empty())) {
+        err << "--watch, --daemon and --socket are not available through the daemon" << std::endl;
+        return 1;
+    }
+    if (opts.throttle) {
+        err << "--throttle requires --socket (it changes a running daemon's limits)" << std::endl;
+        print_usage(err);
+        return 1;
+    }
+
+    const bool job_file = !opts.job_file.empty();
+    if (job_file && (!opts.mode.empty() || !opts.hd.empty() || !opts.pens.empty())) {
+        err << "--job-file takes mode, hd and pen from the file: drop --mode, --hd and --pen" << std::endl;
+        print_usage(err);
+        return 1;
+    }
+    if (!opts.device_limit.empty() && !job_file) {
+        err << "--device-limit requires --job-file" << std::endl;
+        print_usage(err);
+        return 1;
+    }
+
+    Operation op = Operation::Backup;
+    if ((!opts.plan_in.empty() || job_file) && opts.mode.empty()) {
+        // A saved plan carries its own mode, and so does each job of a job file
+    } else if (opts.mode == "backup") op = Operation::Backup;
     else if (opts.mode == "restore") op = Operation::Restore;
+    else if (opts.mode == "verify") op = Operation::Verify;
+    else if (opts.mode == "sync") op = Operation::Sync;
+    else if (opts.mode == "mirror") op = Operation::Mirror;
+    else if (opts.mode == "snapshot") op = Operation::Snapshot;
+    else if (opts.mode == "prune") op = Operation::Prune;
     else if (opts.mode.empty()) {
-        std::cerr << "Missing required --mode" << std::endl;
-        print_usage();
+        err << "Missing required --mode" << std::endl;
+        print_usage(err);
         return 1;
     } else {
-        std::cerr << "Unsupported mode: " << opts.mode << std::endl;
-        print_usage();
+        err << "Unsupported mode: " << opts.mode << std::endl;
+        print_usage(err);
         return 2; // per spec, op not supported
     }
 
     // Validate required paths before delegating
-    if (opts.hd.empty()) {
-        std::cerr << "Missing required --hd" << std::endl;
-        print_usage();
+    if (opts.hd.empty() && op != Operation::Prune && !job_file) {
+        err << "Missing required --hd" << std::endl;
+        print_usage(err);
         return 1;
     }
-    if (opts.pen.empty()) {
-        std::cerr << "Missing required --pen" << std::endl;
-        print_usage();
+    if (opts.pens.empty() && !job_file) {
+        err << "Missing required --pen" << std::endl;
+        print_usage(err);
         return 1;
     }
 
-    ActionResult res = execute_backup(opts.hd, opts.pen, opts.parm, op);
-    if (!res.message.empty()) {
-        std::cerr << res.message << std::endl;
+    tp2::ProfileSpec spec;
+    std::string spec_error;
+    if (!tp2::parse_profile_spec(opts.profile.empty() ? "auto" : opts.profile, spec, spec_error)) {
+        err << "Invalid value for --profile: " << spec_error << std::endl;
+        print_usage(err);
+        return 1;
     }
-    return res.code;
+    std::uint64_t readahead_bytes = 0;
+    if (!parse_size(opts.readahead, readahead_bytes)) {
+        err << "Invalid value for --readahead: " << opts.readahead << std::endl;
+        print_usage(err);
+        return 1;
+    }
+    BackupOptions run;
+    tp2::AdaptiveConcurrency concurrency;
+    tp2::DeviceProfiles profiles(spec);
+    tp2::Readahead readahead(readahead_bytes);
+    run.profiles = &profiles;
+    if (readahead_bytes > 0) run.readahead = &readahead;
+    auto finish = [&](const ActionResult& res) {
+        // The profiles are metrics too: shown when asked for or next to the other metrics.
+        const bool ahead = run.readahead && readahead.stats().files > 0;
+        if (!opts.profile.empty() || run.concurrency || ahead) print_profiles(profiles, err);
+        if (run.concurrency) print_concurrency(concurrency, err);
+        if (ahead) print_readahead(readahead, err);
+        return report(res, err);
+    };
+    // With --profile but no --jobs, the slowest device's queue depth decides how many files copy
+    // at once; with neither, the run stays sequential.
+    auto default_jobs = [&](const std::vector<std::string>& paths) {
+        if (!opts.jobs.empty() || opts.profile.empty()) return;
+        unsigned depth = 0;
+        for (const auto& path : paths) {
+            if (path.empty()) continue;
+            const unsigned d = profiles.for_path(path).queue_depth;
+            depth = depth == 0 ? d : std::min(depth, d);
+        }
+        run.jobs = std::max(1u, depth);
+    };
+    if (opts.jobs == "auto") {
+        // Enough threads for the fastest device; each device's limit decides how many copy at once.
+        run.jobs = tp2::AdaptiveConcurrency::kMaxLimit;
+        run.concurrency = &concurrency;
+    } else if (!opts.jobs.empty()) {
+        std::uint64_t jobs = 0;
+        if (!parse_size(opts.jobs, jobs) || jobs == 0 || jobs > 1024) {
+            err << "Invalid value for --jobs: " << opts.jobs << std::endl;
+            print_usage(err);
+            return 1;
+        }
+        run.jobs = static_cast<unsigned>(jobs);
+    }
+    tp2::IoLimits limits;
+    bool own_limits = false;
+    if (!parse_limits(opts, limits, own_limits, err)) return 1;
+    // Shared by every worker thread (and every pen and job) of this run.
+    tp2::IoThrottle throttle(limits);
+    run.throttle = own_limits ? &throttle : shared_throttle;
+    run.quarantine = opts.quarantine;
+    run.dedup = opts.dedup;
+    run.compress = opts.compress;
+    if (!opts.compress_threads.empty()) {
+        std::uint64_t threads = 0;
+        if (!parse_size(opts.compress_threads, threads) || threads == 0 || threads > 64) {
+            err << "Invalid value for --compress-threads: " << opts.compress_threads << std::endl;
+            print_usage(err);
+            return 1;
+        }
+        run.compress_threads = static_cast<unsigned>(threads);
+    }
+    if (!opts.pack.empty() && (!parse_size(opts.pack, run.pack_threshold) || run.pack_threshold == 0)) {
+        err << "Invalid value for --pack: " << opts.pack << std::endl;
+        print_usage(err);
+        return 1;
+    }
+    if (!opts.split.empty() && (!parse_size(opts.split, run.split_size) || run.split_size == 0)) {
+        err << "Invalid value for --split: " << opts.split << std::endl;
+        print_usage(err);
+        return 1;
+    }
+
+    if (!opts.as_of.empty() && op != Operation::Restore && !job_file) {
+        err << "--as-of requires --mode restore" << std::endl;
+        print_usage(err);
+        return 1;
+    }
+    run.as_of = opts.as_of;
+    struct { const char* name; const std::string& text; unsigned& value; } counts[] = {
+        {"--keep-last", opts.keep_last, run.keep_last},
+        {"--keep-daily", opts.keep_daily, run.keep_daily},
+        {"--keep-weekly", opts.keep_weekly, run.keep_weekly},
+        {"--time-budget", opts.time_budget, run.time_budget_sec},
+    };
+    for (auto& c : counts) {
+        if (c.text.empty()) continue;
+        std::uint64_t value = 0;
+        if ((op != Operation::Prune && !job_file) || !parse_size(c.text, value) || value > 1000000) {
+            err << "Invalid value for " << c.name << ": " << c.text << " (requires --mode prune)" << std::endl;
+            print_usage(err);
+            return 1;
+        }
+        c.value = static_cast<unsigned>(value);
+    }
+
+    if (job_file) {
+        if (opts.watch || opts.dry_run || !opts.plan_in.empty() || opts.stripe) {
+            err << "--watch, --dry-run, --plan and --stripe do not combine with --job-file" << std::endl;
+            print_usage(err);
+            return 1;
+        }
+        std::uint64_t device_limit = 2;
+        if (!opts.device_limit.empty() && (!parse_size(opts.device_limit, device_limit) || device_limit > 1024)) {
+            err << "Invalid value for --device-limit: " << opts.device_limit << std::endl;
+            print_usage(err);
+            return 1;
+        }
+        std::vector<tp2::Job> jobs;
+        std::string error;
+        if (!tp2::load_jobs(opts.job_file, jobs, error)) {
+            err << error << std::endl;
+            return 1;
+        }
+        run.cache = cache;
+        std::vector<std::string> paths;
+        for (const auto& job : jobs) {
+            paths.push_back(job.hd);
+            paths.push_back(job.pen);
+        }
+        default_jobs(paths);
+        std::vector<ActionResult> per_job;
+        ActionResult res = tp2::execute_jobs(jobs, run, static_cast<unsigned>(device_limit), per_job);
+        for (std::size_t j = 0; j < jobs.size(); ++j) {
+            out << "job " << jobs[j].name << ": " << per_job[j].code << ' ' << per_job[j].message << std::endl;
+        }
+        res.pens.clear(); // already listed per job
+        return finish(res);
+    }
+
+    std::vector<std::string> paths = opts.pens;
+    paths.push_back(opts.hd);
+    default_jobs(paths);
+    if (!opts.debounce.empty() && !opts.watch) {
+        err << "--debounce requires --watch" << std::endl;
+        print_usage(err);
+        return 1;
+    }
+    if (opts.watch) {
+        tp2::WatchOptions watch;
+        std::uint64_t debounce = 0;
+        if (!opts.debounce.empty()) {
+            if (!parse_size(opts.debounce, debounce) || debounce > 600000) {
+                err << "Invalid value for --debounce: " << opts.debounce << std::endl;
+                print_usage(err);
+                return 1;
+            }
+            watch.debounce_ms = static_cast<unsigned>(debounce);
+        }
+        if (op != Operation::Backup || opts.pens.size() > 1 || opts.dry_run || !opts.plan_in.empty()) {
+            err << "--watch takes --mode backup with a single --pen" << std::endl;
+            print_usage(err);
+            return 1;
+        }
+        // Runs until interrupted; each batch gets a status line.
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+        watch.stop = &g_stop;
+        watch.on_batch = [&out](const ActionResult& res, std::size_t entries) {
+            out << "watch: " << entries << " entr(ies): " << res.code << ' ' << res.message << std::endl;
+        };
+        return finish(tp2::watch_backup(opts.hd, opts.pens.front(), opts.parm, run, watch));
+    }
+    if (opts.stripe && opts.pens.size() < 2) {
+        err << "--stripe requires two or more --pen" << std::endl;
+        print_usage(err);
+        return 1;
+    }
+    run.stripe = opts.stripe;
+    run.cache = cache;
+    if (opts.pens.size() > 1) {
+        if (opts.dry_run || !opts.plan_in.empty()) {
+            err << "--dry-run and --plan take a single --pen" << std::endl;
+            print_usage(err);
+            return 1;
+        }
+        return finish(tp2::execute_backup_multi(opts.hd, opts.pens, opts.parm, op, run));
+    }
+    const std::string& pen = opts.pens.front();
+
+    if (!opts.plan_in.empty()) {
+        BackupPlan plan;
+        if (!tp2::load_plan(opts.plan_in, plan)) {
+            err << "Cannot read plan: " << opts.plan_in << std::endl;
+            return 1;
+        }
+        if (!opts.mode.empty() && op != plan.op) {
+            err << "--mode " << opts.mode << " does not match the mode of plan " << opts.plan_in << std::endl;
+            return 1;
+        }
+        return finish(tp2::execute_plan(opts.hd, pen, plan, run));
+    }
+    if (opts.dry_run) {
+        BackupPlan plan;
+        ActionResult res = tp2::plan_backup(opts.hd, pen, opts.parm, op, run, plan);
+        if (res.code != 0) return finish(res);
+        out << tp2::format_plan(plan);
+        if (!opts.plan_out.empty() && !tp2::save_plan(plan, opts.plan_out)) {
+            err << "Cannot write plan: " << opts.plan_out << std::endl;
+            return 5;
+        }
+        return 0;
+    }
+
+    return finish(execute_backup(opts.hd, pen, opts.parm, op, run));
+}
+
+static void print_limits(const tp2::IoLimits& limits, std::ostream& out) {
+    auto show = [&out](std::uint64_t value, const char* unit) {
+        if (value == 0) out << "unlimited";
+        else out << value << ' ' << unit;
+    };
+    out << "read: ";
+    show(limits.read_bytes_per_sec, "B/s");
+    out << ", ";
+    show(limits.read_ops_per_sec, "op/s");
+    out << "; write: ";
+    show(limits.write_bytes_per_sec, "B/s");
+    out << ", ";
+    show(limits.write_ops_per_sec, "op/s");
+    out << std::endl;
+}
+
+// --daemon: keep parm lists, manifests and pen stats in memory across runs sent over the socket.
+// SIGHUP drops them; SIGINT/SIGTERM stop the daemon. --throttle requests are answered at once,
+// even during a run, and change the limits of every run that sets none of its own.
+static int serve_daemon(const std::string& socketPath) {
+    tp2::MetadataCache cache;
+    tp2::IoThrottle throttle;
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+    std::signal(SIGHUP, request_reload);
+    auto handler = [&cache, &throttle](const std::vector<std::string>& args, std::ostream& out, std::ostream& err) {
+        if (g_reload.exchange(false)) cache.clear();
+        return run_cli(args, out, err, &cache, &throttle);
+    };
+    auto control = [&throttle](const std::vector<std::string>& args, std::ostream& out, std::ostream& err) {
+        CliOptions opts;
+        if (std::find(args.begin(), args.end(), "--throttle") == args.end()) return -1;
+        if (!parse_args(args, opts, err)) return 1;
+        tp2::IoLimits limits = throttle.limits();
+        bool given = false;
+        if (!parse_limits(opts, limits, given, err)) return 1;
+        if (given) throttle.set_limits(limits);
+        print_limits(throttle.limits(), out);
+        return 0;
+    };
+    std::cerr << "tp2 daemon listening on " << socketPath << std::endl;
+    ActionResult res = tp2::serve_requests(socketPath, handler, g_stop, control);
+    return res.code == 0 ? 0 : report(res, std::cerr);
+}
+
+// --socket: hand the run to the daemon. Paths are made absolute first, since the daemon
+// runs elsewhere; the default parm file is sent explicitly for the same reason.
+static int send_to_daemon(const std::vector<std::string>& args, const std::string& socketPath) {
+    namespace fs = std::filesystem;
+    static const char* const kPathOptions[] = {"--hd", "--pen", "--parm", "--plan", "--plan-out", "--job-file"};
+    std::vector<std::string> forwarded;
+    bool has_parm = false;
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--socket") {
+            ++i;
+            continue;
+        }
+        forwarded.push_back(args[i]);
+        if (i + 1 == args.size()) break;
+        for (const char* option : kPathOptions) {
+            if (args[i] != option) continue;
+            has_parm |= args[i] == "--parm";
+            forwarded.push_back(fs::absolute(args[++i]).string());
+            break;
+        }
+    }
+    if (!has_parm) {
+        forwarded.push_back("--parm");
+        forwarded.push_back(fs::absolute("Backup.parm").string());
+    }
+    ActionResult res = tp2::send_request(socketPath, forwarded, std::cout, std::cerr);
+    return res.message.empty() ? res.code : report(res, std::cerr);
+}
+
+int main(int argc, char** argv) {
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    CliOptions opts;
+    if (!parse_args(args, opts, std::cerr)) return 0;
+    if (!opts.daemon.empty()) return serve_daemon(opts.daemon);
+    if (!opts.socket.empty()) return send_to_daemon(args, opts.socket);
+    return run_cli(args, std::cout, std::cerr, nullptr, nullptr);
 }
@@ -0,0 +1,63 @@
+#include "manifest.hpp"
+#include "checksum.hpp"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace tp2 {
+
+bool Manifest::load(const std::string& penPath) {
+    entries_.clear();
+    std::ifstream in(std::filesystem::path(penPath) / kFileName);
+    if (!in.is_open()) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream ss(line);
+        std::string hex;
+        ManifestEntry e;
+        if (!(ss >> hex >> e.size >> e.mtime_ns)) continue; // skip malformed lines
+        if (!hash_from_hex(hex, e.hash)) continue;
+        ss.get(); // single separator before the path
+        std::string rel;
+        std::getline(ss, rel);
+        if (!rel.empty()) entries_[rel] = e;
+    }
+    return true;
+}
+
+bool Manifest::save(const std::string& penPath) const {
+    namespace fs = std::filesystem;
+    fs::path target = fs::path(penPath) / kFileName;
+    fs::path tmp = target;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        out << "# tp2 manifest v1\n";
+        for (const auto& kv : entries_) {
+            out << hash_to_hex(kv.second.hash) << ' ' << kv.second.size << ' '
+                << kv.second.mtime_ns << ' ' << kv.first << '\n';
+        }
+        out.flush();
+        if (!out.good()) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, target, ec);
+    return !ec;
+}
+
+const ManifestEntry* Manifest::find(const std::string& rel) const {
+    auto it = entries_.find(rel);
+    return it == entries_.end() ? nullptr : &it->second;
+}
+
+void Manifest::set(const std::string& rel, const ManifestEntry& entry) {
+    entries_[rel] = entry;
+}
+
+void Manifest::erase(const std::string& rel) {
+    entries_.erase(rel);
+}
+
+} // namespace tp2
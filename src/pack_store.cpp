@@ -0,0 +1,238 @@
+#include "pack_store.hpp"
+#include "checksum.hpp"
+#include "fsutil.hpp"
+#include "throttle.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tp2 {
+
+namespace {
+constexpr std::size_t kIoBufferSize = 256 * 1024;
+constexpr const char* kIndexName = "index";
+}
+
+PackStore::PackStore(const std::string& penPath)
+    : dir_((std::filesystem::path(penPath) / kDirName).string()) {}
+
+PackStore::~PackStore() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+std::string PackStore::pack_path(std::uint32_t pack) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/pack-%06u.dat", pack);
+    return dir_ + name;
+}
+
+bool PackStore::load() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    dirty_ = false;
+    std::ifstream in(dir_ + "/" + kIndexName);
+    if (!in.is_open()) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream ss(line);
+        PackEntry e;
+        std::string hex;
+        if (!(ss >> e.pack >> e.offset >> e.length >> e.mtime_ns >> hex)) continue; // skip malformed lines
+        if (!hash_from_hex(hex, e.hash)) continue;
+        ss.get(); // single separator before the path
+        std::string rel;
+        std::getline(ss, rel);
+        if (!rel.empty()) index_[rel] = e;
+    }
+    return true;
+}
+
+bool PackStore::save() const {
+    namespace fs = std::filesystem;
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+    const std::string target = dir_ + "/" + kIndexName;
+    const std::string tmp = target + ".tmp";
+    // The appended bytes reach the device before an index that points at them.
+    if (unsynced_ && fd_ >= 0) {
+        if (::fdatasync(fd_) != 0) return false;
+        unsynced_ = false;
+    }
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        out << "# tp2 pack index v1\n";
+        for (const auto& kv : index_) {
+            const PackEntry& e = kv.second;
+            out << e.pack << ' ' << e.offset << ' ' << e.length << ' ' << e.mtime_ns << ' '
+                << hash_to_hex(e.hash) << ' ' << kv.first << '\n';
+        }
+        out.flush();
+        if (!out.good()) return false;
+    }
+    fs::rename(tmp, target, ec);
+    if (ec) return false;
+    dirty_ = false;
+    return true;
+}
+
+bool PackStore::find(const std::string& rel, PackEntry& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(rel);
+    if (it == index_.end()) return false;
+    out = it->second;
+    return true;
+}
+
+bool PackStore::erase(const std::string& rel) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool found = index_.erase(rel) > 0;
+    dirty_ |= found;
+    return found;
+}
+
+std::vector<std::string> PackStore::paths() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> out;
+    out.reserve(index_.size());
+    for (const auto& kv : index_) out.push_back(kv.first);
+    return out;
+}
+
+std::size_t PackStore::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.size();
+}
+
+bool PackStore::dirty() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dirty_;
+}
+
+// Open the newest pack for appending, or start a new one once it is full. Caller holds mutex_.
+bool PackStore::open_current() {
+    namespace fs = std::filesystem;
+    if (fd_ >= 0 && current_size_ < kPackTargetSize) return true;
+    if (fd_ >= 0) {
+        if (unsynced_ && ::fdatasync(fd_) != 0) return false; // save() only syncs the open pack
+        unsynced_ = false;
+        ::close(fd_);
+        fd_ = -1;
+        ++current_;
+    } else {
+        std::error_code ec;
+        fs::create_directories(dir_, ec);
+        current_ = 1;
+        for (fs::directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+            unsigned n = 0;
+            if (std::sscanf(it->path().filename().c_str(), "pack-%u.dat", &n) == 1 && n > current_) current_ = n;
+        }
+    }
+    for (;;) {
+        fd_ = ::open(pack_path(current_).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (::fstat(fd_, &st) != 0) return false;
+        current_size_ = static_cast<std::uint64_t>(st.st_size);
+        if (current_size_ < kPackTargetSize) return true;
+        ::close(fd_);
+        fd_ = -1;
+        ++current_;
+    }
+}
+
+bool PackStore::append(const std::string& rel, const std::string& src, std::int64_t mtime_ns,
+                       ManifestEntry* record) {
+    Fd in(::open(src.c_str(), O_RDONLY));
+    if (in.fd < 0) return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_current()) return false;
+    PackEntry e;
+    e.pack = current_;
+    e.offset = current_size_;
+    e.mtime_ns = mtime_ns;
+    std::vector<char> buf(kIoBufferSize);
+    Hasher64 hasher;
+    bool ok = true;
+    for (;;) {
+        ssize_t n = ::read(in.fd, buf.data(), buf.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { ok = n == 0; break; }
+        if (throttle_) {
+            throttle_->read(static_cast<std::uint64_t>(n));
+            throttle_->write(static_cast<std::uint64_t>(n));
+        }
+        hasher.update(buf.data(), static_cast<std::size_t>(n));
+        if (!write_all(fd_, buf.data(), static_cast<std::size_t>(n))) { ok = false; break; }
+        e.length += static_cast<std::uint64_t>(n);
+    }
+    if (!ok) {
+        // Drop the partial tail so the next append starts at a clean offset.
+        if (::ftruncate(fd_, static_cast<off_t>(e.offset)) != 0) { ::close(fd_); fd_ = -1; }
+        return false;
+    }
+    current_size_ += e.length;
+    unsynced_ = true;
+    e.hash = hasher.digest();
+    index_[rel] = e;
+    dirty_ = true;
+    if (record) *record = {e.length, mtime_ns, e.hash};
+    return true;
+}
+
+bool PackStore::extract(const PackEntry& e, const std::string& dst) const {
+    Fd in(::open(pack_path(e.pack).c_str(), O_RDONLY));
+    if (in.fd < 0) return false;
+    Fd out(::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if (out.fd < 0) return false;
+    loff_t off = static_cast<loff_t>(e.offset);
+    std::uint64_t remaining = e.length;
+    while (remaining > 0 && !throttle_) {
+        ssize_t n = ::copy_file_range(in.fd, &off, out.fd, nullptr, remaining, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; // unsupported here or short pack: finish in user space
+        remaining -= static_cast<std::uint64_t>(n);
+    }
+    std::vector<char> buf(remaining > 0 ? kIoBufferSize : 0);
+    while (remaining > 0) {
+        std::size_t want = remaining < buf.size() ? static_cast<std::size_t>(remaining) : buf.size();
+        ssize_t n = ::pread(in.fd, buf.data(), want, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (throttle_ && n > 0) {
+            throttle_->read(static_cast<std::uint64_t>(n));
+            throttle_->write(static_cast<std::uint64_t>(n));
+        }
+        if (n <= 0 || !write_all(out.fd, buf.data(), static_cast<std::size_t>(n))) return false;
+        off += n;
+        remaining -= static_cast<std::uint64_t>(n);
+    }
+    if (!out.close()) return false;
+    return set_mtime_ns(dst, e.mtime_ns);
+}
+
+bool PackStore::read(const PackEntry& e, const std::function<bool(const char*, std::size_t)>& sink) const {
+    Fd in(::open(pack_path(e.pack).c_str(), O_RDONLY));
+    if (in.fd < 0) return false;
+    std::vector<char> buf(kIoBufferSize);
+    off_t off = static_cast<off_t>(e.offset);
+    std::uint64_t remaining = e.length;
+    while (remaining > 0) {
+        std::size_t want = remaining < buf.size() ? static_cast<std::size_t>(remaining) : buf.size();
+        ssize_t n = ::pread(in.fd, buf.data(), want, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (throttle_ && n > 0) throttle_->read(static_cast<std::uint64_t>(n));
+        if (n <= 0 || !sink(buf.data(), static_cast<std::size_t>(n))) return false;
+        off += n;
+        remaining -= static_cast<std::uint64_t>(n);
+    }
+    return true;
+}
+
+} // namespace tp2
@@ -0,0 +1,80 @@
+#include "path_arena.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace tp2 {
+
+namespace {
+void put_varint(std::vector<char>& out, std::uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+std::uint32_t get_varint(const char* data, std::uint64_t& pos) {
+    std::uint32_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        auto byte = static_cast<unsigned char>(data[pos++]);
+        v |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return v;
+    }
+}
+}
+
+PathArena::Id PathArena::add(std::string_view path) {
+    std::size_t shared = 0;
+    if (count_ % kRestartInterval == 0) {
+        restarts_.push_back(data_.size());
+    } else {
+        std::size_t limit = std::min(last_.size(), path.size());
+        while (shared < limit && last_[shared] == path[shared]) ++shared;
+    }
+    put_varint(data_, static_cast<std::uint32_t>(shared));
+    put_varint(data_, static_cast<std::uint32_t>(path.size() - shared));
+    data_.insert(data_.end(), path.begin() + static_cast<std::ptrdiff_t>(shared), path.end());
+    last_.assign(path.data(), path.size());
+    return count_++;
+}
+
+void PathArena::decode_into(Id id, std::string& out, std::size_t offset) const {
+    if (id >= count_) throw std::out_of_range("PathArena: invalid id");
+    std::uint64_t pos = restarts_[id / kRestartInterval];
+    const char* data = data_.data();
+    for (std::uint32_t step = 0; step <= id % kRestartInterval; ++step) {
+        std::uint32_t shared = get_varint(data, pos);
+        std::uint32_t len = get_varint(data, pos);
+        out.resize(offset + shared);
+        out.append(data + pos, len);
+        pos += len;
+    }
+}
+
+void PathArena::get(Id id, std::string& out) const {
+    out.clear();
+    decode_into(id, out, 0);
+}
+
+void PathArena::join(std::string_view base, Id id, std::string& out) const {
+    out.assign(base.data(), base.size());
+    out.push_back('/');
+    decode_into(id, out, out.size());
+}
+
+std::string PathArena::str(Id id) const {
+    std::string out;
+    get(id, out);
+    return out;
+}
+
+std::size_t PathArena::bytes_used() const {
+    return data_.capacity() + restarts_.capacity() * sizeof(std::uint64_t) + last_.capacity();
+}
+
+void PathArena::shrink_to_fit() {
+    data_.shrink_to_fit();
+    restarts_.shrink_to_fit();
+}
+
+} // namespace tp2
@@ -0,0 +1,172 @@
+#include "plan.hpp"
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace tp2 {
+
+namespace {
+const char* operation_name(Operation op) {
+    switch (op) {
+    case Operation::Backup: return "backup";
+    case Operation::Restore: return "restore";
+    case Operation::Verify: return "verify";
+    case Operation::Sync: return "sync";
+    case Operation::Mirror: return "mirror";
+    case Operation::Snapshot: return "snapshot";
+    case Operation::Prune: return "prune";
+    }
+    return "unknown";
+}
+
+bool parse_operation(const std::string& name, Operation& op) {
+    for (Operation o : {Operation::Backup, Operation::Restore, Operation::Verify,
+                        Operation::Sync, Operation::Mirror}) {
+        if (name == operation_name(o)) { op = o; return true; }
+    }
+    return false;
+}
+
+const char* action_name(PlanAction a) {
+    switch (a) {
+    case PlanAction::Copy: return "copy";
+    case PlanAction::Update: return "update";
+    case PlanAction::Skip: return "skip";
+    case PlanAction::Missing: return "missing";
+    case PlanAction::Delete: return "delete";
+    }
+    return "skip";
+}
+
+bool parse_action(const std::string& name, PlanAction& a) {
+    for (PlanAction x : {PlanAction::Copy, PlanAction::Update, PlanAction::Skip,
+                         PlanAction::Missing, PlanAction::Delete}) {
+        if (name == action_name(x)) { a = x; return true; }
+    }
+    return false;
+}
+
+std::string human_bytes(double bytes) {
+    static const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int u = 0;
+    while (bytes >= 1024.0 && u < 4) { bytes /= 1024.0; ++u; }
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(u == 0 ? 0 : 1) << bytes << ' ' << units[u];
+    return ss.str();
+}
+}
+
+void estimate_plan(BackupPlan& plan, const ThroughputStats& stats) {
+    plan.bytes_to_pen = 0;
+    plan.bytes_to_hd = 0;
+    for (const auto& e : plan.entries) {
+        if (e.action != PlanAction::Copy && e.action != PlanAction::Update) continue;
+        (e.to_hd ? plan.bytes_to_hd : plan.bytes_to_pen) += e.bytes;
+    }
+    plan.pen_write_bps = stats.pen_write_bps > 0 ? stats.pen_write_bps : kDefaultThroughputBps;
+    plan.hd_write_bps = stats.hd_write_bps > 0 ? stats.hd_write_bps : kDefaultThroughputBps;
+    plan.estimated_seconds = static_cast<double>(plan.bytes_to_pen) / plan.pen_write_bps +
+                             static_cast<double>(plan.bytes_to_hd) / plan.hd_write_bps;
+}
+
+bool save_plan(const BackupPlan& plan, const std::string& file) {
+    std::ofstream out(file, std::ios::trunc);
+    if (!out) return false;
+    out << "# tp2 plan v1\n";
+    out << "op " << operation_name(plan.op) << '\n';
+    out << "throughput " << plan.pen_write_bps << ' ' << plan.hd_write_bps << '\n';
+    std::string path;
+    for (const auto& e : plan.entries) {
+        plan.paths.get(e.path, path);
+        out << action_name(e.action) << ' ' << (e.to_hd ? "hd" : "pen") << ' '
+            << e.bytes << ' ' << path << '\n';
+    }
+    out.flush();
+    return out.good();
+}
+
+bool load_plan(const std::string& file, BackupPlan& plan) {
+    std::ifstream in(file);
+    if (!in.is_open()) return false;
+    BackupPlan loaded;
+    bool have_op = false;
+    ThroughputStats stats;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream ss(line);
+        std::string word;
+        ss >> word;
+        if (word == "op") {
+            std::string name;
+            if (!(ss >> name) || !parse_operation(name, loaded.op)) return false;
+            have_op = true;
+        } else if (word == "throughput") {
+            ss >> stats.pen_write_bps >> stats.hd_write_bps;
+        } else {
+            PlanEntry e;
+            std::string side;
+            if (!parse_action(word, e.action) || !(ss >> side >> e.bytes)) return false;
+            if (side != "hd" && side != "pen") return false;
+            e.to_hd = side == "hd";
+            ss.get(); // single separator before the path
+            std::string path;
+            std::getline(ss, path);
+            if (path.empty()) return false;
+            e.path = loaded.paths.add(path);
+            loaded.entries.push_back(e);
+        }
+    }
+    if (!have_op) return false;
+    estimate_plan(loaded, stats);
+    plan = std::move(loaded);
+    return true;
+}
+
+std::string format_plan(const BackupPlan& plan) {
+    std::ostringstream out;
+    std::size_t counts[5] = {0, 0, 0, 0, 0};
+    out << "plan: " << operation_name(plan.op) << '\n';
+    std::string path;
+    for (const auto& e : plan.entries) {
+        plan.paths.get(e.path, path);
+        ++counts[static_cast<int>(e.action)];
+        out << "  " << std::left << std::setw(8) << action_name(e.action)
+            << (e.to_hd ? "->hd  " : "->pen ") << std::right << std::setw(12) << e.bytes
+            << "  " << path << '\n';
+    }
+    out << "total: " << plan.entries.size() << " entries (copy " << counts[0]
+        << ", update " << counts[1] << ", skip " << counts[2] << ", missing " << counts[3]
+        << ", delete " << counts[4] << ")\n";
+    out << "bytes: " << human_bytes(static_cast<double>(plan.bytes_to_pen)) << " to pen, "
+        << human_bytes(static_cast<double>(plan.bytes_to_hd)) << " to hd\n";
+    out << "estimated: " << std::fixed << std::setprecision(1) << plan.estimated_seconds
+        << " s (pen " << human_bytes(plan.pen_write_bps) << "/s, hd "
+        << human_bytes(plan.hd_write_bps) << "/s)\n";
+    return out.str();
+}
+
+ThroughputStats load_throughput_stats(const std::string& penPath) {
+    ThroughputStats stats;
+    std::ifstream in(std::filesystem::path(penPath) / ".tp2_stats");
+    std::string key;
+    double value = 0;
+    while (in >> key >> value) {
+        if (value <= 0) continue;
+        if (key == "pen_write_bps") stats.pen_write_bps = value;
+        else if (key == "hd_write_bps") stats.hd_write_bps = value;
+    }
+    return stats;
+}
+
+bool save_throughput_stats(const std::string& penPath, const ThroughputStats& stats) {
+    std::ofstream out(std::filesystem::path(penPath) / ".tp2_stats", std::ios::trunc);
+    if (!out) return false;
+    out << "pen_write_bps " << stats.pen_write_bps << '\n';
+    out << "hd_write_bps " << stats.hd_write_bps << '\n';
+    out.flush();
+    return out.good();
+}
+
+} // namespace tp2
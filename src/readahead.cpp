@@ -0,0 +1,93 @@
+#include "readahead.hpp"
+#include <algorithm>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace tp2 {
+
+namespace {
+// Ask the kernel to bring [0, len) of path into the page cache.
+void prefetch(const std::string& path, std::uint64_t len) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return; // gone or unreadable: the copy reports it
+    if (::readahead(fd, 0, static_cast<std::size_t>(len)) != 0) {
+        ::posix_fadvise(fd, 0, static_cast<off_t>(len), POSIX_FADV_WILLNEED);
+    }
+    ::close(fd);
+}
+}
+
+Readahead::Pass::Pass(Readahead* owner, std::vector<Item> items)
+    : owner_(owner), items_(std::move(items)), held_(items_.size(), 0), taken_(items_.size(), 0) {
+    if (owner_ && owner_->budget_ > 0 && !items_.empty()) thread_ = std::thread([this] { run(); });
+}
+
+Readahead::Pass::~Pass() {
+    if (!owner_) return;
+    {
+        std::lock_guard<std::mutex> lock(owner_->mutex_);
+        stop_ = true;
+    }
+    owner_->cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+    std::lock_guard<std::mutex> lock(owner_->mutex_);
+    for (std::size_t i = 0; i < held_.size(); ++i) release(i); // copies that never finished
+    owner_->cv_.notify_all();
+}
+
+void Readahead::Pass::started(std::size_t i) {
+    if (!owner_) return;
+    std::lock_guard<std::mutex> lock(owner_->mutex_);
+    taken_[i] = 1;
+    if (held_[i] > 0) ++owner_->stats_.hits;
+    owner_->cv_.notify_all();
+}
+
+void Readahead::Pass::finished(std::size_t i) {
+    if (!owner_) return;
+    std::lock_guard<std::mutex> lock(owner_->mutex_);
+    release(i);
+    owner_->cv_.notify_all();
+}
+
+void Readahead::Pass::release(std::size_t i) {
+    if (held_[i] == 0) return;
+    owner_->stats_.queued_bytes -= held_[i];
+    --owner_->stats_.queued_files;
+    held_[i] = 0;
+}
+
+void Readahead::Pass::run() {
+    Readahead& owner = *owner_;
+    for (std::size_t i = 0; i < items_.size(); ++i) {
+        if (items_[i].size == 0) continue;
+        const std::uint64_t want = std::min(items_[i].size, owner.budget_);
+        {
+            std::unique_lock<std::mutex> lock(owner.mutex_);
+            owner.cv_.wait(lock, [&] {
+                return stop_ || taken_[i] ||
+                       (owner.stats_.queued_bytes + want <= owner.budget_ &&
+                        owner.stats_.queued_files < kMaxQueuedFiles);
+            });
+            if (stop_) return;
+            if (taken_[i]) continue; // the copies caught up with the reader
+            held_[i] = want;
+            Stats& s = owner.stats_;
+            s.queued_bytes += want;
+            ++s.queued_files;
+            s.peak_bytes = std::max(s.peak_bytes, s.queued_bytes);
+            s.peak_files = std::max(s.peak_files, s.queued_files);
+            ++s.files;
+            s.bytes += want;
+        }
+        prefetch(items_[i].path, want);
+    }
+}
+
+Readahead::Stats Readahead::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+} // namespace tp2
@@ -0,0 +1,183 @@
+#include "scheduler.hpp"
+#include "fsutil.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <set>
+
+namespace tp2 {
+
+namespace {
+// Split a job line into fields: blanks separate, double quotes keep spaces inside a field.
+bool split_fields(const std::string& line, std::vector<std::string>& fields) {
+    fields.clear();
+    std::size_t i = 0;
+    while (i < line.size()) {
+        if (line[i] == ' ' || line[i] == '\t' || line[i] == '\r') { ++i; continue; }
+        std::string field;
+        if (line[i] == '"') {
+            auto end = line.find('"', i + 1);
+            if (end == std::string::npos) return false;
+            field = line.substr(i + 1, end - i - 1);
+            i = end + 1;
+        } else {
+            while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') field += line[i++];
+        }
+        fields.push_back(field);
+    }
+    return true;
+}
+
+bool mode_from_name(const std::string& name, Operation& op) {
+    static const std::pair<const char*, Operation> kModes[] = {
+        {"backup", Operation::Backup}, {"restore", Operation::Restore}, {"verify", Operation::Verify},
+        {"sync", Operation::Sync},     {"mirror", Operation::Mirror},   {"snapshot", Operation::Snapshot},
+        {"prune", Operation::Prune},
+    };
+    for (const auto& m : kModes) {
+        if (name == m.first) { op = m.second; return true; }
+    }
+    return false;
+}
+}
+
+bool load_jobs(const std::string& file, std::vector<Job>& jobs, std::string& error) {
+    jobs.clear();
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        error = "cannot read job file " + file;
+        return false;
+    }
+    // Relative paths are taken from the job file's directory, wherever the run starts.
+    const std::filesystem::path base = std::filesystem::absolute(file).parent_path();
+    auto resolve = [&](const std::string& path) {
+        return std::filesystem::path(path).is_absolute() ? path : (base / path).lexically_normal().string();
+    };
+    std::set<std::string> names, pens;
+    std::string line;
+    std::vector<std::string> f;
+    for (std::size_t number = 1; std::getline(in, line); ++number) {
+        const std::string where = "line " + std::to_string(number) + ": ";
+        auto begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#' || line[begin] == ';') continue;
+        if (!split_fields(line, f)) { error = where + "unterminated quote"; return false; }
+        if (f.size() != 5 && f.size() != 6) { error = where + "expected <name> <mode> <hd> <pen> <parm> [weight]"; return false; }
+        Job job;
+        job.name = f[0];
+        if (!mode_from_name(f[1], job.op)) { error = where + "unknown mode " + f[1]; return false; }
+        job.hd = resolve(f[2]);
+        job.pen = resolve(f[3]);
+        job.parm = resolve(f[4]);
+        if (f.size() == 6) {
+            unsigned long weight = 0;
+            try {
+                weight = f[5][0] == '-' ? 0 : std::stoul(f[5]);
+            } catch (const std::exception&) {
+                weight = 0;
+            }
+            if (weight == 0 || weight > 1000) { error = where + "invalid weight " + f[5]; return false; }
+            job.weight = static_cast<unsigned>(weight);
+        }
+        if (!names.insert(job.name).second) { error = where + "duplicate job name " + job.name; return false; }
+        std::string pen_key = std::filesystem::path(job.pen).lexically_normal().string();
+        while (pen_key.size() > 1 && pen_key.back() == '/') pen_key.pop_back();
+        if (!pens.insert(pen_key).second) {
+            error = where + "pen " + job.pen + " already used by another job (merge their parm lists)";
+            return false;
+        }
+        jobs.push_back(std::move(job));
+    }
+    if (jobs.empty()) {
+        error = "job file " + file + " has no jobs";
+        return false;
+    }
+    return true;
+}
+
+std::size_t FairScheduler::add_flow(unsigned weight, const std::vector<std::uint64_t>& devices) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Flow f;
+    f.weight = weight == 0 ? 1 : weight;
+    f.devices = devices;
+    std::sort(f.devices.begin(), f.devices.end());
+    f.devices.erase(std::unique(f.devices.begin(), f.devices.end()), f.devices.end()); // HD and pen may share one
+    flows_.push_back(std::move(f));
+    return flows_.size() - 1;
+}
+
+void FairScheduler::push(std::size_t flow, std::size_t item, std::uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Flow& f = flows_[flow];
+    // A flow that was idle starts from the clock: it banks no credit for the time it had no work.
+    if (f.queue.empty()) f.vtime = std::max(f.vtime, vclock_);
+    f.queue.push_back(Item{item, bytes + kItemOverhead});
+    ++queued_;
+    cv_.notify_one();
+}
+
+bool FairScheduler::devices_free(const Flow& f) const {
+    if (device_limit_ == 0) return true;
+    for (auto dev : f.devices) {
+        auto it = busy_.find(dev);
+        if (it != busy_.end() && it->second >= device_limit_) return false;
+    }
+    return true;
+}
+
+bool FairScheduler::next(std::size_t& flow, std::size_t& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        if (queued_ == 0) return false;
+        // Smallest virtual finish time among flows that can run now.
+        std::size_t best = flows_.size();
+        double best_start = 0, best_finish = std::numeric_limits<double>::max();
+        for (std::size_t i = 0; i < flows_.size(); ++i) {
+            const Flow& f = flows_[i];
+            if (f.queue.empty() || !devices_free(f)) continue;
+            const double start = f.vtime;
+            const double finish = start + static_cast<double>(f.queue.front().cost) / f.weight;
+            if (finish < best_finish) {
+                best = i;
+                best_start = start;
+                best_finish = finish;
+            }
+        }
+        if (best == flows_.size()) {
+            cv_.wait(lock); // every flow with work waits for a device
+            continue;
+        }
+        Flow& f = flows_[best];
+        item = f.queue.front().id;
+        f.queue.pop_front();
+        --queued_;
+        f.vtime = best_finish;
+        vclock_ = std::max(vclock_, best_start);
+        for (auto dev : f.devices) ++busy_[dev];
+        if (!f.started) {
+            f.started = true;
+            f.first = std::chrono::steady_clock::now();
+        }
+        flow = best;
+        return true;
+    }
+}
+
+void FairScheduler::done(std::size_t flow) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Flow& f = flows_[flow];
+        for (auto dev : f.devices) --busy_[dev];
+        f.last = std::chrono::steady_clock::now();
+    }
+    cv_.notify_all();
+}
+
+double FairScheduler::busy_seconds(std::size_t flow) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Flow& f = flows_[flow];
+    if (!f.started || f.last < f.first) return 0;
+    return std::chrono::duration<double>(f.last - f.first).count();
+}
+
+} // namespace tp2
@@ -0,0 +1,293 @@
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tp2 {
+
+namespace {
+// Below this many bytes the binary search gives way to a linear scan.
+constexpr std::uint64_t kScanWindow = 4096;
+
+// Length of a full label (YYYYmmdd-HHMMSS); shorter dates are prefixes.
+constexpr std::size_t kLabelLength = 15;
+
+// "label <= as_of", where a date shorter than a full label covers everything it starts.
+bool label_at_or_before(const std::string& label, const std::string& as_of, bool prefix) {
+    if (!prefix || as_of.size() >= kLabelLength) return label <= as_of;
+    return label.compare(0, as_of.size(), as_of) <= 0;
+}
+
+bool parse_row(const std::string& line, CatalogRow& row) {
+    auto nul = line.find('\0');
+    if (nul == std::string::npos) return false;
+    row.path.assign(line, 0, nul);
+    std::istringstream ss(line.substr(nul + 1));
+    return static_cast<bool>(ss >> row.first >> row.last >> row.mtime_ns >> row.size);
+}
+
+bool row_less(const CatalogRow& a, const CatalogRow& b) {
+    int c = a.path.compare(b.path);
+    return c != 0 ? c < 0 : a.first < b.first;
+}
+
+bool has_suffix(const std::string& name, const std::string& suffix) {
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Days since 1970-01-01 of a label's date (proleptic Gregorian); false if the label has no date.
+bool label_day(const std::string& label, long& days) {
+    int y = 0, m = 0, d = 0;
+    if (label.size() < 8 || std::sscanf(label.c_str(), "%4d%2d%2d", &y, &m, &d) != 3 || m < 1 || m > 12) {
+        return false;
+    }
+    y -= m <= 2;
+    const long era = (y >= 0 ? y : y - 399) / 400;
+    const long yoe = y - era * 400;
+    const long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    days = era * 146097 + doe - 719468;
+    return true;
+}
+}
+
+std::vector<std::string> list_snapshots(const std::string& penPath) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> labels;
+    const std::string partial = kSnapshotPartialSuffix;
+    std::error_code ec;
+    for (fs::directory_iterator it(fs::path(penPath) / kSnapshotDir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        bool unfinished = has_suffix(name, partial) || has_suffix(name, kSnapshotPruneSuffix);
+        if (!unfinished && it->is_directory(ec)) labels.push_back(name);
+    }
+    std::sort(labels.begin(), labels.end());
+    return labels;
+}
+
+std::string next_snapshot_label(const std::string& stamp, const std::string& newest) {
+    std::string base = stamp.substr(0, kLabelLength);
+    if (newest.size() >= kLabelLength && base < newest.substr(0, kLabelLength)) {
+        base = newest.substr(0, kLabelLength); // the clock stepped back
+    }
+    std::string label = base;
+    char suffix[16];
+    for (int n = 2; label <= newest; ++n) {
+        std::snprintf(suffix, sizeof(suffix), "-%03d", n);
+        label = base + suffix;
+    }
+    return label;
+}
+
+std::string snapshot_path(const std::string& penPath, const std::string& label) {
+    return (std::filesystem::path(penPath) / kSnapshotDir / label).string();
+}
+
+std::vector<std::string> select_retained(const std::vector<std::string>& labels, unsigned keep_last,
+                                         unsigned keep_daily, unsigned keep_weekly) {
+    std::vector<std::string> newest_first(labels);
+    std::sort(newest_first.rbegin(), newest_first.rend());
+    std::vector<std::string> kept;
+    long last_day = 0, last_week = 0;
+    bool have_day = false, have_week = false;
+    for (std::size_t i = 0; i < newest_first.size(); ++i) {
+        const std::string& label = newest_first[i];
+        bool keep = i < keep_last;
+        long day = 0;
+        if (label_day(label, day)) {
+            // 1970-01-01 was a Thursday: shifting by 3 starts weeks on Monday.
+            long week = (day + 3) / 7;
+            if (keep_daily > 0 && (!have_day || day != last_day)) {
+                --keep_daily;
+                keep = true;
+                have_day = true;
+                last_day = day;
+            }
+            if (keep_weekly > 0 && (!have_week || week != last_week)) {
+                --keep_weekly;
+                keep = true;
+                have_week = true;
+                last_week = week;
+            }
+        }
+        if (keep) kept.push_back(label);
+    }
+    std::sort(kept.begin(), kept.end());
+    return kept;
+}
+
+SnapshotCatalog::SnapshotCatalog(const std::string& penPath)
+    : file_((std::filesystem::path(penPath) / kSnapshotDir / kFileName).string()) {
+    reopen();
+}
+
+SnapshotCatalog::~SnapshotCatalog() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void SnapshotCatalog::reopen() {
+    if (fd_ >= 0) ::close(fd_);
+    size_ = 0;
+    fd_ = ::open(file_.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd_ >= 0 && ::fstat(fd_, &st) == 0) size_ = static_cast<std::uint64_t>(st.st_size);
+}
+
+// Read the line containing offset, from offset up to its newline; next is where the following line starts.
+bool SnapshotCatalog::read_line(std::uint64_t offset, std::string& line, std::uint64_t& next) const {
+    line.clear();
+    if (fd_ < 0 || offset >= size_) return false;
+    char buf[512];
+    while (offset < size_) {
+        ssize_t n = ::pread(fd_, buf, sizeof(buf), static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        const char* nl = static_cast<const char*>(std::memchr(buf, '\n', static_cast<std::size_t>(n)));
+        if (nl) {
+            line.append(buf, static_cast<std::size_t>(nl - buf));
+            next = offset + static_cast<std::uint64_t>(nl - buf) + 1;
+            return true;
+        }
+        line.append(buf, static_cast<std::size_t>(n));
+        offset += static_cast<std::uint64_t>(n);
+    }
+    next = size_;
+    return true;
+}
+
+// Last row with (path, first) <= (rel, label): bisect byte offsets, then scan the last window.
+bool SnapshotCatalog::last_at_or_before(const std::string& rel, const std::string& label, bool prefix,
+                                        CatalogRow& out) const {
+    auto before = [&](const CatalogRow& r) {
+        int c = r.path.compare(rel);
+        return c < 0 || (c == 0 && label_at_or_before(r.first, label, prefix));
+    };
+    std::string line;
+    CatalogRow row;
+    std::uint64_t lo = 0, hi = size_, start = 0, next = 0;
+    // lo is a line start; no matching row starts at or after hi.
+    while (hi - lo > kScanWindow) {
+        std::uint64_t mid = lo + (hi - lo) / 2;
+        if (!read_line(mid - 1, line, start) || start >= hi || !read_line(start, line, next) ||
+            !parse_row(line, row) || !before(row)) {
+            hi = mid;
+        } else {
+            lo = start;
+        }
+    }
+    bool found = false;
+    for (std::uint64_t off = lo; read_line(off, line, next); off = next) {
+        if (!parse_row(line, row) || !before(row)) break;
+        out = row;
+        found = true;
+    }
+    return found && out.path == rel;
+}
+
+bool SnapshotCatalog::resolve(const std::string& as_of, std::string& label) const {
+    CatalogRow row;
+    if (!last_at_or_before(std::string(), as_of, true, row)) return false;
+    label = row.first;
+    return true;
+}
+
+bool SnapshotCatalog::find(const std::string& rel, const std::string& label, CatalogRow& out) const {
+    if (rel.empty()) return false;
+    return last_at_or_before(rel, label, false, out) && label <= out.last;
+}
+
+std::vector<CatalogRow> SnapshotCatalog::rows() const {
+    std::vector<CatalogRow> out;
+    std::ifstream in(file_, std::ios::binary);
+    std::string line;
+    CatalogRow row;
+    while (std::getline(in, line)) {
+        if (parse_row(line, row)) out.push_back(row);
+    }
+    return out;
+}
+
+bool SnapshotCatalog::add_snapshot(const std::string& label, std::vector<CatalogRow> files) {
+    std::vector<CatalogRow> all = rows();
+    std::string prev;
+    std::unordered_map<std::string, std::size_t> latest; // path -> row of its newest version
+    for (std::size_t i = 0; i < all.size(); ++i) {
+        if (all[i].path.empty()) prev = std::max(prev, all[i].first);
+        else latest[all[i].path] = i;
+    }
+    std::sort(files.begin(), files.end(), [](const CatalogRow& a, const CatalogRow& b) { return a.path < b.path; });
+    files.erase(std::unique(files.begin(), files.end(),
+                            [](const CatalogRow& a, const CatalogRow& b) { return a.path == b.path; }),
+                files.end());
+    const std::size_t old_rows = all.size();
+    for (auto& f : files) {
+        if (f.path.empty()) continue;
+        auto it = latest.find(f.path);
+        if (it != latest.end() && !prev.empty()) {
+            CatalogRow& r = all[it->second];
+            if (r.last == prev && r.mtime_ns == f.mtime_ns && r.size == f.size) {
+                r.last = label; // unchanged since the previous snapshot
+                continue;
+            }
+        }
+        f.first = f.last = label;
+        all.push_back(std::move(f));
+    }
+    all.push_back(CatalogRow{std::string(), label, label, 0, 0});
+    // New rows carry the newest label, so each path's group only needs them merged in.
+    std::sort(all.begin() + static_cast<std::ptrdiff_t>(old_rows), all.end(), row_less);
+    std::inplace_merge(all.begin(), all.begin() + static_cast<std::ptrdiff_t>(old_rows), all.end(), row_less);
+
+    return write(all);
+}
+
+bool SnapshotCatalog::remove_snapshots(const std::vector<std::string>& labels) {
+    std::vector<std::string> gone(labels);
+    std::sort(gone.begin(), gone.end());
+    std::vector<CatalogRow> all = rows();
+    std::vector<std::string> kept; // surviving labels, in order
+    for (const auto& r : all) {
+        if (r.path.empty() && !std::binary_search(gone.begin(), gone.end(), r.first)) kept.push_back(r.first);
+    }
+    std::vector<CatalogRow> out;
+    out.reserve(all.size());
+    for (auto& r : all) {
+        // A version is in every catalogued snapshot of [first, last]; shrink that to the survivors.
+        auto lo = std::lower_bound(kept.begin(), kept.end(), r.first);
+        auto hi = std::upper_bound(kept.begin(), kept.end(), r.last);
+        if (lo == hi) continue;
+        r.first = *lo;
+        r.last = *(hi - 1);
+        out.push_back(std::move(r));
+    }
+    // Shrinking keeps the order: rows of one path cover disjoint ranges.
+    return write(out);
+}
+
+bool SnapshotCatalog::write(const std::vector<CatalogRow>& all) {
+    namespace fs = std::filesystem;
+    const std::string tmp = file_ + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        for (const auto& r : all) {
+            out << r.path << '\0' << r.first << ' ' << r.last << ' ' << r.mtime_ns << ' ' << r.size << '\n';
+        }
+        out.flush();
+        if (!out.good()) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, file_, ec);
+    reopen();
+    return !ec;
+}
+
+} // namespace tp2
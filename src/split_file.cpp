@@ -0,0 +1,242 @@
+#include "split_file.hpp"
+#include "checksum.hpp"
+#include "fsutil.hpp"
+#include "parallel.hpp"
+#include "throttle.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tp2 {
+
+namespace {
+constexpr std::size_t kIoBufferSize = 256 * 1024;
+constexpr unsigned kPartThreads = 4;
+constexpr const char* kPartMarker = ".tp2-part-";
+constexpr const char* kMagic = "tp2-split v1";
+
+// Copy len bytes from in at in_off to out at out_off: in the kernel with copy_file_range
+// while it works, then (and always with a throttle, so every block is charged) by pread/pwrite.
+bool copy_range(int in, std::uint64_t in_off, int out, std::uint64_t out_off, std::uint64_t len,
+                IoThrottle* throttle) {
+    loff_t src = static_cast<loff_t>(in_off), dst = static_cast<loff_t>(out_off);
+    while (len > 0 && !throttle) {
+        ssize_t n = ::copy_file_range(in, &src, out, &dst, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; // unsupported between these filesystems, or the source shrank
+        len -= static_cast<std::uint64_t>(n);
+    }
+    std::vector<char> buf(len > 0 ? kIoBufferSize : 0);
+    while (len > 0) {
+        const std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(len, buf.size()));
+        ssize_t n = ::pread(in, buf.data(), want, src);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        if (throttle) {
+            throttle->read(static_cast<std::uint64_t>(n));
+            throttle->write(static_cast<std::uint64_t>(n));
+        }
+        if (!pwrite_all(out, buf.data(), static_cast<std::size_t>(n), static_cast<std::uint64_t>(dst))) return false;
+        src += n;
+        dst += n;
+        len -= static_cast<std::uint64_t>(n);
+    }
+    return true;
+}
+
+// Read [0, size) of fd in order into sink.
+bool read_all(int fd, std::uint64_t size, IoThrottle* throttle,
+              const std::function<bool(const char*, std::size_t)>& sink) {
+    std::vector<char> buf(kIoBufferSize);
+    std::uint64_t off = 0;
+    while (off < size) {
+        const std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(size - off, buf.size()));
+        ssize_t n = ::pread(fd, buf.data(), want, static_cast<off_t>(off));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        if (throttle) throttle->read(static_cast<std::uint64_t>(n));
+        if (!sink(buf.data(), static_cast<std::size_t>(n))) return false;
+        off += static_cast<std::uint64_t>(n);
+    }
+    return true;
+}
+
+// Write the parts of split side by side, each from its own offset in the source; one more
+// worker reads the source in order for hasher, when given.
+bool write_parts_parallel(int in, const SplitDescriptor& split, const std::string& dst, IoThrottle* throttle,
+                          Hasher64* hasher) {
+    std::atomic<bool> ok{true};
+    // Index 0 reads the source in order for the hash; index k + 1 writes part k.
+    parallel_for(split.parts() + 1, kPartThreads + 1, [&](std::size_t i) {
+        if (i == 0) {
+            if (hasher && !read_all(in, split.size, throttle, [&](const char* data, std::size_t n) {
+                    hasher->update(data, n);
+                    return ok.load();
+                })) {
+                ok = false;
+            }
+            return;
+        }
+        const std::size_t k = i - 1;
+        const std::uint64_t first = k * split.part_size;
+        Fd out(::open(split_part_path(dst, k).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        if (out.fd < 0 || !copy_range(in, first, out.fd, 0, std::min(split.part_size, split.size - first), throttle)) {
+            ok = false;
+            return;
+        }
+        if (!out.close()) ok = false;
+    });
+    return ok;
+}
+
+// Write the parts of split one after the other in whole blocks of write.erase_block, from a
+// single in-order read of the source. The first block is read before taking write.gate.
+bool write_parts_coalesced(int in, const SplitDescriptor& split, const std::string& dst, IoThrottle* throttle,
+                           Hasher64* hasher, const SplitWrite& write) {
+    std::vector<char> buf(write.erase_block);
+    std::uint64_t off = 0;
+    std::size_t n = 0;
+    // Read the next block of at most len bytes into buf.
+    auto fill = [&](std::uint64_t len) {
+        n = static_cast<std::size_t>(std::min<std::uint64_t>(len, buf.size()));
+        for (std::size_t got = 0; got < n;) {
+            ssize_t r = ::pread(in, buf.data() + got, n - got, static_cast<off_t>(off + got));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            got += static_cast<std::size_t>(r);
+        }
+        if (throttle) throttle->read(n);
+        if (hasher) hasher->update(buf.data(), n);
+        off += n;
+        return true;
+    };
+    if (!fill(std::min(split.part_size, split.size))) return false;
+    std::unique_lock<std::mutex> gate;
+    if (write.gate) gate = std::unique_lock<std::mutex>(*write.gate);
+    for (std::size_t k = 0; k < split.parts(); ++k) {
+        const std::uint64_t len = std::min(split.part_size, split.size - k * split.part_size);
+        Fd out(::open(split_part_path(dst, k).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        if (out.fd < 0) return false;
+        ::fallocate(out.fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(len)); // best effort
+        for (std::uint64_t done = 0;;) {
+            if (throttle) throttle->write(n);
+            if (!pwrite_all(out.fd, buf.data(), n, done)) return false;
+            ::sync_file_range(out.fd, static_cast<off_t>(done), static_cast<off_t>(n), SYNC_FILE_RANGE_WRITE);
+            done += n;
+            if (off == split.size) break;
+            if (!fill(done < len ? len - done : std::min(split.part_size, split.size - off))) return false;
+            if (done == len) break; // buf already holds the start of the next part
+        }
+        if (write.sync && ::fdatasync(out.fd) != 0) return false;
+        if (!out.close()) return false;
+    }
+    return true;
+}
+}
+
+bool read_split_descriptor(const std::string& path, SplitDescriptor& out) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || st.st_size > 128) return false;
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line) || line.compare(0, std::char_traits<char>::length(kMagic), kMagic) != 0) return false;
+    std::istringstream fields(line.substr(std::char_traits<char>::length(kMagic)));
+    SplitDescriptor d;
+    if (!(fields >> d.size >> d.part_size) || d.size == 0 || d.part_size == 0) return false;
+    out = d;
+    return true;
+}
+
+std::string split_part_path(const std::string& path, std::size_t k) {
+    std::ostringstream name;
+    name << path << kPartMarker << std::setw(3) << std::setfill('0') << k;
+    return name.str();
+}
+
+bool is_split_part(const std::string& rel) {
+    const auto pos = rel.rfind(kPartMarker);
+    if (pos == std::string::npos || rel.find('/', pos) != std::string::npos) return false;
+    const std::size_t digits = pos + std::char_traits<char>::length(kPartMarker);
+    if (digits == rel.size()) return false;
+    return std::all_of(rel.begin() + static_cast<std::ptrdiff_t>(digits), rel.end(),
+                       [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; });
+}
+
+std::vector<std::string> split_parts_on_disk(const std::string& path, std::size_t from) {
+    std::vector<std::string> parts;
+    for (std::size_t k = from;; ++k) {
+        std::string part = split_part_path(path, k);
+        if (!stat_path(part).exists) break;
+        parts.push_back(std::move(part));
+    }
+    return parts;
+}
+
+bool split_copy(const std::string& src, const std::string& dst, std::uint64_t part_size, std::int64_t mtime_ns,
+                IoThrottle* throttle, ManifestEntry* record, const SplitWrite& write) {
+    if (part_size == 0) return false;
+    Fd in(::open(src.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat st;
+    if (in.fd < 0 || ::fstat(in.fd, &st) != 0) return false;
+    const SplitDescriptor split{static_cast<std::uint64_t>(st.st_size), part_size};
+    const std::size_t parts = split.parts();
+    // Without a descriptor, an interrupted copy leaves the entry missing rather than mixed.
+    if (::unlink(dst.c_str()) != 0 && errno != ENOENT) return false;
+    Hasher64 hasher;
+    const bool ok = write.erase_block > 0
+                        ? write_parts_coalesced(in.fd, split, dst, throttle, record ? &hasher : nullptr, write)
+                        : write_parts_parallel(in.fd, split, dst, throttle, record ? &hasher : nullptr);
+    if (!ok) return false;
+    {
+        std::ofstream desc(dst, std::ios::trunc);
+        desc << kMagic << ' ' << split.size << ' ' << split.part_size << '\n';
+        desc.close();
+        if (desc.fail()) return false;
+    }
+    if (!set_mtime_ns(dst, mtime_ns)) return false;
+    for (const auto& stale : split_parts_on_disk(dst, parts)) std::remove(stale.c_str()); // from a larger version
+    if (record) *record = {split.size, mtime_ns, hasher.digest()};
+    return true;
+}
+
+bool join_copy(const std::string& path, const SplitDescriptor& split, const std::string& dst,
+               std::int64_t mtime_ns, IoThrottle* throttle, std::uint64_t& bytes) {
+    Fd out(::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (out.fd < 0 || ::ftruncate(out.fd, static_cast<off_t>(split.size)) != 0) return false;
+    std::atomic<bool> ok{true};
+    parallel_for(split.parts(), kPartThreads, [&](std::size_t k) {
+        const std::uint64_t first = k * split.part_size;
+        const std::uint64_t len = std::min(split.part_size, split.size - first);
+        Fd in(::open(split_part_path(path, k).c_str(), O_RDONLY | O_CLOEXEC));
+        struct stat st;
+        if (in.fd < 0 || ::fstat(in.fd, &st) != 0 || static_cast<std::uint64_t>(st.st_size) != len ||
+            !copy_range(in.fd, 0, out.fd, first, len, throttle)) {
+            ok = false;
+        }
+    });
+    if (!out.close() || !ok) return false;
+    bytes = split.size;
+    return set_mtime_ns(dst, mtime_ns);
+}
+
+bool read_split(const std::string& path, const SplitDescriptor& split,
+                const std::function<bool(const char*, std::size_t)>& sink) {
+    for (std::size_t k = 0; k < split.parts(); ++k) {
+        const std::uint64_t len = std::min(split.part_size, split.size - k * split.part_size);
+        Fd in(::open(split_part_path(path, k).c_str(), O_RDONLY | O_CLOEXEC));
+        struct stat st;
+        if (in.fd < 0 || ::fstat(in.fd, &st) != 0 || static_cast<std::uint64_t>(st.st_size) != len) return false;
+        if (!read_all(in.fd, len, nullptr, sink)) return false;
+    }
+    return true;
+}
+
+} // namespace tp2
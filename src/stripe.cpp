@@ -0,0 +1,110 @@
+#include "stripe.hpp"
+#include "checksum.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace tp2 {
+
+namespace {
+constexpr const char* kHeader = "# tp2 stripe layout v1";
+}
+
+bool StripeLayout::load(const std::string& penPath, std::size_t& slot) {
+    entries_.clear();
+    loads_.clear();
+    generation_ = 0;
+    std::ifstream in(std::filesystem::path(penPath) / kFileName);
+    if (!in.is_open()) return false;
+    std::string line;
+    if (!std::getline(in, line) || line.compare(0, std::string(kHeader).size(), kHeader) != 0) return false;
+    std::istringstream header(line.substr(std::string(kHeader).size()));
+    std::size_t pens = 0;
+    if (!(header >> slot >> pens >> generation_) || pens == 0 || slot >= pens) return false;
+    loads_.assign(pens, 0);
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream ss(line);
+        Slot s;
+        if (!(ss >> s.pen >> s.size) || s.pen >= pens) continue; // skip malformed lines
+        ss.get(); // single separator before the path
+        std::string rel;
+        std::getline(ss, rel);
+        if (rel.empty()) continue;
+        auto it = entries_.find(rel);
+        if (it != entries_.end()) loads_[it->second.pen] -= it->second.size;
+        entries_[rel] = s;
+        loads_[s.pen] += s.size;
+    }
+    return true;
+}
+
+bool StripeLayout::save(const std::string& penPath, std::size_t slot) const {
+    namespace fs = std::filesystem;
+    fs::path target = fs::path(penPath) / kFileName;
+    fs::path tmp = target;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        out << kHeader << ' ' << slot << ' ' << loads_.size() << ' ' << generation_ + 1 << '\n';
+        for (const auto& kv : entries_) out << kv.second.pen << ' ' << kv.second.size << ' ' << kv.first << '\n';
+        out.flush();
+        if (!out.good()) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, target, ec);
+    return !ec;
+}
+
+bool StripeLayout::find(const std::string& rel, std::size_t& slot) const {
+    auto it = entries_.find(rel);
+    if (it == entries_.end()) return false;
+    slot = it->second.pen;
+    return true;
+}
+
+std::size_t StripeLayout::pick(const std::string& rel, std::uint64_t size) const {
+    const std::size_t n = loads_.size();
+    if (n <= 1) return 0;
+    if (size >= kLargeFile) {
+        // One large file can unbalance the set on its own: give it the emptiest pen.
+        return static_cast<std::size_t>(std::min_element(loads_.begin(), loads_.end()) - loads_.begin());
+    }
+    // Two distinct candidates from one hash; the lighter one wins, ties go to the first.
+    const std::uint64_t h = hash64(rel.data(), rel.size());
+    const std::size_t a = static_cast<std::size_t>(h % n);
+    std::size_t b = static_cast<std::size_t>((h >> 32) % (n - 1));
+    if (b >= a) ++b;
+    return loads_[b] < loads_[a] ? b : a;
+}
+
+std::size_t StripeLayout::assign(const std::string& rel, std::uint64_t size) {
+    auto it = entries_.find(rel);
+    if (it != entries_.end()) {
+        loads_[it->second.pen] += size - it->second.size;
+        it->second.size = size;
+        return it->second.pen;
+    }
+    const std::size_t pen = pick(rel, size);
+    entries_[rel] = Slot{pen, size};
+    loads_[pen] += size;
+    return pen;
+}
+
+std::size_t StripeLayout::retain(const std::vector<std::string>& live) {
+    std::size_t removed = 0;
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        if (std::binary_search(live.begin(), live.end(), it->first)) {
+            ++it;
+            continue;
+        }
+        loads_[it->second.pen] -= it->second.size;
+        it = entries_.erase(it);
+        ++removed;
+    }
+    return removed;
+}
+
+} // namespace tp2
@@ -0,0 +1,86 @@
+#include "throttle.hpp"
+#include <algorithm>
+#include <thread>
+
+namespace tp2 {
+
+namespace {
+// Waiters wake at least this often, so a new rate takes effect without waiting out the old one.
+constexpr std::chrono::milliseconds kMaxSleep{50};
+}
+
+RateLimiter::RateLimiter(std::uint64_t rate_per_sec)
+    : rate_(rate_per_sec),
+      supplied_(static_cast<double>(rate_per_sec)),
+      last_(std::chrono::steady_clock::now()) {}
+
+// Release what accrued since the last refill, keeping at most one second of unused tokens.
+void RateLimiter::refill(std::chrono::steady_clock::time_point now) {
+    double elapsed = std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+    const double burst = static_cast<double>(rate_);
+    supplied_ = std::min(supplied_ + elapsed * burst, issued_ + burst);
+}
+
+void RateLimiter::acquire(std::uint64_t amount) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (rate_ == 0) return;
+    refill(std::chrono::steady_clock::now());
+    // Reserve up front (the bucket may go into debt) so concurrent callers queue fairly:
+    // this caller goes once everything up to its ticket has been supplied.
+    issued_ += static_cast<double>(amount);
+    const double ticket = issued_;
+    while (rate_ != 0 && supplied_ < ticket) {
+        std::chrono::duration<double> wait((ticket - supplied_) / static_cast<double>(rate_));
+        lock.unlock();
+        std::this_thread::sleep_for(std::min<std::chrono::duration<double>>(wait, kMaxSleep));
+        lock.lock();
+        if (rate_ != 0) refill(std::chrono::steady_clock::now());
+    }
+}
+
+void RateLimiter::set_rate(std::uint64_t rate_per_sec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = std::chrono::steady_clock::now();
+    if (rate_ != 0) refill(now);
+    // Coming from unlimited, start with a full burst; otherwise keep the balance, with unused
+    // tokens capped to the new burst.
+    if (rate_ == 0) supplied_ = issued_ + static_cast<double>(rate_per_sec);
+    rate_ = rate_per_sec;
+    supplied_ = std::min(supplied_, issued_ + static_cast<double>(rate_));
+    last_ = now;
+}
+
+std::uint64_t RateLimiter::rate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rate_;
+}
+
+IoThrottle::IoThrottle(const IoLimits& limits)
+    : read_bytes_(limits.read_bytes_per_sec),
+      write_bytes_(limits.write_bytes_per_sec),
+      read_ops_(limits.read_ops_per_sec),
+      write_ops_(limits.write_ops_per_sec) {}
+
+void IoThrottle::read(std::uint64_t bytes) {
+    read_ops_.acquire(1);
+    read_bytes_.acquire(bytes);
+}
+
+void IoThrottle::write(std::uint64_t bytes) {
+    write_ops_.acquire(1);
+    write_bytes_.acquire(bytes);
+}
+
+void IoThrottle::set_limits(const IoLimits& limits) {
+    read_bytes_.set_rate(limits.read_bytes_per_sec);
+    write_bytes_.set_rate(limits.write_bytes_per_sec);
+    read_ops_.set_rate(limits.read_ops_per_sec);
+    write_ops_.set_rate(limits.write_ops_per_sec);
+}
+
+IoLimits IoThrottle::limits() const {
+    return {read_bytes_.rate(), write_bytes_.rate(), read_ops_.rate(), write_ops_.rate()};
+}
+
+} // namespace tp2
@@ -0,0 +1,115 @@
+#include "watch.hpp"
+#include "fsutil.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace tp2 {
+
+namespace {
+constexpr std::uint32_t kDirMask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+}
+
+ChangeWatcher::ChangeWatcher(const std::string& root)
+    : fd_(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), root_(root) {}
+
+ChangeWatcher::~ChangeWatcher() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void ChangeWatcher::add(const std::string& rel) {
+    std::string norm = normalize_rel(rel);
+    while (norm.size() > 1 && norm.back() == '/') norm.pop_back();
+    if (norm.empty() || norm == ".") return;
+    const auto slash = norm.rfind('/');
+    const std::string dir = slash == std::string::npos ? std::string() : norm.substr(0, slash);
+    const std::string name = slash == std::string::npos ? norm : norm.substr(slash + 1);
+    listed_[dir][name].push_back(rel);
+    if (watches_.find(dir) == watches_.end()) watch_dir(dir, nullptr);
+}
+
+std::size_t ChangeWatcher::unwatched() const {
+    std::size_t n = 0;
+    for (const auto& kv : watches_) n += kv.second < 0;
+    return n;
+}
+
+// Watch one parent directory; once one that was missing shows up, whatever appeared in it
+// before the watch existed counts as changed.
+void ChangeWatcher::watch_dir(const std::string& dir, std::set<std::string>* dirty) {
+    int wd = -1;
+    if (fd_ >= 0) {
+        const std::string full = dir.empty() ? root_ : root_ + "/" + dir;
+        wd = ::inotify_add_watch(fd_, full.c_str(), kDirMask);
+    }
+    watches_[dir] = wd;
+    if (wd < 0) return;
+    dirs_[wd] = dir;
+    if (dirty) mark_all(dir, *dirty);
+}
+
+void ChangeWatcher::mark_all(const std::string& dir, std::set<std::string>& dirty) const {
+    auto it = listed_.find(dir);
+    if (it == listed_.end()) return;
+    for (const auto& names : it->second) dirty.insert(names.second.begin(), names.second.end());
+}
+
+// A watched directory went away (deleted, moved or unmounted): its entries changed, and it is
+// watched again if it comes back.
+void ChangeWatcher::lose(int wd, std::set<std::string>& dirty) {
+    auto it = dirs_.find(wd);
+    if (it == dirs_.end()) return;
+    const std::string dir = it->second;
+    dirs_.erase(it);
+    ::inotify_rm_watch(fd_, wd); // already gone after IN_IGNORED; harmless
+    watches_[dir] = -1;
+    mark_all(dir, dirty);
+}
+
+int ChangeWatcher::wait(int timeout_ms, std::set<std::string>& dirty) {
+    if (fd_ < 0) return 0;
+    int relevant = 0;
+    for (auto& kv : watches_) {
+        if (kv.second >= 0) continue;
+        const std::size_t before = dirty.size();
+        watch_dir(kv.first, &dirty);
+        relevant += static_cast<int>(dirty.size() - before);
+    }
+    pollfd pfd{fd_, POLLIN, 0};
+    if (::poll(&pfd, 1, relevant > 0 ? 0 : timeout_ms) <= 0) return relevant; // timeout or EINTR
+
+    alignas(inotify_event) char buf[64 * 1024];
+    bool overflow = false;
+    for (;;) {
+        ssize_t n = ::read(fd_, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; // EAGAIN: queue drained
+        for (char* p = buf; p < buf + n;) {
+            const auto* ev = reinterpret_cast<const inotify_event*>(p);
+            p += sizeof(inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                if (dirs_.count(ev->wd)) ++relevant;
+                lose(ev->wd, dirty);
+                continue;
+            }
+            auto d = dirs_.find(ev->wd);
+            if (d == dirs_.end() || ev->len == 0) continue;
+            auto names = listed_.find(d->second);
+            if (names == listed_.end()) continue;
+            auto hit = names->second.find(ev->name);
+            if (hit == names->second.end()) continue;
+            dirty.insert(hit->second.begin(), hit->second.end());
+            ++relevant;
+        }
+    }
+    return overflow ? -1 : relevant;
+}
+
+} // namespace tp2
@@ -2,8 +2,25 @@
 #define CATCH_CONFIG_NO_POSIX_SIGNALS 1
 #include "catch.hpp"
 #include "backup.hpp"
+#include "cache.hpp"
+#include "checksum.hpp"
+#include "chunk_store.hpp"
+#include "compress.hpp"
+#include "concurrency.hpp"
+#include "device_profile.hpp"
+#include "fsutil.hpp"
+#include "manifest.hpp"
+#include "plan.hpp"
+#include "readahead.hpp"
+#include "scheduler.hpp"
+#include "snapshot.hpp"
+#include "split_file.hpp"
+#include "stripe.hpp"
+#include "throttle.hpp"
 #include <filesystem>
 #include <fstream>
+#include <atomic>
+#include <mutex>
 #include <thread>
 #include <chrono>
 
@@ -576,3 +593,1223 @@ TEST_CASE("backup: returns code 4 when listed file is missing on HD") {
 
     fs::remove_all(tmp);
 }
+
+TEST_CASE("verify: freshly backed up pen passes, corrupted file is reported") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_verify_basic";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "sub");
+    fs::create_directories(tmp / "pen");
+
+    std::ofstream(tmp / "hd" / "V1.txt") << "first";
+    std::ofstream(tmp / "hd" / "sub" / "V2.txt") << std::string(100000, 'v');
+    std::ofstream(tmp / "hd" / "EMPTY.txt").close();
+    std::ofstream(tmp / "Backup.parm") << "V1.txt\nsub/V2.txt\nEMPTY.txt\n";
+
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup).code == 0);
+    REQUIRE(fs::exists(tmp / "pen" / "EMPTY.txt"));
+
+    BackupOptions opts;
+    opts.jobs = 3;
+    auto ok = execute_backup(hd, pen, parm, Operation::Verify, opts);
+    REQUIRE(ok.code == 0);
+    REQUIRE(ok.mismatched.empty());
+
+    // Flip content on the pen without touching the HD (simulated bit rot)
+    auto t = fs::last_write_time(tmp / "pen" / "sub" / "V2.txt");
+    { std::fstream f(tmp / "pen" / "sub" / "V2.txt", std::ios::in | std::ios::out | std::ios::binary);
+      f.seekp(5000); f.put('X'); }
+    fs::last_write_time(tmp / "pen" / "sub" / "V2.txt", t);
+
+    auto bad = execute_backup(hd, pen, parm, Operation::Verify, opts);
+    REQUIRE(bad.code == 6);
+    REQUIRE(bad.mismatched == std::vector<std::string>{"sub/V2.txt"});
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("verify: file missing on pen or without checksum returns 4") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_verify_missing";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+
+    // Copied to the pen by hand, so no checksum was ever recorded
+    std::ofstream(tmp / "pen" / "MANUAL.txt") << "manual";
+    std::ofstream(tmp / "Backup.parm") << "MANUAL.txt\n";
+    auto r1 = execute_backup((tmp / "hd").string(), (tmp / "pen").string(), (tmp / "Backup.parm").string(), Operation::Verify);
+    REQUIRE(r1.code == 4);
+
+    std::ofstream(tmp / "Backup.parm") << "GONE.txt\n";
+    auto r2 = execute_backup((tmp / "hd").string(), (tmp / "pen").string(), (tmp / "Backup.parm").string(), Operation::Verify);
+    REQUIRE(r2.code == 4);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("sync: copies each entry from the newer side in one pass") {
+    namespace fs = std::filesystem;
+    using namespace std::chrono_literals;
+    fs::path tmp = fs::current_path() / "_tmp_sync_mixed";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    auto now = fs::file_time_type::clock::now();
+
+    std::ofstream(tmp / "hd" / "H_ONLY.txt") << "from-hd";
+    fs::create_directories(tmp / "pen" / "deep" / "dir");
+    std::ofstream(tmp / "pen" / "deep" / "dir" / "P_ONLY.txt") << "from-pen";
+
+    std::ofstream(tmp / "hd" / "HD_NEW.txt") << "hd-wins";
+    std::ofstream(tmp / "pen" / "HD_NEW.txt") << "pen-old";
+    fs::last_write_time(tmp / "hd" / "HD_NEW.txt", now);
+    fs::last_write_time(tmp / "pen" / "HD_NEW.txt", now - 2s);
+
+    std::ofstream(tmp / "hd" / "PEN_NEW.txt") << "hd-old";
+    std::ofstream(tmp / "pen" / "PEN_NEW.txt") << "pen-wins";
+    fs::last_write_time(tmp / "hd" / "PEN_NEW.txt", now - 2s);
+    fs::last_write_time(tmp / "pen" / "PEN_NEW.txt", now);
+
+    std::ofstream(tmp / "hd" / "SAME.txt") << "hd-same";
+    std::ofstream(tmp / "pen" / "SAME.txt") << "pen-same";
+    fs::last_write_time(tmp / "hd" / "SAME.txt", now - 5s);
+    fs::last_write_time(tmp / "pen" / "SAME.txt", now - 5s);
+
+    std::ofstream(tmp / "Backup.parm") << "H_ONLY.txt\ndeep/dir/P_ONLY.txt\nHD_NEW.txt\nPEN_NEW.txt\nSAME.txt\n";
+
+    BackupOptions opts;
+    opts.jobs = 4;
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+    auto r = execute_backup(hd, pen, parm, Operation::Sync, opts);
+    REQUIRE(r.code == 0);
+
+    auto read = [](const fs::path& p) { std::string s; std::ifstream in(p); std::getline(in, s); return s; };
+    REQUIRE(read(tmp / "pen" / "H_ONLY.txt") == "from-hd");
+    REQUIRE(read(tmp / "hd" / "deep" / "dir" / "P_ONLY.txt") == "from-pen");
+    REQUIRE(read(tmp / "pen" / "HD_NEW.txt") == "hd-wins");
+    REQUIRE(read(tmp / "hd" / "PEN_NEW.txt") == "pen-wins");
+    REQUIRE(read(tmp / "hd" / "SAME.txt") == "hd-same");
+    REQUIRE(read(tmp / "pen" / "SAME.txt") == "pen-same");
+    REQUIRE(fs::last_write_time(tmp / "hd" / "PEN_NEW.txt") == fs::last_write_time(tmp / "pen" / "PEN_NEW.txt"));
+
+    // A second sync finds nothing to do and the pen copies made by sync verify cleanly
+    std::ofstream(tmp / "Backup.parm") << "H_ONLY.txt\nHD_NEW.txt\n";
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Sync, opts).code == 0);
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Verify).code == 0);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("sync: entry missing on both sides returns 4 but others still sync") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_sync_missing";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "pen" / "OK.txt") << "ok";
+    std::ofstream(tmp / "Backup.parm") << "NOWHERE.txt\nOK.txt\n";
+
+    auto r = execute_backup((tmp / "hd").string(), (tmp / "pen").string(), (tmp / "Backup.parm").string(), Operation::Sync);
+    REQUIRE(r.code == 4);
+    REQUIRE(fs::exists(tmp / "hd" / "OK.txt"));
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("mirror: removes pen files deleted from HD or dropped from the list") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_mirror_delete";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "keep");
+    fs::create_directories(tmp / "pen");
+
+    std::ofstream(tmp / "hd" / "keep" / "A.txt") << "a";
+    std::ofstream(tmp / "hd" / "B.txt") << "b";
+    std::ofstream(tmp / "hd" / "GONE.txt") << "gone";
+    std::ofstream(tmp / "Backup.parm") << "keep/A.txt\nB.txt\nGONE.txt\n";
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup).code == 0);
+
+    // GONE.txt disappears from the HD, B.txt leaves the list, an unrelated stray lives in a nested dir
+    fs::remove(tmp / "hd" / "GONE.txt");
+    std::ofstream(tmp / "Backup.parm") << "keep/A.txt\nGONE.txt\n";
+    fs::create_directories(tmp / "pen" / "old" / "deep");
+    std::ofstream(tmp / "pen" / "old" / "deep" / "STRAY.txt") << "stray";
+
+    auto r = execute_backup(hd, pen, parm, Operation::Mirror);
+    REQUIRE(r.code == 0);
+    REQUIRE(fs::exists(tmp / "pen" / "keep" / "A.txt"));
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "B.txt"));
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "GONE.txt"));
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "old")); // emptied directories are dropped
+    REQUIRE(r.removed == (std::vector<std::string>{"B.txt", "GONE.txt", "old/deep/STRAY.txt"}));
+    // Control files survive and the manifest forgets the removed entries
+    REQUIRE(fs::exists(tmp / "pen" / ".tp2_manifest"));
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Verify).code == 4); // GONE.txt is listed but gone
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("mirror: quarantine moves stale files instead of deleting them") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_mirror_quarantine";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "LIVE.txt") << "live";
+    std::ofstream(tmp / "pen" / "DEAD.txt") << "dead";
+    std::ofstream(tmp / "Backup.parm") << "LIVE.txt\n";
+
+    BackupOptions opts;
+    opts.quarantine = true;
+    auto r = execute_backup((tmp / "hd").string(), (tmp / "pen").string(), (tmp / "Backup.parm").string(), Operation::Mirror, opts);
+    REQUIRE(r.code == 0);
+    REQUIRE(fs::exists(tmp / "pen" / "LIVE.txt"));
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "DEAD.txt"));
+
+    bool found = false;
+    for (const auto& e : fs::recursive_directory_iterator(tmp / "pen" / ".tp2_quarantine")) {
+        if (e.path().filename() == "DEAD.txt") found = true;
+    }
+    REQUIRE(found);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("dedup: identical files share chunks and restore byte for byte") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_dedup_basic";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "copy");
+    fs::create_directories(tmp / "pen");
+    std::string big;
+    for (int i = 0; i < 200000; ++i) big += std::to_string(i * 7919 % 100003) + ',';
+    std::ofstream(tmp / "hd" / "orig.log") << big;
+    std::ofstream(tmp / "hd" / "copy" / "orig.log") << big;
+    std::ofstream(tmp / "hd" / "small.txt") << "small";
+    std::ofstream(tmp / "Backup.parm") << "orig.log\ncopy/orig.log\nsmall.txt\n";
+
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+    BackupOptions opts;
+    opts.dedup = true;
+    opts.jobs = 2;
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "orig.log"));
+    REQUIRE(fs::exists(tmp / "pen" / ".tp2_recipes" / "copy" / "orig.log"));
+
+    std::uintmax_t stored = 0;
+    for (const auto& e : fs::recursive_directory_iterator(tmp / "pen" / ".tp2_chunks")) {
+        if (e.is_regular_file()) stored += e.file_size();
+    }
+    REQUIRE(stored < big.size() + 100); // the second copy costs no chunk bytes
+
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Verify, opts).code == 0);
+
+    fs::remove_all(tmp / "hd");
+    fs::create_directories(tmp / "hd");
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Restore, opts).code == 0);
+    std::ifstream in(tmp / "hd" / "copy" / "orig.log");
+    std::string back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    REQUIRE(back == big);
+
+    // Unchanged files are skipped on the next run: nothing to reassemble.
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Restore, opts).code == 0);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("compress: pen holds compressed files, restore and verify see the original") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_compress_basic";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::string text;
+    for (int i = 0; text.size() < 600000; ++i) text += "registro " + std::to_string(i % 1000) + " ok\n";
+    std::string photo = "\xFF\xD8\xFF\xE0" + std::string(5000, 'j');
+    std::ofstream(tmp / "hd" / "app.log") << text;
+    std::ofstream(tmp / "hd" / "photo.jpg", std::ios::binary) << photo;
+    std::ofstream(tmp / "Backup.parm") << "app.log\nphoto.jpg\n";
+
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+    BackupOptions opts;
+    opts.compress = true;
+    opts.compress_threads = 3;
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    REQUIRE(fs::file_size(tmp / "pen" / "app.log") < text.size() / 4);
+    REQUIRE(fs::file_size(tmp / "pen" / "photo.jpg") == photo.size()); // stored as-is
+
+    // Verify and restore need no flag: frames are recognized on read.
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Verify).code == 0);
+    fs::remove_all(tmp / "hd");
+    fs::create_directories(tmp / "hd");
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Restore).code == 0);
+    std::ifstream in(tmp / "hd" / "app.log");
+    std::string back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    REQUIRE(back == text);
+    REQUIRE(fs::file_size(tmp / "hd" / "photo.jpg") == photo.size());
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("compress: HD files that start like a frame come back byte for byte without --compress") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_compress_lookalike";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    for (const char* pen : {"pen", "pen2", "pen3"}) fs::create_directories(tmp / pen);
+    std::string text;
+    for (int i = 0; text.size() < 100000; ++i) text += "linha " + std::to_string(i % 500) + "\n";
+    std::vector<char> frame;
+    REQUIRE(encode_frame(text.data(), text.size(), frame));
+    const std::map<std::string, std::string> files = {
+        {"copied.log", std::string(frame.begin(), frame.end())}, // a pen file copied back to the HD
+        {"broken.bin", "\x89TP2Z\r\n\x1a" + std::string(3000, 'x')},
+        {"plain.txt", text}};
+    std::ofstream parm(tmp / "Backup.parm");
+    for (const auto& f : files) {
+        std::ofstream(tmp / "hd" / f.first, std::ios::binary) << f.second;
+        parm << f.first << "\n";
+    }
+    parm.close();
+
+    const std::string hd = (tmp / "hd").string(), pen = (tmp / "pen").string(), parm_path = (tmp / "Backup.parm").string();
+    const std::vector<std::string> pens = {(tmp / "pen2").string(), (tmp / "pen3").string()};
+    REQUIRE(execute_backup(hd, pen, parm_path, Operation::Backup).code == 0);
+    REQUIRE(execute_backup_multi(hd, pens, parm_path, Operation::Backup, BackupOptions{}).code == 0);
+    REQUIRE(fs::file_size(tmp / "pen" / "plain.txt") == text.size()); // not framed
+    BackupPlan plan;
+    REQUIRE(plan_backup(hd, pen, parm_path, Operation::Backup, BackupOptions{}, plan).code == 0);
+    REQUIRE(plan.bytes_to_pen == 0);
+    REQUIRE(execute_backup(hd, pen, parm_path, Operation::Verify).code == 0);
+    REQUIRE(execute_backup_multi(hd, pens, parm_path, Operation::Verify, BackupOptions{}).code == 0);
+    for (const std::string& from : {pen, pens[1]}) {
+        for (const auto& f : files) fs::remove(tmp / "hd" / f.first);
+        REQUIRE(execute_backup(hd, from, parm_path, Operation::Restore).code == 0);
+        for (const auto& f : files) {
+            std::ifstream in(tmp / "hd" / f.first, std::ios::binary);
+            REQUIRE(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()) == f.second);
+        }
+    }
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("pack: small files go into packs, restore reads them back by range") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_pack_basic";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "tiny");
+    fs::create_directories(tmp / "pen");
+    std::string parm;
+    for (int i = 0; i < 50; ++i) {
+        std::string name = "tiny/f" + std::to_string(i) + ".txt";
+        std::ofstream(tmp / "hd" / name) << "content " << i;
+        parm += name + "\n";
+    }
+    std::ofstream(tmp / "hd" / "big.bin") << std::string(200000, 'z');
+    parm += "big.bin\n";
+    std::ofstream(tmp / "Backup.parm") << parm;
+
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parmFile = (tmp / "Backup.parm").string();
+    BackupOptions opts;
+    opts.pack_threshold = 4096;
+    opts.jobs = 3;
+    REQUIRE(execute_backup(hd, pen, parmFile, Operation::Backup, opts).code == 0);
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "tiny"));          // no loose small files
+    REQUIRE(fs::exists(tmp / "pen" / "big.bin"));             // above the threshold
+    REQUIRE(fs::exists(tmp / "pen" / ".tp2_packs" / "index"));
+
+    // Second run sees the packed copies as up to date.
+    BackupPlan plan;
+    REQUIRE(plan_backup(hd, pen, parmFile, Operation::Backup, opts, plan).code == 0);
+    REQUIRE(plan.bytes_to_pen == 0);
+
+    REQUIRE(execute_backup(hd, pen, parmFile, Operation::Verify).code == 0);
+
+    fs::remove_all(tmp / "hd");
+    fs::create_directories(tmp / "hd");
+    REQUIRE(execute_backup(hd, pen, parmFile, Operation::Restore).code == 0);
+    std::ifstream in(tmp / "hd" / "tiny" / "f17.txt");
+    std::string back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    REQUIRE(back == "content 17");
+
+    // Mirror drops entries that left the list from the pack index.
+    std::ofstream(tmp / "Backup.parm") << "big.bin\ntiny/f1.txt\n";
+    auto m = execute_backup(hd, pen, parmFile, Operation::Mirror, opts);
+    REQUIRE(m.code == 0);
+    REQUIRE(m.removed.size() == 49);
+    REQUIRE(execute_backup(hd, pen, parmFile, Operation::Verify).code == 0);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("snapshot: unchanged files are hard-linked, changed files keep history") {
+    namespace fs = std::filesystem;
+    using namespace std::chrono_literals;
+    fs::path tmp = fs::current_path() / "_tmp_snapshot_basic";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "a" / "b");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "a" / "b" / "SAME.txt") << "same";
+    std::ofstream(tmp / "hd" / "EDIT.txt") << "v1";
+    std::ofstream(tmp / "Backup.parm") << "a/b/SAME.txt\nEDIT.txt\n";
+
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+    auto r1 = execute_backup(hd, pen, parm, Operation::Snapshot);
+    REQUIRE(r1.code == 0);
+    auto snaps = list_snapshots(pen);
+    REQUIRE(snaps.size() == 1);
+
+    std::ofstream(tmp / "hd" / "EDIT.txt") << "v2";
+    fs::last_write_time(tmp / "hd" / "EDIT.txt", fs::last_write_time(tmp / "hd" / "EDIT.txt") + 5s);
+    BackupOptions opts;
+    opts.jobs = 2;
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Snapshot, opts).code == 0);
+    snaps = list_snapshots(pen);
+    REQUIRE(snaps.size() == 2);
+    fs::path first = snapshot_path(pen, snaps[0]);
+    fs::path second = snapshot_path(pen, snaps[1]);
+    REQUIRE(fs::equivalent(first / "a" / "b" / "SAME.txt", second / "a" / "b" / "SAME.txt"));
+    REQUIRE(fs::hard_link_count(second / "a" / "b" / "SAME.txt") == 2);
+    REQUIRE_FALSE(fs::equivalent(first / "EDIT.txt", second / "EDIT.txt"));
+    std::ifstream old_copy(first / "EDIT.txt");
+    std::string old_text;
+    old_copy >> old_text;
+    REQUIRE(old_text == "v1");
+    REQUIRE(fs::file_size(second / "EDIT.txt") == 2);
+
+    // Snapshots never show up as user files on the pen.
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "EDIT.txt"));
+
+    // Same mtime, different size: a new version, never a link to the old one.
+    const auto same_mtime = fs::last_write_time(tmp / "hd" / "EDIT.txt");
+    std::ofstream(tmp / "hd" / "EDIT.txt") << "v3-longer";
+    fs::last_write_time(tmp / "hd" / "EDIT.txt", same_mtime);
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Snapshot).code == 0);
+    snaps = list_snapshots(pen);
+    REQUIRE(snaps.size() == 3);
+    const fs::path third = snapshot_path(pen, snaps[2]);
+    REQUIRE_FALSE(fs::equivalent(second / "EDIT.txt", third / "EDIT.txt"));
+    REQUIRE(fs::file_size(third / "EDIT.txt") == 9);
+    REQUIRE(fs::equivalent(second / "a" / "b" / "SAME.txt", third / "a" / "b" / "SAME.txt"));
+
+    std::ofstream(tmp / "Backup.parm") << "GONE.txt\n";
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Snapshot).code == 4);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("restore --as-of brings back the version from the chosen snapshot") {
+    namespace fs = std::filesystem;
+    using namespace std::chrono_literals;
+    fs::path tmp = fs::current_path() / "_tmp_restore_as_of";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "sub");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "sub" / "doc.txt") << "first";
+    std::ofstream(tmp / "hd" / "keep.txt") << "keep";
+    std::ofstream(tmp / "Backup.parm") << "sub/doc.txt\nkeep.txt\n";
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Snapshot).code == 0);
+    const std::string first = list_snapshots(pen).back();
+    std::ofstream(tmp / "hd" / "sub" / "doc.txt") << "second version";
+    fs::last_write_time(tmp / "hd" / "sub" / "doc.txt", fs::last_write_time(tmp / "hd" / "sub" / "doc.txt") + 5s);
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Snapshot).code == 0);
+
+    // Lose the file on the hd, then ask for it as of the first snapshot.
+    fs::remove_all(tmp / "hd" / "sub");
+    BackupOptions opts;
+    opts.as_of = first;
+    opts.jobs = 2;
+    auto r = execute_backup(hd, pen, parm, Operation::Restore, opts);
+    REQUIRE(r.code == 0);
+    REQUIRE(r.message == "ok: restored from snapshot " + first);
+    std::ifstream in(tmp / "hd" / "sub" / "doc.txt");
+    std::string text;
+    std::getline(in, text);
+    REQUIRE(text == "first");
+
+    // The newest snapshot is picked for a date after both.
+    opts.as_of = "2999";
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Restore, opts).code == 0);
+    REQUIRE(fs::file_size(tmp / "hd" / "sub" / "doc.txt") == std::string("second version").size());
+
+    opts.as_of = "1999";
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Restore, opts).code == 4);
+    BackupPlan plan;
+    REQUIRE(plan_backup(hd, pen, parm, Operation::Restore, opts, plan).code == 2);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("prune drops snapshots outside the retention and reclaims dedup chunks") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_prune";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "a.txt") << "alpha";
+    std::ofstream(tmp / "Backup.parm") << "a.txt\n";
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+    for (int i = 0; i < 3; ++i) REQUIRE(execute_backup(hd, pen, parm, Operation::Snapshot).code == 0);
+    auto before = list_snapshots(pen);
+    REQUIRE(before.size() == 3);
+
+    // No policy keeps every snapshot; no param file is needed.
+    BackupOptions opts;
+    auto r = execute_backup(hd, pen, (tmp / "absent.parm").string(), Operation::Prune, opts);
+    REQUIRE(r.code == 0);
+    REQUIRE(r.removed.empty());
+    REQUIRE(list_snapshots(pen).size() == 3);
+
+    opts.keep_last = 1;
+    r = execute_backup(hd, pen, parm, Operation::Prune, opts);
+    REQUIRE(r.code == 0);
+    REQUIRE(r.removed.size() == 2);
+    REQUIRE((list_snapshots(pen) == std::vector<std::string>{before.back()}));
+    REQUIRE_FALSE(fs::exists(snapshot_path(pen, before[0]) + kSnapshotPruneSuffix));
+    REQUIRE(fs::hard_link_count(fs::path(snapshot_path(pen, before.back())) / "a.txt") == 1);
+    BackupOptions as_of;
+    as_of.as_of = before[0];
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Restore, as_of).code == 4);
+
+    // Chunks left behind by a dedup mirror are reclaimed.
+    BackupOptions dedup;
+    dedup.dedup = true;
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Mirror, dedup).code == 0);
+    std::ofstream(tmp / "Backup.parm") << "other.txt\n";
+    std::ofstream(tmp / "hd" / "other.txt") << "other";
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Mirror, dedup).code == 0);
+    r = execute_backup(hd, pen, parm, Operation::Prune, BackupOptions{});
+    REQUIRE(r.code == 0);
+    REQUIRE(r.message == "ok: pruned 0 snapshot(s), freed 1 chunk(s)");
+    REQUIRE(list_snapshots(pen).size() == 1);
+
+    // A damaged recipe stops the collection rather than freeing the chunks it names.
+    std::ofstream(tmp / "pen" / ChunkStore::kRecipeDir / "other.txt", std::ios::trunc) << "# tp2 recipe v1\n";
+    r = execute_backup(hd, pen, parm, Operation::Prune, BackupOptions{});
+    REQUIRE(r.code == 6);
+    REQUIRE(r.message.find("other.txt") != std::string::npos);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("backup resumes from the run journal left by an interrupted run") {
+    namespace fs = std::filesystem;
+    using namespace std::chrono_literals;
+    fs::path tmp = fs::current_path() / "_tmp_journal_resume";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::string big;
+    for (int i = 0; big.size() < 300000; ++i) big += "bloco " + std::to_string(i) + "\n";
+    std::ofstream(tmp / "hd" / "big.txt", std::ios::binary) << big;
+    std::ofstream(tmp / "hd" / "small.txt") << "small";
+    std::ofstream(tmp / "Backup.parm") << "big.txt\nsmall.txt\n";
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+
+    // State at the crash: small.txt finished, big.txt checkpointed at 100000 bytes plus an
+    // unsynced tail, both with fresh pen mtimes, no manifest yet.
+    const std::uint64_t checkpoint = 100000;
+    const FileStat big_stat = stat_path((tmp / "hd" / "big.txt").string());
+    const FileStat small_stat = stat_path((tmp / "hd" / "small.txt").string());
+    fs::copy_file(tmp / "hd" / "small.txt", tmp / "pen" / "small.txt");
+    set_mtime_ns((tmp / "pen" / "small.txt").string(), small_stat.mtime_ns);
+    // The kept prefix is marked so the test can tell it was not copied again.
+    std::ofstream(tmp / "pen" / "big.txt", std::ios::binary) << std::string(checkpoint, 'X') << "torn tail";
+    fs::last_write_time(tmp / "pen" / "big.txt", fs::last_write_time(tmp / "hd" / "big.txt") + 60s);
+    const std::uint64_t small_hash = hash64("small", 5);
+    {
+        std::ofstream j(tmp / "pen" / ".tp2_journal");
+        j << "B p " << small_stat.mtime_ns << " 5 0 small.txt\n";
+        j << "B p " << big_stat.mtime_ns << ' ' << big.size() << " 0 big.txt\n";
+        j << "D p " << hash_to_hex(small_hash) << " 5 " << small_stat.mtime_ns << " small.txt\n";
+        j << "C " << checkpoint << " big.txt\n";
+        j << "B p 12";
+    }
+
+    // The half-written copy looks newer than the hd, yet it is planned again.
+    BackupPlan plan;
+    REQUIRE(plan_backup(hd, pen, parm, Operation::Sync, BackupOptions{}, plan).code == 0);
+    REQUIRE(plan.entries[0].action == PlanAction::Update);
+    REQUIRE_FALSE(plan.entries[0].to_hd);
+    BackupPlan restore_plan;
+    REQUIRE(plan_backup(hd, pen, parm, Operation::Restore, BackupOptions{}, restore_plan).code == 0);
+    REQUIRE(restore_plan.entries[0].action == PlanAction::Skip);
+
+    auto r = execute_backup(hd, pen, parm, Operation::Backup);
+    REQUIRE(r.code == 0);
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / ".tp2_journal"));
+    std::ifstream in(tmp / "pen" / "big.txt", std::ios::binary);
+    std::string stored((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    REQUIRE(stored.size() == big.size());
+    REQUIRE(stored.substr(0, checkpoint) == std::string(checkpoint, 'X'));
+    REQUIRE(stored.substr(checkpoint) == big.substr(checkpoint));
+
+    Manifest manifest;
+    REQUIRE(manifest.load(pen));
+    REQUIRE(manifest.find("small.txt") != nullptr);
+    REQUIRE(manifest.find("small.txt")->hash == small_hash);
+    // The hash covers the source, prefix included.
+    REQUIRE(manifest.find("big.txt")->hash == hash64(big.data(), big.size()));
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("multi-pen backup reads once and keeps a status per pen") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_multi_pen";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "sub");
+    fs::create_directories(tmp / "pen1");
+    fs::create_directories(tmp / "pen2");
+    std::string big;
+    for (int i = 0; big.size() < 2 * 1024 * 1024; ++i) big += "registro " + std::to_string(i) + "\n";
+    std::ofstream(tmp / "hd" / "sub" / "big.log", std::ios::binary) << big;
+    std::ofstream(tmp / "hd" / "small.txt") << "small";
+    std::ofstream(tmp / "Backup.parm") << "sub/big.log\nsmall.txt\n";
+    auto hd = (tmp / "hd").string();
+    auto parm = (tmp / "Backup.parm").string();
+    const std::vector<std::string> pens = {(tmp / "pen1").string(), (tmp / "pen2").string()};
+
+    for (bool compress : {false, true}) {
+        BackupOptions opts;
+        opts.jobs = 2;
+        opts.compress = compress;
+        if (compress) {
+            // Start over so both pens get compressed copies.
+            for (const auto& pen : pens) {
+                fs::remove_all(pen);
+                fs::create_directories(pen);
+            }
+        }
+        auto r = execute_backup_multi(hd, pens, parm, Operation::Backup, opts);
+        REQUIRE(r.code == 0);
+        REQUIRE(r.pens.size() == 2);
+        for (const auto& p : r.pens) REQUIRE(p.code == 0);
+        for (const auto& pen : pens) {
+            Manifest manifest;
+            REQUIRE(manifest.load(pen));
+            REQUIRE(manifest.find("sub/big.log")->hash == hash64(big.data(), big.size()));
+            if (compress) REQUIRE(fs::file_size(fs::path(pen) / "sub" / "big.log") < big.size() / 2);
+            else REQUIRE(fs::file_size(fs::path(pen) / "sub" / "big.log") == big.size());
+        }
+        REQUIRE(execute_backup_multi(hd, pens, parm, Operation::Verify, opts).code == 0);
+    }
+
+    // Mirror removes the stale file from every pen.
+    std::ofstream(tmp / "Backup.parm") << "small.txt\n";
+    auto m = execute_backup_multi(hd, pens, parm, Operation::Mirror, BackupOptions{});
+    REQUIRE(m.code == 0);
+    REQUIRE(m.removed.size() == 2);
+    REQUIRE_FALSE(fs::exists(tmp / "pen1" / "sub" / "big.log"));
+    REQUIRE_FALSE(fs::exists(tmp / "pen2" / "sub" / "big.log"));
+
+    // A pen that cannot be written fails alone.
+    std::ofstream(tmp / "Backup.parm") << "sub/big.log\nsmall.txt\n";
+    std::ofstream(tmp / "not-a-dir") << "file";
+    const std::vector<std::string> mixed = {(tmp / "pen3").string(), (tmp / "not-a-dir").string()};
+    fs::create_directories(tmp / "pen3");
+    auto r = execute_backup_multi(hd, mixed, parm, Operation::Backup, BackupOptions{});
+    REQUIRE(r.code == 5);
+    REQUIRE(r.pens[0].code == 0);
+    REQUIRE(r.pens[1].code == 5);
+    REQUIRE(r.message.find("not-a-dir") != std::string::npos);
+    REQUIRE(fs::file_size(tmp / "pen3" / "sub" / "big.log") == big.size());
+
+    REQUIRE(execute_backup_multi(hd, pens, parm, Operation::Restore, BackupOptions{}).code == 2);
+    REQUIRE(execute_backup_multi(hd, {}, parm, Operation::Backup, BackupOptions{}).code == 1);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("striped backup spreads files over the pens and restores from all of them") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_stripe";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "sub");
+    std::string parm_text;
+    for (int i = 0; i < 40; ++i) {
+        const std::string name = "sub/f" + std::to_string(i) + ".txt";
+        std::ofstream(tmp / "hd" / name) << std::string(1000 + i * 37, static_cast<char>('a' + i % 26));
+        parm_text += name + "\n";
+    }
+    std::ofstream(tmp / "Backup.parm") << parm_text;
+    auto hd = (tmp / "hd").string();
+    auto parm = (tmp / "Backup.parm").string();
+    std::vector<std::string> pens;
+    for (int p = 0; p < 3; ++p) {
+        pens.push_back((tmp / ("pen" + std::to_string(p))).string());
+        fs::create_directories(pens.back());
+    }
+    BackupOptions opts;
+    opts.stripe = true;
+    opts.jobs = 2;
+
+    auto r = execute_backup_multi(hd, pens, parm, Operation::Backup, opts);
+    REQUIRE(r.code == 0);
+    REQUIRE(r.pens.size() == 3);
+    // Every file is on exactly one pen, and every pen got a share.
+    std::uintmax_t per_pen[3] = {0, 0, 0};
+    for (int i = 0; i < 40; ++i) {
+        const std::string name = "sub/f" + std::to_string(i) + ".txt";
+        int copies = 0;
+        for (int p = 0; p < 3; ++p) {
+            if (!fs::exists(fs::path(pens[p]) / name)) continue;
+            ++copies;
+            per_pen[p] += fs::file_size(fs::path(pens[p]) / name);
+        }
+        REQUIRE(copies == 1);
+    }
+    for (auto bytes : per_pen) REQUIRE(bytes > 0);
+    StripeLayout layout;
+    std::size_t slot = 9;
+    REQUIRE(layout.load(pens[1], slot));
+    REQUIRE(slot == 1);
+    REQUIRE(layout.size() == 40);
+    REQUIRE(execute_backup_multi(hd, pens, parm, Operation::Verify, opts).code == 0);
+
+    // Restore finds each file through the layout, whatever the order of the pens.
+    fs::remove_all(tmp / "hd");
+    fs::create_directories(tmp / "hd");
+    const std::vector<std::string> shuffled = {pens[2], pens[0], pens[1]};
+    auto restored = execute_backup_multi(hd, shuffled, parm, Operation::Restore, opts);
+    REQUIRE(restored.code == 0);
+    for (int i = 0; i < 40; ++i) {
+        REQUIRE(fs::file_size(tmp / "hd" / ("sub/f" + std::to_string(i) + ".txt")) == 1000u + i * 37u);
+    }
+
+    // Mirror drops files from their own pen and from the layout.
+    std::ofstream(tmp / "Backup.parm") << "sub/f0.txt\n";
+    auto m = execute_backup_multi(hd, pens, parm, Operation::Mirror, opts);
+    REQUIRE(m.code == 0);
+    REQUIRE(m.removed.size() == 39);
+    REQUIRE(layout.load(pens[0], slot));
+    REQUIRE(layout.size() == 1);
+
+    // Entries outside the layout, a wrong pen count and unsupported modes are reported.
+    std::ofstream(tmp / "Backup.parm") << "sub/f0.txt\nnever.txt\n";
+    REQUIRE(execute_backup_multi(hd, pens, parm, Operation::Restore, opts).code == 4);
+    REQUIRE(execute_backup_multi(hd, {pens[0], pens[1]}, parm, Operation::Restore, opts).code == 2);
+    REQUIRE(execute_backup_multi(hd, pens, parm, Operation::Sync, opts).code == 2);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("watch mode copies only the entries that changed, in debounced batches") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_watch_backup";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "sub");
+    fs::create_directories(tmp / "pen");
+    std::string parm_text;
+    for (int i = 0; i < 20; ++i) {
+        const std::string name = "sub/f" + std::to_string(i) + ".txt";
+        std::ofstream(tmp / "hd" / name) << "v1 " << i;
+        parm_text += name + "\n";
+    }
+    std::ofstream(tmp / "Backup.parm") << parm_text;
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+
+    std::atomic<bool> stop{false};
+    std::mutex mutex;
+    std::vector<std::pair<int, std::size_t>> batches;
+    WatchOptions watch;
+    watch.debounce_ms = 50;
+    watch.stop = &stop;
+    watch.on_batch = [&](const ActionResult& res, std::size_t entries) {
+        std::lock_guard<std::mutex> lock(mutex);
+        batches.emplace_back(res.code, entries);
+    };
+    auto batch_count = [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        return batches.size();
+    };
+    auto wait_for = [&](std::size_t n) {
+        for (int i = 0; i < 500 && batch_count() < n; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return batch_count() >= n;
+    };
+    ActionResult final_res{-1, ""};
+    std::thread runner([&] {
+        final_res = watch_backup(hd, pen, (tmp / "Backup.parm").string(), BackupOptions{}, watch);
+    });
+
+    REQUIRE(wait_for(1)); // initial full pass
+    REQUIRE(fs::exists(tmp / "pen" / "sub" / "f19.txt"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::ofstream(tmp / "hd" / "sub" / "f3.txt") << "v2 changed";
+    std::ofstream(tmp / "hd" / "sub" / "f7.txt") << "v2 changed too";
+    std::ofstream(tmp / "hd" / "sub" / "unlisted.txt") << "not in the list";
+    const bool second = wait_for(2);
+    stop = true;
+    runner.join();
+
+    REQUIRE(second);
+    REQUIRE(batches[0] == std::make_pair(0, std::size_t{20}));
+    std::size_t changed = 0;
+    for (std::size_t b = 1; b < batches.size(); ++b) {
+        REQUIRE(batches[b].first == 0);
+        changed += batches[b].second;
+    }
+    REQUIRE(changed == 2);
+    REQUIRE(final_res.code == 0);
+    std::ifstream in(tmp / "pen" / "sub" / "f7.txt");
+    std::string content;
+    std::getline(in, content);
+    REQUIRE(content == "v2 changed too");
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "sub" / "unlisted.txt"));
+    Manifest manifest;
+    REQUIRE(manifest.load(pen));
+    REQUIRE(manifest.find("sub/f3.txt")->size == std::string("v2 changed").size());
+
+    REQUIRE(watch_backup(hd, pen, (tmp / "absent.parm").string(), BackupOptions{}, watch).code == 1);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("backup with a metadata cache trusts pen stats until the pen changes") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_cached_backup";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "a.txt") << "alpha";
+    std::ofstream(tmp / "hd" / "b.txt") << "beta";
+    std::ofstream(tmp / "Backup.parm") << "a.txt\nb.txt\n";
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+    auto parm = (tmp / "Backup.parm").string();
+    MetadataCache cache;
+    BackupOptions opts;
+    opts.cache = &cache;
+
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    REQUIRE(fs::exists(tmp / "pen" / "a.txt"));
+    // Entries just copied are stat'ed once more; from then on they are known.
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+
+    // Pen-side stats come from memory: a file removed behind tp2's back goes unnoticed...
+    fs::remove(tmp / "pen" / "a.txt");
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "a.txt"));
+    // ...until the cache is dropped.
+    cache.clear();
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    REQUIRE(fs::exists(tmp / "pen" / "a.txt"));
+
+    // HD changes are always seen, and what was copied is stat'ed again next time.
+    std::ofstream(tmp / "hd" / "b.txt") << "beta v2";
+    REQUIRE(set_mtime_ns((tmp / "hd" / "b.txt").string(), stat_path((tmp / "hd" / "b.txt").string()).mtime_ns + 10000000000LL));
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    REQUIRE(fs::file_size(tmp / "pen" / "b.txt") == 7);
+    Manifest manifest;
+    REQUIRE(manifest.load(pen));
+    REQUIRE(manifest.find("b.txt")->size == 7);
+    REQUIRE(manifest.find("a.txt") != nullptr);
+
+    // A run outside the daemon rewrites the manifest, which invalidates the cached stats.
+    fs::remove(tmp / "pen" / "a.txt");
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, BackupOptions{}).code == 0);
+    fs::remove(tmp / "pen" / "a.txt");
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    REQUIRE(fs::exists(tmp / "pen" / "a.txt"));
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("job file runs several jobs through one pool with a status per job") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_jobs";
+    fs::remove_all(tmp);
+    for (const char* dir : {"hd1", "hd2", "pen1", "pen2", "pen3"}) fs::create_directories(tmp / dir);
+    std::string big;
+    for (int i = 0; big.size() < 1024 * 1024; ++i) big += "linha " + std::to_string(i) + "\n";
+    for (int i = 0; i < 6; ++i) std::ofstream(tmp / "hd1" / ("f" + std::to_string(i) + ".bin"), std::ios::binary) << big;
+    std::ofstream(tmp / "hd2" / "doc.txt") << "documento";
+    std::ofstream(tmp / "one.parm") << "f0.bin\nf1.bin\nf2.bin\nf3.bin\nf4.bin\nf5.bin\n";
+    std::ofstream(tmp / "two.parm") << "doc.txt\ngone.txt\n";
+    std::ofstream(tmp / "jobs.txt") << "fotos backup hd1 pen1 one.parm 3\n"
+                                       "docs backup hd2 pen2 two.parm\n"
+                                       "checagem verify hd1 pen3 one.parm\n";
+    std::vector<Job> jobs;
+    std::string error;
+    REQUIRE(load_jobs((tmp / "jobs.txt").string(), jobs, error));
+
+    BackupOptions opts;
+    opts.jobs = 3;
+    std::vector<ActionResult> per_job;
+    auto r = execute_jobs(jobs, opts, 1, per_job);
+    REQUIRE(per_job.size() == 3);
+    REQUIRE(per_job[0].code == 0);
+    REQUIRE(per_job[1].code == 4); // gone.txt is listed but missing
+    REQUIRE(per_job[2].code != 0); // nothing on pen3 to verify
+    REQUIRE(r.code == 4);
+    REQUIRE(r.message.rfind("job docs: ", 0) == 0);
+    REQUIRE(r.pens.size() == 3);
+    for (int i = 0; i < 6; ++i) REQUIRE(fs::file_size(tmp / "pen1" / ("f" + std::to_string(i) + ".bin")) == big.size());
+    REQUIRE(fs::exists(tmp / "pen2" / "doc.txt"));
+    Manifest manifest;
+    REQUIRE(manifest.load((tmp / "pen1").string()));
+    REQUIRE(manifest.find("f5.bin")->hash == hash64(big.data(), big.size()));
+
+    // Each job is an ordinary pen afterwards: verify it the usual way.
+    REQUIRE(execute_backup((tmp / "hd1").string(), (tmp / "pen1").string(), (tmp / "one.parm").string(),
+                           Operation::Verify).code == 0);
+    std::ofstream(tmp / "two.parm") << "doc.txt\n";
+    REQUIRE(execute_jobs({jobs[0], jobs[1]}, opts, 0, per_job).code == 0);
+
+    // A job whose pen cannot be written fails alone.
+    std::ofstream(tmp / "not-a-dir") << "file";
+    jobs[0].pen = (tmp / "not-a-dir").string();
+    fs::remove_all(tmp / "pen2");
+    fs::create_directories(tmp / "pen2");
+    r = execute_jobs({jobs[0], jobs[1]}, opts, 2, per_job);
+    REQUIRE(r.code == 5);
+    REQUIRE(per_job[1].code == 0);
+    REQUIRE(fs::exists(tmp / "pen2" / "doc.txt"));
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("backup honours the write limit across worker threads") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_throttled";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    const std::string block(512 * 1024, 'x');
+    std::string parm;
+    for (int i = 0; i < 6; ++i) {
+        std::ofstream(tmp / "hd" / ("f" + std::to_string(i)), std::ios::binary) << block;
+        parm += "f" + std::to_string(i) + "\n";
+    }
+    std::ofstream(tmp / "Backup.parm") << parm;
+    IoLimits limits;
+    limits.write_bytes_per_sec = 1024 * 1024; // 3 MiB to write: 1 MiB of burst, then ~2 s
+    IoThrottle throttle(limits);
+    BackupOptions opts;
+    opts.jobs = 4;
+    opts.throttle = &throttle;
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(execute_backup((tmp / "hd").string(), (tmp / "pen").string(), (tmp / "Backup.parm").string(),
+                           Operation::Backup, opts).code == 0);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    REQUIRE(elapsed >= 1.5);
+    REQUIRE(fs::file_size(tmp / "pen" / "f5") == block.size());
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("backup with --jobs auto copies everything and learns a limit per device") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_auto_jobs";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "d");
+    fs::create_directories(tmp / "pen");
+    std::string parm;
+    for (int i = 0; i < 200; ++i) {
+        std::ofstream(tmp / "hd" / "d" / ("f" + std::to_string(i))) << std::string(1000 + i, 'a' + i % 26);
+        parm += "d/f" + std::to_string(i) + "\n";
+    }
+    std::ofstream(tmp / "Backup.parm") << parm;
+    AdaptiveConcurrency concurrency;
+    BackupOptions opts;
+    opts.jobs = AdaptiveConcurrency::kMaxLimit;
+    opts.concurrency = &concurrency;
+    REQUIRE(execute_backup((tmp / "hd").string(), (tmp / "pen").string(), (tmp / "Backup.parm").string(),
+                           Operation::Backup, opts).code == 0);
+    for (int i = 0; i < 200; ++i) REQUIRE(fs::file_size(tmp / "pen" / "d" / ("f" + std::to_string(i))) == 1000u + i);
+    const auto devices = concurrency.devices();
+    REQUIRE_FALSE(devices.empty()); // HD and pen share one device here
+    for (const auto& d : devices) {
+        REQUIRE(d.limit >= 1);
+        REQUIRE(d.limit <= AdaptiveConcurrency::kMaxLimit);
+        REQUIRE(d.peak <= AdaptiveConcurrency::kMaxLimit);
+    }
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("backup through a usb profile syncs and drops each copy and keeps the content") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_profile";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen1");
+    fs::create_directories(tmp / "pen2");
+    std::string big;
+    for (int i = 0; i < 100000; ++i) big += static_cast<char>('a' + i % 23);
+    std::ofstream(tmp / "hd" / "big.bin") << big;
+    std::ofstream(tmp / "hd" / "small.txt") << "small";
+    std::ofstream(tmp / "Backup.parm") << "big.bin\nsmall.txt\n";
+    ProfileSpec spec;
+    std::string error;
+    REQUIRE(parse_profile_spec("usb,buffer=4K", spec, error));
+    DeviceProfiles profiles(spec);
+    BackupOptions opts;
+    opts.profiles = &profiles;
+    const std::string hd = (tmp / "hd").string(), parm = (tmp / "Backup.parm").string();
+    REQUIRE(execute_backup(hd, (tmp / "pen1").string(), parm, Operation::Backup, opts).code == 0);
+    REQUIRE(execute_backup_multi(hd, {(tmp / "pen1").string(), (tmp / "pen2").string()}, parm, Operation::Mirror,
+                                 opts).code == 0);
+    for (const char* pen : {"pen1", "pen2"}) {
+        std::ifstream in(tmp / pen / "big.bin", std::ios::binary);
+        std::string got((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        REQUIRE(got == big);
+    }
+    REQUIRE(execute_backup(hd, (tmp / "pen2").string(), parm, Operation::Verify, opts).code == 0);
+    fs::remove(tmp / "hd" / "big.bin");
+    REQUIRE(execute_backup(hd, (tmp / "pen1").string(), parm, Operation::Restore, opts).code == 0);
+    REQUIRE(fs::file_size(tmp / "hd" / "big.bin") == big.size());
+    REQUIRE(profiles.devices().front().profile.fsync == FsyncPolicy::File);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("backup does not recopy a file whose pen copy reads back older than the source") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_coarse_mtime";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "a.txt") << "alpha";
+    std::ofstream(tmp / "hd" / "b.txt") << "bravo";
+    std::ofstream(tmp / "Backup.parm") << "a.txt\nb.txt\n";
+    const std::string hd = (tmp / "hd").string(), pen = (tmp / "pen").string(), parm = (tmp / "Backup.parm").string();
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup).code == 0);
+    // What a FAT pen does: the stored mtimes come back rounded down.
+    for (const char* name : {"a.txt", "b.txt"}) {
+        const FileStat st = stat_path((tmp / "pen" / name).string());
+        REQUIRE(set_mtime_ns((tmp / "pen" / name).string(), st.mtime_ns - 1500000000LL));
+    }
+    std::ofstream(tmp / "hd" / "b.txt") << "BRAVO"; // same size, new content and mtime
+    REQUIRE(set_mtime_ns((tmp / "hd" / "b.txt").string(), stat_path((tmp / "hd" / "b.txt").string()).mtime_ns + 5000000000LL));
+    BackupPlan plan;
+    REQUIRE(plan_backup(hd, pen, parm, Operation::Backup, BackupOptions{}, plan).code == 0);
+    REQUIRE(plan.entries.size() == 2);
+    REQUIRE(plan.entries[0].action == PlanAction::Skip);   // manifest: the pen has this exact source
+    REQUIRE(plan.entries[1].action == PlanAction::Update); // the source changed since
+    REQUIRE(execute_plan(hd, pen, plan, BackupOptions{}).code == 0);
+    std::string got;
+    std::ifstream(tmp / "pen" / "b.txt") >> got;
+    REQUIRE(got == "BRAVO");
+    fs::remove_all(tmp);
+}
+
+
+TEST_CASE("backup splits files over the part size and restores, verifies and mirrors them whole") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_split_backup";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::string big;
+    for (int i = 0; i < 5500; ++i) big += static_cast<char>('a' + i % 19);
+    std::ofstream(tmp / "hd" / "big.bin") << big;
+    std::ofstream(tmp / "hd" / "small.txt") << "small";
+    std::ofstream(tmp / "Backup.parm") << "big.bin\nsmall.txt\n";
+    BackupOptions opts;
+    opts.split_size = 1000;
+    const std::string hd = (tmp / "hd").string(), pen = (tmp / "pen").string(), parm = (tmp / "Backup.parm").string();
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    SplitDescriptor split;
+    REQUIRE(read_split_descriptor((tmp / "pen" / "big.bin").string(), split));
+    REQUIRE(split_parts_on_disk((tmp / "pen" / "big.bin").string()).size() == 6);
+    REQUIRE_FALSE(read_split_descriptor((tmp / "pen" / "small.txt").string(), split));
+
+    // Nothing to do the second time; mirror keeps the parts; verify reads through them.
+    BackupPlan plan;
+    REQUIRE(plan_backup(hd, pen, parm, Operation::Mirror, opts, plan).code == 0);
+    for (const auto& e : plan.entries) REQUIRE(e.action == PlanAction::Skip);
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Mirror, opts).code == 0);
+    REQUIRE(split_parts_on_disk((tmp / "pen" / "big.bin").string()).size() == 6);
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Verify, opts).code == 0);
+
+    fs::remove(tmp / "hd" / "big.bin");
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Restore, opts).code == 0);
+    std::ifstream in(tmp / "hd" / "big.bin", std::ios::binary);
+    REQUIRE(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()) == big);
+    {
+        std::ofstream part(split_part_path((tmp / "pen" / "big.bin").string(), 2), std::ios::in | std::ios::out);
+        part << "X";
+    }
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Verify, opts).code == 6);
+
+    // Dropped from the list: mirror takes the descriptor and every part with it.
+    std::ofstream(tmp / "Backup.parm", std::ios::trunc) << "small.txt\n";
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Mirror, opts).code == 0);
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "big.bin"));
+    REQUIRE(split_parts_on_disk((tmp / "pen" / "big.bin").string()).empty());
+
+    // With --quarantine the parts are set aside next to their descriptor, in a nested directory too.
+    fs::create_directories(tmp / "hd" / "sub");
+    std::ofstream(tmp / "hd" / "sub" / "big.bin") << big;
+    std::ofstream(tmp / "Backup.parm", std::ios::trunc) << "small.txt\nsub/big.bin\n";
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    REQUIRE(split_parts_on_disk((tmp / "pen" / "sub" / "big.bin").string()).size() == 6);
+    std::ofstream(tmp / "Backup.parm", std::ios::trunc) << "small.txt\n";
+    BackupOptions quarantine = opts;
+    quarantine.quarantine = true;
+    auto r = execute_backup(hd, pen, parm, Operation::Mirror, quarantine);
+    REQUIRE(r.code == 0);
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "sub" / "big.bin"));
+    REQUIRE(split_parts_on_disk((tmp / "pen" / "sub" / "big.bin").string()).empty());
+    std::vector<fs::path> kept;
+    for (const auto& entry : fs::directory_iterator(tmp / "pen" / ".tp2_quarantine")) {
+        kept.push_back(entry.path() / "sub" / "big.bin");
+    }
+    REQUIRE(kept.size() == 1);
+    REQUIRE(read_split_descriptor(kept[0].string(), split));
+    REQUIRE(split_parts_on_disk(kept[0].string()).size() == 6);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("backup with --compress splits what could pass the part size, precompressed files included") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_split_compress";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::string big, edge(995, 'e'), small(900, 's');
+    for (int i = 0; i < 5500; ++i) big += static_cast<char>('a' + i % 19);
+    std::ofstream(tmp / "hd" / "big.zip") << big;  // copied as-is under --compress
+    std::ofstream(tmp / "hd" / "log.txt") << big;
+    std::ofstream(tmp / "hd" / "edge.txt") << edge; // fits raw, its frame might not
+    std::ofstream(tmp / "hd" / "small.txt") << small;
+    std::ofstream(tmp / "Backup.parm") << "big.zip\nlog.txt\nedge.txt\nsmall.txt\n";
+    BackupOptions opts;
+    opts.compress = true;
+    opts.split_size = 1000;
+    const std::string hd = (tmp / "hd").string(), pen = (tmp / "pen").string(), parm = (tmp / "Backup.parm").string();
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Backup, opts).code == 0);
+    SplitDescriptor split;
+    for (const char* name : {"big.zip", "log.txt", "edge.txt"}) {
+        REQUIRE(read_split_descriptor((tmp / "pen" / name).string(), split));
+    }
+    REQUIRE_FALSE(read_split_descriptor((tmp / "pen" / "small.txt").string(), split));
+    REQUIRE(fs::file_size(tmp / "pen" / "small.txt") < small.size());
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Verify, opts).code == 0);
+
+    const std::map<std::string, std::string> files = {
+        {"big.zip", big}, {"log.txt", big}, {"edge.txt", edge}, {"small.txt", small}};
+    for (const auto& f : files) fs::remove(tmp / "hd" / f.first);
+    REQUIRE(execute_backup(hd, pen, parm, Operation::Restore, opts).code == 0);
+    for (const auto& f : files) {
+        std::ifstream in(tmp / "hd" / f.first, std::ios::binary);
+        REQUIRE(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()) == f.second);
+    }
+
+    // Fanned out to two pens, the same files go in parts on both.
+    fs::create_directories(tmp / "pen2");
+    REQUIRE(execute_backup_multi(hd, {pen, (tmp / "pen2").string()}, parm, Operation::Backup, opts).code == 0);
+    REQUIRE(read_split_descriptor((tmp / "pen2" / "big.zip").string(), split));
+    REQUIRE(read_split_descriptor((tmp / "pen2" / "edge.txt").string(), split));
+    REQUIRE_FALSE(read_split_descriptor((tmp / "pen2" / "small.txt").string(), split));
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("backup with erase-block coalescing writes every size whole across parallel jobs") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_coalesce";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    const std::size_t block = 64 * 1024;
+    const std::size_t sizes[] = {0, 1, block - 1, block, block + 1, 3 * block + 777};
+    std::map<std::string, std::string> files;
+    std::ofstream parm(tmp / "Backup.parm");
+    for (std::size_t k = 0; k < std::size(sizes); ++k) {
+        std::string data;
+        for (std::size_t i = 0; i < sizes[k]; ++i) data += static_cast<char>((i * 31 + k) % 253);
+        const std::string name = "f" + std::to_string(k) + ".bin";
+        std::ofstream(tmp / "hd" / name, std::ios::binary) << data;
+        parm << name << "\n";
+        files[name] = data;
+    }
+    parm.close();
+    ProfileSpec spec;
+    std::string error;
+    REQUIRE(parse_profile_spec("usb,erase=64K,fsync=none,direct=off", spec, error));
+    DeviceProfiles profiles(spec);
+    BackupOptions opts;
+    opts.profiles = &profiles;
+    opts.jobs = 4;
+    const std::string hd = (tmp / "hd").string(), pen = (tmp / "pen").string(), parm_path = (tmp / "Backup.parm").string();
+    REQUIRE(execute_backup(hd, pen, parm_path, Operation::Backup, opts).code == 0);
+    for (const auto& kv : files) {
+        std::ifstream in(tmp / "pen" / kv.first, std::ios::binary);
+        REQUIRE(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()) == kv.second);
+        REQUIRE(stat_path((tmp / "pen" / kv.first).string()).mtime_ns ==
+                stat_path((tmp / "hd" / kv.first).string()).mtime_ns);
+    }
+    REQUIRE(execute_backup(hd, pen, parm_path, Operation::Verify, opts).code == 0);
+
+    // Compressed, split and fanned-out copies go through the same gate, and come back whole.
+    opts.compress = true;
+    opts.split_size = 2 * block;
+    const std::vector<std::string> pens = {(tmp / "pen2").string(), (tmp / "pen3").string()};
+    for (const auto& p : pens) fs::create_directories(p);
+    REQUIRE(execute_backup_multi(hd, pens, parm_path, Operation::Backup, opts).code == 0);
+    SplitDescriptor split;
+    REQUIRE(read_split_descriptor((tmp / "pen3" / "f5.bin").string(), split));
+    REQUIRE_FALSE(read_split_descriptor((tmp / "pen3" / "f4.bin").string(), split));
+    REQUIRE(execute_backup_multi(hd, pens, parm_path, Operation::Verify, opts).code == 0);
+    for (const auto& kv : files) fs::remove(tmp / "hd" / kv.first);
+    REQUIRE(execute_backup(hd, pens[1], parm_path, Operation::Restore, opts).code == 0);
+    for (const auto& kv : files) {
+        std::ifstream in(tmp / "hd" / kv.first, std::ios::binary);
+        REQUIRE(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()) == kv.second);
+    }
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("backup and restore with readahead prefetch each source once and copy it intact") {
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::current_path() / "_tmp_readahead_backup";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::ofstream parm(tmp / "Backup.parm");
+    for (int k = 0; k < 8; ++k) {
+        std::ofstream(tmp / "hd" / ("f" + std::to_string(k))) << std::string(1000 + k, static_cast<char>('a' + k));
+        parm << "f" << k << "\n";
+    }
+    parm.close();
+    Readahead readahead(4096);
+    BackupOptions opts;
+    opts.readahead = &readahead;
+    opts.jobs = 2;
+    const std::string hd = (tmp / "hd").string(), pen = (tmp / "pen").string(), parm_path = (tmp / "Backup.parm").string();
+    REQUIRE(execute_backup(hd, pen, parm_path, Operation::Backup, opts).code == 0);
+    REQUIRE(readahead.stats().files <= 8);
+    REQUIRE(readahead.stats().peak_bytes <= 4096);
+    REQUIRE(readahead.stats().queued_files == 0);
+    for (int k = 0; k < 8; ++k) REQUIRE(fs::file_size(tmp / "pen" / ("f" + std::to_string(k))) == 1000u + k);
+    fs::remove(tmp / "hd" / "f3");
+    REQUIRE(execute_backup(hd, pen, parm_path, Operation::Restore, opts).code == 0);
+    std::string got;
+    std::ifstream(tmp / "hd" / "f3") >> got;
+    REQUIRE(got == std::string(1003, 'd'));
+    REQUIRE(readahead.stats().queued_bytes == 0);
+    fs::remove_all(tmp);
+}
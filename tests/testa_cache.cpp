@@ -0,0 +1,66 @@
+#include "catch.hpp"
+#include "cache.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+TEST_CASE("cache: parm list reloads when the file changes") {
+    fs::path tmp = fs::current_path() / "_tmp_cache_parm";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    const std::string parm = (tmp / "Backup.parm").string();
+    std::ofstream(parm) << "a.txt\n# comment\nb.txt\n";
+    MetadataCache cache;
+    PathArena paths;
+    REQUIRE(cache.params(parm, paths) == 2);
+    REQUIRE(paths.str(1) == "b.txt");
+
+    std::ofstream(parm) << "a.txt\nb.txt\nc/d.txt\n"; // different size: reloaded
+    PathArena again;
+    REQUIRE(cache.params(parm, again) == 3);
+    REQUIRE(again.str(2) == "c/d.txt");
+
+    PathArena none;
+    REQUIRE(cache.params((tmp / "absent.parm").string(), none) == 0);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("cache: manifest and pen stats are dropped when the pen changes behind it") {
+    fs::path tmp = fs::current_path() / "_tmp_cache_pen";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    const std::string pen = tmp.string();
+    MetadataCache cache;
+
+    Manifest manifest;
+    manifest.set("a.txt", ManifestEntry{1, 2, 3});
+    REQUIRE(manifest.save(pen));
+    cache.put_manifest(pen, std::move(manifest));
+    Manifest taken;
+    REQUIRE(cache.take_manifest(pen, taken));
+    REQUIRE(taken.find("a.txt") != nullptr);
+    REQUIRE_FALSE(cache.take_manifest(pen, taken)); // taken means gone until put back
+
+    // Stats count only once confirmed, and only while the manifest is the one left behind.
+    auto stats = std::make_shared<MetadataCache::StatMap>();
+    (*stats)["a.txt"] = FileStat{true, false, 1, 2};
+    (*stats)["b.txt"] = FileStat{true, false, 5, 6};
+    cache.stage_pen_stats(pen, stats, false);
+    REQUIRE(cache.pen_stats(pen, pen) == nullptr);
+    cache.confirm_pen_stats(pen, pen, {"b.txt"});
+    auto known = cache.pen_stats(pen, pen);
+    REQUIRE(known != nullptr);
+    REQUIRE(known->count("a.txt") == 1);
+    REQUIRE(known->count("b.txt") == 0);
+
+    taken.set("other.txt", ManifestEntry{7, 8, 9});
+    REQUIRE(taken.save(pen)); // another run wrote to the pen
+    REQUIRE(cache.pen_stats(pen, pen) == nullptr);
+    cache.put_manifest(pen, std::move(taken));
+    cache.clear();
+    REQUIRE_FALSE(cache.take_manifest(pen, taken));
+    fs::remove_all(tmp);
+}
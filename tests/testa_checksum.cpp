@@ -0,0 +1,37 @@
+#include "catch.hpp"
+#include "checksum.hpp"
+#include <algorithm>
+#include <string>
+
+using namespace tp2;
+
+TEST_CASE("checksum: hash64 matches XXH64 reference vectors") {
+    REQUIRE(hash64("", 0) == 0xEF46DB3751D8E999ULL);
+    REQUIRE(hash64("abc", 3) == 0x44BC2CF5AD770999ULL);
+}
+
+TEST_CASE("checksum: incremental updates equal one-shot hash") {
+    std::string data;
+    for (int i = 0; i < 1000; ++i) data.push_back(static_cast<char>(i * 31 + 7));
+
+    // Feed in uneven pieces so the 32-byte stripe buffer is exercised
+    Hasher64 h;
+    std::size_t pos = 0, step = 1;
+    while (pos < data.size()) {
+        std::size_t n = std::min(step, data.size() - pos);
+        h.update(data.data() + pos, n);
+        pos += n;
+        step = step * 3 % 61 + 1;
+    }
+    REQUIRE(h.digest() == hash64(data.data(), data.size()));
+    REQUIRE(hash64(data.data(), data.size(), 1) != hash64(data.data(), data.size(), 0));
+}
+
+TEST_CASE("checksum: hex round trip and invalid input") {
+    std::uint64_t h = hash64("tp2", 3), back = 0;
+    REQUIRE(hash_to_hex(h).size() == 16);
+    REQUIRE(hash_from_hex(hash_to_hex(h), back));
+    REQUIRE(back == h);
+    REQUIRE_FALSE(hash_from_hex("xyz", back));
+    REQUIRE_FALSE(hash_from_hex("zzzzzzzzzzzzzzzz", back));
+}
@@ -0,0 +1,293 @@
+#include "catch.hpp"
+#include "chunk_store.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+namespace {
+std::vector<std::uint8_t> random_bytes(std::size_t n, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::vector<std::uint8_t> data(n);
+    for (auto& b : data) b = static_cast<std::uint8_t>(gen());
+    return data;
+}
+
+// Cut a whole buffer the way the store does and return the chunk sizes.
+std::vector<std::size_t> cut_all(const std::vector<std::uint8_t>& data, const ChunkParams& p) {
+    std::vector<std::size_t> sizes;
+    for (std::size_t pos = 0; pos < data.size();) {
+        std::size_t cut = fastcdc_cut(data.data() + pos, data.size() - pos, p);
+        sizes.push_back(cut);
+        pos += cut;
+    }
+    return sizes;
+}
+
+void write_bytes(const fs::path& path, const std::vector<std::uint8_t>& data) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+}
+
+std::string read_all(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+}
+
+TEST_CASE("chunk_store: fastcdc cuts respect the size limits") {
+    ChunkParams p;
+    auto data = random_bytes(4 * 1024 * 1024, 1);
+    auto sizes = cut_all(data, p);
+    REQUIRE(sizes.size() > 16);
+    for (std::size_t i = 0; i + 1 < sizes.size(); ++i) {
+        REQUIRE(sizes[i] > p.min_size);
+        REQUIRE(sizes[i] <= p.max_size);
+    }
+    // Average lands near the requested size on random data.
+    double avg = static_cast<double>(data.size()) / static_cast<double>(sizes.size());
+    REQUIRE(avg > p.avg_size / 2.0);
+    REQUIRE(avg < p.avg_size * 2.0);
+    REQUIRE(fastcdc_cut(data.data(), 100, p) == 100);
+}
+
+TEST_CASE("chunk_store: inserting bytes only disturbs nearby chunks") {
+    ChunkParams p;
+    auto data = random_bytes(2 * 1024 * 1024, 2);
+    auto shifted = data;
+    shifted.insert(shifted.begin() + 300000, {'x', 'y', 'z'});
+
+    auto ids = [&](const std::vector<std::uint8_t>& d) {
+        std::vector<std::string> out;
+        std::size_t pos = 0;
+        for (std::size_t n : cut_all(d, p)) { out.push_back(chunk_id(d.data() + pos, n).hex()); pos += n; }
+        return out;
+    };
+    auto a = ids(data);
+    auto b = ids(shifted);
+    std::size_t shared = 0;
+    for (const auto& id : b) shared += std::count(a.begin(), a.end(), id) > 0;
+    REQUIRE(shared + 3 >= a.size());
+}
+
+TEST_CASE("chunk_store: store, dedup and restore round trip") {
+    fs::path tmp = fs::current_path() / "_tmp_chunk_store";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "pen");
+    auto base = random_bytes(1024 * 1024, 3);
+    auto clone = base;
+    clone[700000] ^= 0xFF; // near-identical copy
+    write_bytes(tmp / "a.bin", base);
+    write_bytes(tmp / "b.bin", clone);
+
+    ChunkStore store((tmp / "pen").string());
+    ManifestEntry rec;
+    std::string recipe_a = store.recipe_root() + "/a.bin";
+    REQUIRE(store.store_file((tmp / "a.bin").string(), 1234, recipe_a, &rec));
+    REQUIRE(rec.size == base.size());
+    const auto after_first = store.bytes_written();
+    REQUIRE(after_first == base.size());
+
+    REQUIRE(store.store_file((tmp / "b.bin").string(), 1234, store.recipe_root() + "/dir/b.bin"));
+    // Only the chunk holding the changed byte is new.
+    REQUIRE(store.chunks_written() > 1);
+    REQUIRE(store.bytes_written() - after_first <= ChunkParams{}.max_size);
+
+    std::uint64_t bytes = 0;
+    REQUIRE(store.restore_file(store.recipe_root() + "/dir/b.bin", (tmp / "b.out").string(), bytes));
+    REQUIRE(bytes == clone.size());
+    REQUIRE(read_all(tmp / "b.out") == read_all(tmp / "b.bin"));
+
+    Recipe recipe;
+    REQUIRE(load_recipe(recipe_a, recipe));
+    REQUIRE(recipe.mtime_ns == 1234);
+    REQUIRE(recipe.hash == rec.hash);
+
+    // A damaged chunk is detected instead of silently restored.
+    { std::fstream f(store.chunk_path(recipe.chunks[0].id), std::ios::in | std::ios::out | std::ios::binary);
+      f.seekp(10); f.put('!'); }
+    REQUIRE_FALSE(store.restore_file(recipe_a, (tmp / "a.out").string(), bytes));
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("chunk_store: empty file has an empty recipe") {
+    fs::path tmp = fs::current_path() / "_tmp_chunk_empty";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    std::ofstream(tmp / "empty").close();
+    ChunkStore store((tmp / "pen").string());
+    REQUIRE(store.store_file((tmp / "empty").string(), 0, store.recipe_root() + "/empty"));
+    std::uint64_t bytes = 1;
+    REQUIRE(store.restore_file(store.recipe_root() + "/empty", (tmp / "empty.out").string(), bytes));
+    REQUIRE(bytes == 0);
+    REQUIRE(fs::file_size(tmp / "empty.out") == 0);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("chunk_store: compressed chunks restore the original bytes") {
+    fs::path tmp = fs::current_path() / "_tmp_chunk_compress";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    std::string text;
+    for (int i = 0; text.size() < 500000; ++i) text += "linha " + std::to_string(i % 300) + "\n";
+    std::ofstream(tmp / "log.txt") << text;
+
+    ChunkStore store((tmp / "pen").string());
+    store.set_compression(true);
+    REQUIRE(store.store_file((tmp / "log.txt").string(), 0, store.recipe_root() + "/log.txt"));
+    REQUIRE(store.bytes_written() < text.size() / 4);
+    std::uint64_t bytes = 0;
+    REQUIRE(store.restore_file(store.recipe_root() + "/log.txt", (tmp / "log.out").string(), bytes));
+    REQUIRE(read_all(tmp / "log.out") == text);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("chunk_store: garbage collection keeps referenced chunks and resumes after the deadline") {
+    fs::path tmp = fs::current_path() / "_tmp_chunk_gc";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "pen");
+    write_bytes(tmp / "keep.bin", random_bytes(300000, 11));
+    write_bytes(tmp / "drop.bin", random_bytes(300000, 12));
+
+    ChunkStore store((tmp / "pen").string());
+    const std::string keep = store.recipe_root() + "/keep.bin";
+    const std::string drop = store.recipe_root() + "/drop.bin";
+    REQUIRE(store.store_file((tmp / "keep.bin").string(), 0, keep));
+    REQUIRE(store.store_file((tmp / "drop.bin").string(), 0, drop));
+    Recipe dropped;
+    REQUIRE(load_recipe(drop, dropped));
+    fs::remove(drop);
+
+    // An expired deadline sweeps nothing.
+    GcResult idle = store.collect_garbage(std::chrono::steady_clock::now() - std::chrono::seconds(1));
+    REQUIRE(idle.chunks_removed == 0);
+    REQUIRE_FALSE(idle.complete);
+
+    GcResult gc = store.collect_garbage(std::chrono::steady_clock::time_point::max());
+    REQUIRE(gc.complete);
+    REQUIRE(gc.chunks_removed == dropped.chunks.size());
+    REQUIRE(gc.bytes_removed >= 300000);
+    for (const auto& c : dropped.chunks) REQUIRE_FALSE(fs::exists(store.chunk_path(c.id)));
+    std::uint64_t bytes = 0;
+    REQUIRE(store.restore_file(keep, (tmp / "keep.out").string(), bytes));
+    REQUIRE(read_all(tmp / "keep.out") == read_all(tmp / "keep.bin"));
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("chunk_store: an unreadable recipe stops garbage collection before the sweep") {
+    fs::path tmp = fs::current_path() / "_tmp_chunk_gc_unreadable";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "pen");
+    write_bytes(tmp / "a.bin", random_bytes(300000, 31));
+    ChunkStore store((tmp / "pen").string());
+    const std::string recipe = store.recipe_root() + "/a.bin";
+    REQUIRE(store.store_file((tmp / "a.bin").string(), 0, recipe));
+    Recipe stored;
+    REQUIRE(load_recipe(recipe, stored));
+    std::ofstream(store.recipe_root() + "/b.bin.tmp") << "# tp2 recipe v1\nfile 9"; // interrupted save
+    fs::resize_file(recipe, fs::file_size(recipe) / 2);
+
+    GcResult gc = store.collect_garbage(std::chrono::steady_clock::time_point::max());
+    REQUIRE(gc.unreadable == recipe);
+    REQUIRE_FALSE(gc.complete);
+    REQUIRE(gc.chunks_removed == 0);
+    for (const auto& c : stored.chunks) REQUIRE(fs::exists(store.chunk_path(c.id)));
+
+    REQUIRE(store.store_file((tmp / "a.bin").string(), 0, recipe)); // repaired
+    gc = store.collect_garbage(std::chrono::steady_clock::time_point::max());
+    REQUIRE(gc.unreadable.empty());
+    REQUIRE(gc.complete);
+    REQUIRE(gc.chunks_removed == 0);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("chunk_store: a collection spread over many short budgets still reclaims everything") {
+    fs::path tmp = fs::current_path() / "_tmp_chunk_gc_budget";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "pen");
+    write_bytes(tmp / "keep.bin", random_bytes(100000, 21));
+    write_bytes(tmp / "drop.bin", random_bytes(600000, 22));
+    ChunkStore store((tmp / "pen").string());
+    const std::string keep = store.recipe_root() + "/keep.bin";
+    const std::string drop = store.recipe_root() + "/drop.bin";
+    REQUIRE(store.store_file((tmp / "keep.bin").string(), 0, keep));
+    REQUIRE(store.store_file((tmp / "drop.bin").string(), 0, drop));
+    Recipe dropped;
+    REQUIRE(load_recipe(drop, dropped));
+    fs::remove(drop);
+    // Enough recipes that marking them all takes many budgets.
+    for (int i = 0; i < 3000; ++i) fs::copy_file(keep, store.recipe_root() + "/copy" + std::to_string(i));
+
+    const auto budget = std::chrono::milliseconds(2);
+    std::uint64_t removed = 0;
+    bool complete = false;
+    int runs = 0;
+    for (; runs < 4096 && !complete; ++runs) {
+        const auto start = std::chrono::steady_clock::now();
+        GcResult gc = store.collect_garbage(start + budget);
+        // The mark is charged too: no run reads every recipe.
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+        removed += gc.chunks_removed;
+        complete = gc.complete;
+    }
+    REQUIRE(complete);
+    REQUIRE(runs > 1);
+    REQUIRE(removed == dropped.chunks.size());
+    for (const auto& c : dropped.chunks) REQUIRE_FALSE(fs::exists(store.chunk_path(c.id)));
+    std::uint64_t bytes = 0;
+    REQUIRE(store.restore_file(keep, (tmp / "keep.out").string(), bytes));
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("chunk_store: files stored between two collection runs keep their chunks") {
+    fs::path tmp = fs::current_path() / "_tmp_chunk_gc_between";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "pen");
+    write_bytes(tmp / "keep.bin", random_bytes(200000, 41));
+    write_bytes(tmp / "drop.bin", random_bytes(200000, 42));
+    write_bytes(tmp / "new.bin", random_bytes(200000, 43));
+    const std::string pen = (tmp / "pen").string();
+    Recipe dropped;
+    {
+        ChunkStore store(pen);
+        REQUIRE(store.store_file((tmp / "keep.bin").string(), 0, store.recipe_root() + "/a/keep.bin"));
+        REQUIRE(store.store_file((tmp / "drop.bin").string(), 0, store.recipe_root() + "/b/drop.bin"));
+        REQUIRE(load_recipe(store.recipe_root() + "/b/drop.bin", dropped));
+        fs::remove(store.recipe_root() + "/b/drop.bin");
+        // An expired budget still marks one recipe, and leaves the cycle open.
+        GcResult gc = store.collect_garbage(std::chrono::steady_clock::now() - std::chrono::seconds(1));
+        REQUIRE_FALSE(gc.complete);
+        REQUIRE(gc.chunks_removed == 0);
+    }
+    {
+        // A backup in between: a new file, and one that brings the unreferenced chunks back.
+        ChunkStore store(pen);
+        REQUIRE(store.store_file((tmp / "new.bin").string(), 0, store.recipe_root() + "/0/new.bin"));
+        REQUIRE(store.store_file((tmp / "drop.bin").string(), 0, store.recipe_root() + "/0/again.bin"));
+    }
+    ChunkStore store(pen);
+    GcResult gc = store.collect_garbage(std::chrono::steady_clock::time_point::max());
+    REQUIRE(gc.complete);
+    REQUIRE(gc.chunks_removed == 0);
+    for (const char* name : {"a/keep.bin", "0/new.bin", "0/again.bin"}) {
+        std::uint64_t bytes = 0;
+        REQUIRE(store.restore_file(store.recipe_root() + "/" + name, (tmp / "out.bin").string(), bytes));
+    }
+    REQUIRE(read_all(tmp / "out.bin") == read_all(tmp / "drop.bin"));
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / ChunkStore::kChunkDir / "gc_cursor")); // the cycle is closed
+
+    // With nothing stored in between, the next cycle frees them.
+    fs::remove(store.recipe_root() + "/0/again.bin");
+    gc = store.collect_garbage(std::chrono::steady_clock::time_point::max());
+    REQUIRE(gc.complete);
+    REQUIRE(gc.chunks_removed == dropped.chunks.size());
+    fs::remove_all(tmp);
+}
@@ -1,6 +1,7 @@
 #include "catch.hpp"
 #include <filesystem>
 #include <fstream>
+#include <iterator>
 #include <string>
 #include <cstdlib>
 #include <unistd.h>
@@ -161,9 +162,182 @@ TEST_CASE("cli: error when mode is invalid (exit 2)") {
     fs::remove_all(tmp);
 }
 
+TEST_CASE("cli: verify mode after backup exits 0, invalid --jobs exits 1") {
+    require_cli_present();
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::temp_directory_path() / ("tp2_cli_verify_" + std::to_string(::getpid()));
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "CLI_V.txt") << "verify-me";
+    std::ofstream(tmp / "Backup.parm") << "CLI_V.txt\n";
+
+    auto q = [](const fs::path& p) { return std::string("\"") + p.string() + "\""; };
+    std::string paths = "--hd " + q(tmp / "hd") + " --pen " + q(tmp / "pen") + " --parm " + q(tmp / "Backup.parm");
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup " + paths + " 2>" +
+                                                 q(tmp / "quiet.txt")).c_str())) == 0);
+    std::ifstream quiet_err(tmp / "quiet.txt");
+    std::string quiet((std::istreambuf_iterator<char>(quiet_err)), std::istreambuf_iterator<char>());
+    REQUIRE(quiet.find("profile: ") == std::string::npos);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode verify --jobs 2 --bwlimit 64M " + paths).c_str())) == 0);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode verify --jobs auto " + paths).c_str())) == 0);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode verify --jobs zero " + paths + " 2>/dev/null").c_str())) == 1);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup --profile ssd,queue=3 " + paths + " 2>" +
+                                                 q(tmp / "stderr.txt")).c_str())) == 0);
+    std::ifstream profile_err(tmp / "stderr.txt");
+    std::string shown((std::istreambuf_iterator<char>(profile_err)), std::istreambuf_iterator<char>());
+    REQUIRE(shown.find("profile: device ") != std::string::npos);
+    REQUIRE(shown.find("ssd, ") != std::string::npos);
+    REQUIRE(shown.find("queue 3") != std::string::npos);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup --profile floppy " + paths + " 2>/dev/null").c_str())) == 1);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup --split 0 " + paths + " 2>/dev/null").c_str())) == 1);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode verify --split 4K " + paths).c_str())) == 0);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup --readahead lots " + paths + " 2>/dev/null").c_str())) == 1);
+    std::ofstream(tmp / "hd" / "CLI_V.txt") << "verify-me-again";
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup --readahead 1M " + paths + " 2>/dev/null").c_str())) == 0);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode verify --readahead 0 " + paths).c_str())) == 0);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("cli: --dry-run prints the plan and copies nothing; --plan runs it") {
+    require_cli_present();
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::temp_directory_path() / ("tp2_cli_dryrun_" + std::to_string(::getpid()));
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "CLI_D.txt") << "dry";
+    std::ofstream(tmp / "Backup.parm") << "CLI_D.txt\n";
+
+    auto q = [](const fs::path& p) { return std::string("\"") + p.string() + "\""; };
+    std::string paths = "--hd " + q(tmp / "hd") + " --pen " + q(tmp / "pen") + " --parm " + q(tmp / "Backup.parm");
+    std::string dry = "./bin/tp2_cli --mode backup --dry-run --plan-out " + q(tmp / "saved.plan") + " " + paths +
+                      " >" + q(tmp / "stdout.txt");
+    REQUIRE(exit_status_from_system(std::system(dry.c_str())) == 0);
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "CLI_D.txt"));
+    std::ifstream out(tmp / "stdout.txt");
+    std::string all((std::istreambuf_iterator<char>(out)), std::istreambuf_iterator<char>());
+    REQUIRE(all.find("copy") != std::string::npos);
+    REQUIRE(all.find("estimated:") != std::string::npos);
+    REQUIRE(all.find("plan: backup") != std::string::npos);
+
+    std::string restore = "./bin/tp2_cli --mode restore --dry-run " + paths + " >" + q(tmp / "restore.txt");
+    REQUIRE(exit_status_from_system(std::system(restore.c_str())) == 0);
+    std::ifstream restore_out(tmp / "restore.txt");
+    std::string restore_plan((std::istreambuf_iterator<char>(restore_out)), std::istreambuf_iterator<char>());
+    REQUIRE(restore_plan.find("plan: restore") != std::string::npos);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode verify --dry-run " + paths + " 2>/dev/null").c_str())) == 2);
+
+    std::string run = "./bin/tp2_cli --plan " + q(tmp / "saved.plan") + " --hd " + q(tmp / "hd") + " --pen " + q(tmp / "pen");
+    REQUIRE(exit_status_from_system(std::system((run + " --mode restore 2>/dev/null").c_str())) == 1);
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "CLI_D.txt"));
+    REQUIRE(exit_status_from_system(std::system((run + " --mode backup").c_str())) == 0);
+    REQUIRE(fs::exists(tmp / "pen" / "CLI_D.txt"));
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("cli: --pen may repeat to back up to several pens") {
+    require_cli_present();
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::temp_directory_path() / ("tp2_cli_multipen_" + std::to_string(::getpid()));
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen1");
+    fs::create_directories(tmp / "pen2");
+    std::ofstream(tmp / "hd" / "CLI_M.txt") << "twice";
+    std::ofstream(tmp / "Backup.parm") << "CLI_M.txt\n";
+
+    auto q = [](const fs::path& p) { return std::string("\"") + p.string() + "\""; };
+    std::string paths = "--hd " + q(tmp / "hd") + " --pen " + q(tmp / "pen1") + " --pen " + q(tmp / "pen2") +
+                        " --parm " + q(tmp / "Backup.parm");
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup " + paths + " 2>/dev/null").c_str())) == 0);
+    REQUIRE(fs::exists(tmp / "pen1" / "CLI_M.txt"));
+    REQUIRE(fs::exists(tmp / "pen2" / "CLI_M.txt"));
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup --dry-run " + paths + " 2>/dev/null").c_str())) == 1);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode restore " + paths + " 2>/dev/null").c_str())) == 2);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup --stripe --hd " + q(tmp / "hd") + " --pen " +
+                                                 q(tmp / "pen1") + " --parm " + q(tmp / "Backup.parm") + " 2>/dev/null").c_str())) == 1);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("cli: --job-file runs each job and prints its status") {
+    require_cli_present();
+    namespace fs = std::filesystem;
+    fs::path tmp = fs::temp_directory_path() / ("tp2_cli_jobs_" + std::to_string(::getpid()));
+    fs::remove_all(tmp);
+    for (const char* dir : {"hd", "pen1", "pen2"}) fs::create_directories(tmp / dir);
+    std::ofstream(tmp / "hd" / "CLI_J.txt") << "job";
+    std::ofstream(tmp / "Backup.parm") << "CLI_J.txt\n";
+    std::ofstream(tmp / "jobs.txt") << "um backup hd pen1 Backup.parm 2\ndois backup hd pen2 Backup.parm\n";
+
+    auto q = [](const fs::path& p) { return std::string("\"") + p.string() + "\""; };
+    const std::string out = (tmp / "out.txt").string();
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --job-file " + q(tmp / "jobs.txt") +
+                                                 " --jobs 2 --device-limit 1 > " + q(out) + " 2>/dev/null").c_str())) == 0);
+    REQUIRE(fs::exists(tmp / "pen1" / "CLI_J.txt"));
+    REQUIRE(fs::exists(tmp / "pen2" / "CLI_J.txt"));
+    std::ifstream in(out);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    REQUIRE(text.find("job um: 0 ok") != std::string::npos);
+    REQUIRE(text.find("job dois: 0 ok") != std::string::npos);
+
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --job-file " + q(tmp / "jobs.txt") + " --mode backup 2>/dev/null").c_str())) == 1);
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --mode backup --hd " + q(tmp / "hd") + " --pen " + q(tmp / "pen1") +
+                                                 " --device-limit 1 2>/dev/null").c_str())) == 1);
+    std::ofstream(tmp / "jobs.txt") << "um backup hd pen1 Backup.parm\ndois backup hd pen1/ Backup.parm\n";
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --job-file " + q(tmp / "jobs.txt") + " 2>/dev/null").c_str())) == 1);
+    fs::remove_all(tmp);
+}
+
 TEST_CASE("cli: help prints and exits 0") {
     require_cli_present();
     int rc = std::system("./bin/tp2_cli --help > /dev/null 2>&1");
     int ec = exit_status_from_system(rc);
     REQUIRE(ec == 0);
 }
+
+TEST_CASE("cli: --socket hands the run to a --daemon") {
+    require_cli_present();
+    fs::path tmp = fs::temp_directory_path() / ("tp2_cli_daemon_" + std::to_string(::getpid()));
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "CLI_D.txt") << "via daemon";
+    std::ofstream(tmp / "Backup.parm") << "CLI_D.txt\n";
+    auto q = [](const fs::path& p) { return std::string("\"") + p.string() + "\""; };
+    const fs::path sock = tmp / "tp2.sock";
+    const fs::path pidfile = tmp / "daemon.pid";
+
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --daemon " + q(sock) + " 2>/dev/null & echo $! > " +
+                                                 q(pidfile)).c_str())) == 0);
+    for (int i = 0; i < 300 && !fs::exists(sock); ++i) ::usleep(10000);
+    REQUIRE(fs::exists(sock));
+
+    // Relative paths are resolved by the client, so the daemon's own directory does not matter.
+    std::string run = "cd " + q(tmp) + " && " + fs::absolute("./bin/tp2_cli").string() +
+                      " --socket " + q(sock) + " --mode backup --hd hd --pen pen 2>/dev/null";
+    REQUIRE(exit_status_from_system(std::system(run.c_str())) == 0);
+    REQUIRE(fs::exists(tmp / "pen" / "CLI_D.txt"));
+    REQUIRE(exit_status_from_system(std::system(run.c_str())) == 0);
+    std::string missing = "./bin/tp2_cli --socket " + q(sock) + " --mode backup --hd " + q(tmp / "hd") + " --pen " +
+                          q(tmp / "pen") + " --parm " + q(tmp / "absent.parm") + " 2>/dev/null";
+    REQUIRE(exit_status_from_system(std::system(missing.c_str())) == 1);
+
+    // Limits change at once, for the runs that follow as well.
+    const std::string limits_out = (tmp / "limits.txt").string();
+    REQUIRE(exit_status_from_system(std::system(("./bin/tp2_cli --socket " + q(sock) + " --throttle --write-limit 64M --read-iops 500 > " +
+                                                 q(limits_out)).c_str())) == 0);
+    std::ifstream limits_in(limits_out);
+    std::string limits((std::istreambuf_iterator<char>(limits_in)), std::istreambuf_iterator<char>());
+    REQUIRE(limits.find("500 op/s") != std::string::npos);
+    REQUIRE(limits.find(std::to_string(64 * 1024 * 1024) + " B/s") != std::string::npos);
+    REQUIRE(exit_status_from_system(std::system(run.c_str())) == 0);
+    REQUIRE(exit_status_from_system(std::system("./bin/tp2_cli --throttle --bwlimit 1M 2>/dev/null")) == 1);
+
+    std::system(("kill $(cat " + q(pidfile) + ")").c_str());
+    for (int i = 0; i < 300 && fs::exists(sock); ++i) ::usleep(10000);
+    REQUIRE_FALSE(fs::exists(sock));
+    std::string gone = "./bin/tp2_cli --socket " + q(sock) + " --mode backup --hd hd --pen pen 2>/dev/null";
+    REQUIRE(exit_status_from_system(std::system(gone.c_str())) == 4);
+    fs::remove_all(tmp);
+}
@@ -0,0 +1,118 @@
+#include "catch.hpp"
+#include "compress.hpp"
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace tp2;
+
+namespace {
+std::string sample_text(std::size_t n) {
+    std::string s;
+    for (std::size_t i = 0; s.size() < n; ++i) s += "line " + std::to_string(i % 977) + ": the quick brown fox\n";
+    s.resize(n);
+    return s;
+}
+
+std::string random_text(std::size_t n, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::string s(n, '\0');
+    for (auto& c : s) c = static_cast<char>(gen());
+    return s;
+}
+
+bool lz4_round_trip(const std::string& raw) {
+    std::vector<char> packed(lz4_compress_bound(raw.size()));
+    std::size_t n = lz4_compress(raw.data(), raw.size(), packed.data(), packed.size());
+    if (n == 0) return false;
+    std::string back(raw.size(), '\0');
+    return lz4_decompress(packed.data(), n, &back[0], back.size()) && back == raw;
+}
+
+std::string compress_string(const std::string& raw, unsigned threads) {
+    std::istringstream in(raw);
+    std::ostringstream out;
+    REQUIRE(compress_stream(in, out, threads, [](const char*, std::size_t) {}));
+    return out.str();
+}
+
+std::string expand_string(const std::string& stored, bool& ok) {
+    std::istringstream in(stored);
+    std::string out;
+    ok = read_stored(in, [&](const char* p, std::size_t n) { out.append(p, n); return true; });
+    return out;
+}
+}
+
+TEST_CASE("compress: lz4 block round trip") {
+    REQUIRE(lz4_round_trip(""));
+    REQUIRE(lz4_round_trip("abc"));
+    REQUIRE(lz4_round_trip(std::string(100000, 'a')));       // long overlapping matches
+    REQUIRE(lz4_round_trip(sample_text(300000)));
+    REQUIRE(lz4_round_trip(random_text(70000, 7)));
+
+    std::string text = sample_text(100000);
+    std::vector<char> packed(lz4_compress_bound(text.size()));
+    std::size_t n = lz4_compress(text.data(), text.size(), packed.data(), packed.size());
+    REQUIRE(n < text.size() / 4);
+    // Too small an output buffer is reported, not overrun.
+    REQUIRE(lz4_compress(text.data(), text.size(), packed.data(), n / 2) == 0);
+}
+
+TEST_CASE("compress: corrupted lz4 input is rejected") {
+    std::string text = sample_text(50000);
+    std::vector<char> packed(lz4_compress_bound(text.size()));
+    std::size_t n = lz4_compress(text.data(), text.size(), packed.data(), packed.size());
+    std::string back(text.size(), '\0');
+    REQUIRE_FALSE(lz4_decompress(packed.data(), n - 3, &back[0], back.size()));
+    REQUIRE_FALSE(lz4_decompress(packed.data(), n, &back[0], back.size() - 1));
+}
+
+TEST_CASE("compress: pipeline keeps block order for any thread count") {
+    std::string raw = sample_text(3 * kFrameBlockSize + 12345) + random_text(kFrameBlockSize, 3);
+    for (unsigned threads : {1u, 2u, 4u}) {
+        std::string stored = compress_string(raw, threads);
+        REQUIRE(is_framed(stored.data(), stored.size()));
+        REQUIRE(stored.size() < raw.size());
+        bool ok = false;
+        REQUIRE(expand_string(stored, ok) == raw);
+        REQUIRE(ok);
+    }
+    bool ok = false;
+    REQUIRE(expand_string(compress_string("", 2), ok).empty());
+    REQUIRE(ok);
+}
+
+TEST_CASE("compress: frame_bound covers incompressible input") {
+    for (std::size_t n : {std::size_t{0}, std::size_t{1}, kFrameBlockSize, 2 * kFrameBlockSize + 1}) {
+        const std::string stored = compress_string(random_text(n, 7), 2);
+        REQUIRE(stored.size() <= frame_bound(n));
+    }
+    REQUIRE(frame_bound(kFrameBlockSize) == kFrameBlockSize + 20);
+}
+
+TEST_CASE("compress: unframed content passes through, truncated frames fail") {
+    bool ok = false;
+    REQUIRE(expand_string("plain bytes", ok) == "plain bytes");
+    REQUIRE(ok);
+    std::string stored = compress_string(sample_text(100000), 2);
+    expand_string(stored.substr(0, stored.size() - 10), ok);
+    REQUIRE_FALSE(ok);
+}
+
+TEST_CASE("compress: already-compressed formats are detected") {
+    REQUIRE(is_precompressed("fotos/IMG_001.JPG", "", 0));
+    REQUIRE(is_precompressed("a/b.tar.gz", "", 0));
+    REQUIRE(is_precompressed("noext", "PK\x03\x04", 4));
+    REQUIRE(is_precompressed("noext", "\xFF\xD8\xFF\xE0", 4));
+    REQUIRE_FALSE(is_precompressed("notes.txt", "hello", 5));
+    REQUIRE_FALSE(is_precompressed("dir.zip/notes", "hello", 5));
+
+    std::vector<char> frame;
+    std::string text = sample_text(10000);
+    REQUIRE(encode_frame(text.data(), text.size(), frame));
+    std::vector<char> back;
+    REQUIRE(decode_buffer(frame.data(), frame.size(), back));
+    REQUIRE(std::string(back.begin(), back.end()) == text);
+}
@@ -0,0 +1,84 @@
+#include "catch.hpp"
+#include "concurrency.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace tp2;
+
+namespace {
+// A device that serves `parallel` copies at full speed; beyond that, copies share its bandwidth.
+// Drives `threads` workers through the limit for `duration` and returns the settled limit.
+unsigned settle(unsigned parallel, unsigned threads, std::chrono::milliseconds duration) {
+    AdaptiveLimit limit(1, 16, 2);
+    std::atomic<unsigned> in_flight{0};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            while (!stop) {
+                limit.acquire();
+                const unsigned k = ++in_flight;
+                const double share = k > parallel ? static_cast<double>(k) / parallel : 1.0;
+                auto start = std::chrono::steady_clock::now();
+                std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long>(2000 * share)));
+                --in_flight;
+                limit.release(1024 * 1024,
+                              std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+        });
+    }
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto& w : workers) w.join();
+    return limit.limit();
+}
+}
+
+TEST_CASE("adaptive limit: grows on a parallel device, stays low on a serial one") {
+    const unsigned wide = settle(8, 16, std::chrono::milliseconds(1500));
+    const unsigned serial = settle(1, 16, std::chrono::milliseconds(1500));
+    INFO("wide " << wide << ", serial " << serial);
+    REQUIRE(wide >= 6);
+    REQUIRE(serial <= 4);
+    REQUIRE(serial < wide);
+}
+
+TEST_CASE("adaptive limit: failed copies free the slot without moving the limit") {
+    AdaptiveLimit limit(1, 4, 1);
+    for (int i = 0; i < 100; ++i) {
+        limit.acquire();
+        limit.release(0, 0.5);
+    }
+    REQUIRE(limit.limit() == 1);
+    REQUIRE(limit.peak() == 1);
+    REQUIRE(limit.throughput() == 0);
+}
+
+TEST_CASE("adaptive concurrency: one limit per device, slots taken once per device") {
+    AdaptiveConcurrency concurrency(4, 1);
+    {
+        AdaptiveConcurrency::Slot a(&concurrency, {7, 3, 7}); // 7 twice counts once
+        a.done(100);
+    }
+    // With a limit of 1, a second slot on device 3 must wait for the first.
+    std::atomic<bool> second_in{false};
+    std::thread other;
+    {
+        AdaptiveConcurrency::Slot first(&concurrency, {3});
+        other = std::thread([&] {
+            AdaptiveConcurrency::Slot second(&concurrency, {3, 9});
+            second_in = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        REQUIRE_FALSE(second_in);
+    }
+    other.join();
+    REQUIRE(second_in);
+    const auto devices = concurrency.devices();
+    REQUIRE(devices.size() == 3);
+    REQUIRE(devices[0].device == 3);
+    REQUIRE(devices[0].peak == 1);
+    AdaptiveConcurrency::Slot none(nullptr, {1, 2}); // no controller: no-op
+}
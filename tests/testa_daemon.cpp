@@ -0,0 +1,89 @@
+#include "catch.hpp"
+#include "daemon.hpp"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+TEST_CASE("daemon: requests round trip over the socket, one daemon per socket") {
+    fs::path tmp = fs::current_path() / "_tmp_daemon";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    const std::string socket = (tmp / "tp2.sock").string();
+
+    std::ostringstream out, err;
+    REQUIRE(send_request(socket, {"--mode", "backup"}, out, err).code == 4); // nobody listening yet
+
+    std::atomic<bool> stop{false};
+    int served = 0;
+    RequestHandler handler = [&](const std::vector<std::string>& args, std::ostream& o, std::ostream& e) {
+        ++served;
+        for (const auto& arg : args) o << '[' << arg << ']';
+        e << "err text\n";
+        return args.empty() ? 9 : static_cast<int>(args.size());
+    };
+    ActionResult served_res{-1, ""};
+    std::thread server([&] { served_res = serve_requests(socket, handler, stop); });
+    for (int i = 0; i < 200 && !fs::exists(socket); ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE((fs::status(socket).permissions() & (fs::perms::group_all | fs::perms::others_all)) == fs::perms::none);
+
+    ActionResult res = send_request(socket, {"--mode", "with space", ""}, out, err);
+    REQUIRE(res.code == 3);
+    REQUIRE(out.str() == "[--mode][with space][]");
+    REQUIRE(err.str() == "err text\n");
+    REQUIRE(send_request(socket, {}, out, err).code == 9);
+    REQUIRE(serve_requests(socket, handler, stop).code == 2); // already served
+
+    stop = true;
+    server.join();
+    REQUIRE(served_res.code == 0);
+    REQUIRE(served == 2);
+    REQUIRE_FALSE(fs::exists(socket));
+    REQUIRE(serve_requests(std::string(200, 'x'), handler, stop).code == 1);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("daemon: control requests are answered while a run is in progress") {
+    fs::path tmp = fs::current_path() / "_tmp_daemon_control";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    const std::string socket = (tmp / "tp2.sock").string();
+
+    std::atomic<bool> stop{false}, release{false}, running{false};
+    RequestHandler handler = [&](const std::vector<std::string>&, std::ostream& o, std::ostream&) {
+        running = true;
+        while (!release) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        o << "run done";
+        return 0;
+    };
+    RequestHandler control = [&](const std::vector<std::string>& args, std::ostream& o, std::ostream&) {
+        if (args.empty() || args[0] != "--throttle") return -1;
+        o << "limits changed";
+        release = true; // lets the run finish
+        return 0;
+    };
+    std::thread server([&] { serve_requests(socket, handler, stop, control); });
+    for (int i = 0; i < 200 && !fs::exists(socket); ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    std::ostringstream run_out, run_err;
+    ActionResult run_res{-1, ""};
+    std::thread client([&] { run_res = send_request(socket, {"--mode", "backup"}, run_out, run_err); });
+    for (int i = 0; i < 200 && !running; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(running);
+
+    std::ostringstream out, err;
+    REQUIRE(send_request(socket, {"--throttle"}, out, err).code == 0);
+    REQUIRE(out.str() == "limits changed");
+    client.join();
+    REQUIRE(run_res.code == 0);
+    REQUIRE(run_out.str() == "run done");
+
+    stop = true;
+    server.join();
+    fs::remove_all(tmp);
+}
@@ -0,0 +1,116 @@
+#include "catch.hpp"
+#include "device_profile.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+using namespace tp2;
+namespace fs = std::filesystem;
+
+namespace {
+// A fake sysfs whose dev/block/<maj>:<min> entry for `probe`'s device points at `target`
+// (relative to root/devices). Returns false when probe is not on a block device.
+bool fake_sysfs(const fs::path& root, const fs::path& probe, const std::string& target) {
+    struct stat st;
+    if (::stat(probe.c_str(), &st) != 0 || major(st.st_dev) == 0) return false;
+    fs::remove_all(root);
+    fs::create_directories(root / "dev" / "block");
+    fs::create_directories(root / "devices" / target);
+    fs::create_directory_symlink(root / "devices" / target,
+                                 root / "dev" / "block" /
+                                     (std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev))));
+    return true;
+}
+
+void put(const fs::path& file, const std::string& text) {
+    fs::create_directories(file.parent_path());
+    std::ofstream(file) << text << "\n";
+}
+}
+
+TEST_CASE("device profile: class read from sysfs, through partitions and dm devices") {
+    const fs::path probe = fs::current_path();
+    const fs::path root = probe / "_tmp_sysfs";
+    if (!fake_sysfs(root, probe, "pci0/usb1/1-1/block/sdb/sdb1")) {
+        WARN("working directory is not on a block device; skipped");
+        return;
+    }
+    put(root / "devices/pci0/usb1/1-1/block/sdb/sdb1/partition", "1");
+    put(root / "devices/pci0/usb1/1-1/block/sdb/removable", "0");
+    put(root / "devices/pci0/usb1/1-1/block/sdb/queue/rotational", "1");
+    REQUIRE(detect_device_class(probe.string(), root.string()) == DeviceClass::Removable); // on USB
+
+    fake_sysfs(root, probe, "pci0/nvme/block/nvme0n1");
+    put(root / "devices/pci0/nvme/block/nvme0n1/removable", "0");
+    put(root / "devices/pci0/nvme/block/nvme0n1/queue/rotational", "0");
+    REQUIRE(detect_device_class(probe.string(), root.string()) == DeviceClass::Ssd);
+
+    // LVM on a partition of a spinning disk.
+    fake_sysfs(root, probe, "virtual/block/dm-0");
+    put(root / "devices/pci0/ata/block/sda/sda2/partition", "2");
+    put(root / "devices/pci0/ata/block/sda/queue/rotational", "1");
+    put(root / "devices/virtual/block/dm-0/queue/rotational", "0");
+    fs::create_directories(root / "devices/virtual/block/dm-0/slaves");
+    fs::create_directory_symlink(root / "devices/pci0/ata/block/sda/sda2",
+                                 root / "devices/virtual/block/dm-0/slaves/sda2");
+    REQUIRE(detect_device_class(probe.string(), root.string()) == DeviceClass::Rotational);
+
+    fs::remove_all(root / "dev");
+    REQUIRE(detect_device_class(probe.string(), root.string()) == DeviceClass::Generic);
+    fs::remove_all(root);
+}
+
+TEST_CASE("device profile: class defaults, FAT as removable, overrides from the spec") {
+    REQUIRE(profile_for(DeviceClass::Generic, "ext4").fsync == FsyncPolicy::None);
+    REQUIRE(profile_for(DeviceClass::Generic, "vfat").device_class == DeviceClass::Removable);
+    REQUIRE(profile_for(DeviceClass::Removable, "exfat").direct_io);
+    REQUIRE(profile_for(DeviceClass::Rotational, "ext4").queue_depth == 2);
+    REQUIRE(mtime_granularity_ns("vfat") == 2000000000LL);
+    REQUIRE(mtime_granularity_ns("ext4") == 0);
+    REQUIRE(profile_for(DeviceClass::Ssd, "xfs").queue_depth > profile_for(DeviceClass::Removable, "xfs").queue_depth);
+
+    ProfileSpec spec;
+    std::string error;
+    REQUIRE(parse_profile_spec("ssd,buffer=512K,queue=3,fsync=file,direct=on", spec, error));
+    REQUIRE_FALSE(spec.detect);
+    REQUIRE(spec.device_class == DeviceClass::Ssd);
+    DeviceProfiles profiles(spec);
+    const DeviceProfile& p = profiles.for_path(fs::current_path().string());
+    REQUIRE(p.buffer_size == 512 * 1024);
+    REQUIRE(p.queue_depth == 3);
+    REQUIRE(p.fsync == FsyncPolicy::File);
+    REQUIRE(p.direct_io);
+    REQUIRE(&profiles.for_path((fs::current_path() / "not" / "there").string()) == &p); // same device
+    REQUIRE(profiles.devices().size() == 1);
+    REQUIRE(describe_profile(p).find("ssd, ") == 0);
+
+    REQUIRE(parse_profile_spec("auto", spec, error));
+    REQUIRE(spec.detect);
+    REQUIRE_FALSE(parse_profile_spec("floppy", spec, error));
+    REQUIRE_FALSE(parse_profile_spec("auto,fsync=sometimes", spec, error));
+    REQUIRE_FALSE(parse_profile_spec("auto,queue=0", spec, error));
+    REQUIRE_FALSE(parse_profile_spec("", spec, error));
+}
+
+TEST_CASE("device profile: erase-block coalescing on usb, set or turned off from the spec") {
+    REQUIRE(profile_for(DeviceClass::Removable, "vfat").erase_block == 4 * 1024 * 1024);
+    REQUIRE(profile_for(DeviceClass::Ssd, "ext4").erase_block == 0);
+    REQUIRE(describe_profile(profile_for(DeviceClass::Removable, "vfat")).find("erase 4096 KiB") != std::string::npos);
+    REQUIRE(describe_profile(profile_for(DeviceClass::Ssd, "ext4")).find("erase off") != std::string::npos);
+
+    ProfileSpec spec;
+    std::string error;
+    REQUIRE(parse_profile_spec("usb,erase=off", spec, error));
+    REQUIRE(DeviceProfiles(spec).for_path(fs::current_path().string()).erase_block == 0);
+    REQUIRE(parse_profile_spec("hdd,erase=1M", spec, error));
+    DeviceProfiles profiles(spec);
+    REQUIRE(profiles.for_path(fs::current_path().string()).erase_block == 1024 * 1024);
+    // One gate per device.
+    REQUIRE(&profiles.write_gate(fs::current_path().string()) ==
+            &profiles.write_gate((fs::current_path() / "not" / "there").string()));
+    REQUIRE_FALSE(parse_profile_spec("usb,erase=4K", spec, error));     // below 64 KiB
+    REQUIRE_FALSE(parse_profile_spec("usb,erase=100000", spec, error)); // not whole pages
+    REQUIRE_FALSE(parse_profile_spec("usb,erase=on", spec, error));
+}
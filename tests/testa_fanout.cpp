@@ -0,0 +1,80 @@
+#include "catch.hpp"
+#include "fanout.hpp"
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+namespace {
+std::string read_all(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+}
+
+TEST_CASE("fanout: every destination gets the same bytes, a failed one is dropped") {
+    fs::path tmp = fs::current_path() / "_tmp_fanout";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    std::string data;
+    for (int i = 0; data.size() < 3 * 1024 * 1024; ++i) data += "bloco " + std::to_string(i) + "\n";
+
+    for (bool threaded : {true, false}) {
+        std::vector<std::string> dsts = {(tmp / "a.out").string(), (tmp / "missing-dir" / "b.out").string(),
+                                         (tmp / "c.out").string()};
+        FanoutSink sink(dsts, threaded);
+        REQUIRE(sink.size() == 3);
+        // Uneven block sizes, many more blocks than a queue holds.
+        for (std::size_t pos = 0; pos < data.size(); pos += 10007) {
+            sink.write(data.data() + pos, std::min<std::size_t>(10007, data.size() - pos));
+        }
+        REQUIRE(sink.finish());
+        REQUIRE(sink.ok(0));
+        REQUIRE_FALSE(sink.ok(1));
+        REQUIRE(sink.ok(2));
+        REQUIRE(read_all(tmp / "a.out") == data);
+        REQUIRE(read_all(tmp / "c.out") == data);
+    }
+
+    FanoutSink none({(tmp / "missing-dir" / "x").string()}, true);
+    none.write("x", 1);
+    REQUIRE_FALSE(none.finish());
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("fanout: a destination failing mid-run does not stall the reader on its full queue") {
+    fs::path tmp = fs::current_path() / "_tmp_fanout_fail";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    // A pipe nobody reads: its writer blocks until the queue is full, then fails with EPIPE
+    // once the read end goes away.
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    auto previous = std::signal(SIGPIPE, SIG_IGN);
+    std::thread closer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        ::close(fds[0]);
+    });
+    const std::string block(64 * 1024, 'z');
+    const std::size_t blocks = 4 * FanoutSink::kMaxQueued;
+    {
+        FanoutSink sink({"/proc/self/fd/" + std::to_string(fds[1]), (tmp / "ok.out").string()}, true);
+        for (std::size_t k = 0; k < blocks; ++k) sink.write(block.data(), block.size());
+        REQUIRE(sink.finish());
+        REQUIRE_FALSE(sink.ok(0));
+        REQUIRE(sink.ok(1));
+    }
+    closer.join();
+    ::close(fds[1]);
+    std::signal(SIGPIPE, previous);
+    REQUIRE(fs::file_size(tmp / "ok.out") == blocks * block.size());
+    fs::remove_all(tmp);
+}
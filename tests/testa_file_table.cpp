@@ -0,0 +1,115 @@
+#include "catch.hpp"
+#include "file_table.hpp"
+#include "plan.hpp"
+
+using namespace tp2;
+
+namespace {
+// Fill row i with one synthetic entry; absent sides keep zeroed columns.
+void set_row(FileTable& t, std::size_t i, std::uint8_t flags,
+             std::int64_t hd_mtime, std::uint64_t hd_size,
+             std::int64_t pen_mtime, std::uint64_t pen_size) {
+    t.flags[i] = flags;
+    t.hd_mtime[i] = hd_mtime;
+    t.hd_size[i] = hd_size;
+    t.pen_mtime[i] = pen_mtime;
+    t.pen_size[i] = pen_size;
+}
+
+PlanAction action_of(const FileTable& t, std::size_t i) { return static_cast<PlanAction>(t.action[i]); }
+
+FileTable sample() {
+    FileTable t;
+    t.resize(7);
+    const std::uint8_t both = FileTable::HdExists | FileTable::PenExists;
+    set_row(t, 0, FileTable::HdExists, 10, 100, 0, 0);      // only on hd
+    set_row(t, 1, FileTable::PenExists, 0, 0, 10, 200);     // only on pen
+    set_row(t, 2, both, 20, 300, 10, 30);                   // hd newer
+    set_row(t, 3, both, 10, 40, 20, 400);                   // pen newer
+    set_row(t, 4, both, 10, 50, 10, 50);                    // equal
+    set_row(t, 5, 0, 0, 0, 0, 0);                           // nowhere
+    set_row(t, 6, FileTable::HdExists | FileTable::HdDir | FileTable::PenExists | FileTable::PenDir, 30, 0, 10, 0);
+    return t;
+}
+}
+
+TEST_CASE("file_table: resize gives zeroed input columns") {
+    FileTable t;
+    t.resize(3);
+    REQUIRE(t.size() == 3);
+    REQUIRE(t.hd_size.size() == 3);
+    REQUIRE(t.pen_mtime.size() == 3);
+    for (std::size_t i = 0; i < t.size(); ++i) REQUIRE(t.flags[i] == 0);
+}
+
+TEST_CASE("file_table: backup classification") {
+    FileTable t = sample();
+    classify_table(t, Operation::Backup);
+    REQUIRE(action_of(t, 0) == PlanAction::Copy);
+    REQUIRE(t.bytes[0] == 100);
+    REQUIRE(action_of(t, 1) == PlanAction::Missing);
+    REQUIRE(action_of(t, 2) == PlanAction::Update);
+    REQUIRE(t.bytes[2] == 300);
+    REQUIRE(action_of(t, 3) == PlanAction::Skip);
+    REQUIRE(t.bytes[3] == 0);
+    REQUIRE(action_of(t, 4) == PlanAction::Skip);
+    REQUIRE(action_of(t, 5) == PlanAction::Missing);
+    REQUIRE(action_of(t, 6) == PlanAction::Skip);
+    for (std::size_t i = 0; i < t.size(); ++i) REQUIRE(t.to_hd[i] == 0);
+}
+
+TEST_CASE("file_table: restore classification") {
+    FileTable t = sample();
+    classify_table(t, Operation::Restore);
+    REQUIRE(action_of(t, 0) == PlanAction::Missing);
+    REQUIRE(action_of(t, 1) == PlanAction::Copy);
+    REQUIRE(t.bytes[1] == 200);
+    REQUIRE(action_of(t, 2) == PlanAction::Skip);
+    REQUIRE(action_of(t, 3) == PlanAction::Update);
+    REQUIRE(t.bytes[3] == 400);
+    REQUIRE(action_of(t, 4) == PlanAction::Skip);
+    REQUIRE(t.to_hd[3] == 1);
+}
+
+TEST_CASE("file_table: sync picks the newer side per entry") {
+    FileTable t = sample();
+    classify_table(t, Operation::Sync);
+    REQUIRE(action_of(t, 0) == PlanAction::Copy);
+    REQUIRE(t.to_hd[0] == 0);
+    REQUIRE(action_of(t, 1) == PlanAction::Copy);
+    REQUIRE(t.to_hd[1] == 1);
+    REQUIRE(action_of(t, 2) == PlanAction::Update);
+    REQUIRE(t.to_hd[2] == 0);
+    REQUIRE(t.bytes[2] == 300);
+    REQUIRE(action_of(t, 3) == PlanAction::Update);
+    REQUIRE(t.to_hd[3] == 1);
+    REQUIRE(t.bytes[3] == 400);
+    REQUIRE(action_of(t, 4) == PlanAction::Skip);
+    REQUIRE(action_of(t, 5) == PlanAction::Missing);
+    REQUIRE(action_of(t, 6) == PlanAction::Skip);
+}
+
+TEST_CASE("file_table: mtimes within the slack are equal unless the sizes differ") {
+    const std::int64_t s = 2000000000LL; // FAT
+    const std::uint8_t both = FileTable::HdExists | FileTable::PenExists;
+    FileTable t;
+    t.resize(5);
+    set_row(t, 0, both, 10 * s, 50, 10 * s - s / 2, 50); // pen rounded down, same size
+    set_row(t, 1, both, 10 * s, 60, 10 * s - s / 2, 61); // rounded, but the size changed
+    set_row(t, 2, both, 10 * s, 70, 8 * s, 70);          // beyond the slack
+    set_row(t, 3, both, 10 * s, 80, 10 * s + s / 2, 80); // pen a little ahead
+    set_row(t, 4, both, 10 * s, 90, 10 * s, 91);         // equal mtimes never copy
+    classify_table(t, Operation::Backup, s);
+    REQUIRE(action_of(t, 0) == PlanAction::Skip);
+    REQUIRE(action_of(t, 1) == PlanAction::Update);
+    REQUIRE(action_of(t, 2) == PlanAction::Update);
+    REQUIRE(action_of(t, 3) == PlanAction::Skip);
+    REQUIRE(action_of(t, 4) == PlanAction::Skip);
+    classify_table(t, Operation::Sync, s);
+    REQUIRE(action_of(t, 0) == PlanAction::Skip);
+    REQUIRE(action_of(t, 3) == PlanAction::Skip);
+    REQUIRE(action_of(t, 1) == PlanAction::Update);
+    REQUIRE(t.to_hd[1] == 0);
+    classify_table(t, Operation::Backup);
+    REQUIRE(action_of(t, 0) == PlanAction::Update); // no slack: the old rule
+}
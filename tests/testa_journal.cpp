@@ -0,0 +1,60 @@
+#include "catch.hpp"
+#include "journal.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+TEST_CASE("journal: records round trip and the last record of a path wins") {
+    fs::path tmp = fs::current_path() / "_tmp_journal";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    const std::string pen = tmp.string();
+    {
+        RunJournal journal(pen);
+        REQUIRE_FALSE(journal.load());
+        REQUIRE(journal.open());
+        journal.begin("dir/big file.bin", false, 111, 5000);
+        journal.checkpoint("dir/big file.bin", 4096);
+        journal.begin("done.txt", false, 222, 3);
+        journal.done("done.txt", false, ManifestEntry{3, 222, 0xabcdefULL});
+        journal.begin("restored.txt", true, 333, 9);
+        journal.done("restored.txt", true, ManifestEntry{});
+    }
+    // A crash mid-write leaves a torn last line behind.
+    std::ofstream(tmp / RunJournal::kFileName, std::ios::app) << "D p 00000000";
+
+    RunJournal journal(pen);
+    REQUIRE(journal.load());
+    REQUIRE(journal.entries().size() == 3);
+    REQUIRE(journal.has_pending());
+    JournalEntry e;
+    REQUIRE(journal.find("dir/big file.bin", e));
+    REQUIRE_FALSE(e.done);
+    REQUIRE_FALSE(e.to_hd);
+    REQUIRE(e.src_mtime_ns == 111);
+    REQUIRE(e.src_size == 5000);
+    REQUIRE(e.offset == 4096);
+    REQUIRE(journal.find("done.txt", e));
+    REQUIRE(e.done);
+    REQUIRE(e.record.hash == 0xabcdefULL);
+    REQUIRE(e.record.mtime_ns == 222);
+    REQUIRE(journal.find("restored.txt", e));
+    REQUIRE(e.to_hd);
+
+    // finish() keeps only the unfinished copy, with its checkpoint.
+    REQUIRE(journal.finish());
+    RunJournal reread(pen);
+    REQUIRE(reread.load());
+    REQUIRE(reread.entries().size() == 1);
+    REQUIRE(reread.find("dir/big file.bin", e));
+    REQUIRE(e.offset == 4096);
+
+    reread.done("dir/big file.bin", false, ManifestEntry{5000, 111, 1});
+    REQUIRE(reread.finish());
+    REQUIRE_FALSE(fs::exists(tmp / RunJournal::kFileName));
+
+    fs::remove_all(tmp);
+}
@@ -0,0 +1,67 @@
+#include "catch.hpp"
+#include "pack_store.hpp"
+#include "fsutil.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+namespace {
+std::string read_all(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+}
+
+TEST_CASE("pack_store: append, index round trip and extract") {
+    fs::path tmp = fs::current_path() / "_tmp_pack_store";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "a.txt") << "alpha";
+    std::ofstream(tmp / "b.txt") << std::string(300000, 'b'); // larger than one I/O buffer
+    std::ofstream(tmp / "empty.txt").close();
+
+    const std::string pen = (tmp / "pen").string();
+    {
+        PackStore packs(pen);
+        REQUIRE_FALSE(packs.load());
+        ManifestEntry rec;
+        REQUIRE(packs.append("a.txt", (tmp / "a.txt").string(), 111, &rec));
+        REQUIRE(rec.size == 5);
+        REQUIRE(packs.append("dir with space/b.txt", (tmp / "b.txt").string(), 222));
+        REQUIRE(packs.append("empty.txt", (tmp / "empty.txt").string(), 333));
+        REQUIRE(packs.dirty());
+        REQUIRE(packs.save());
+    }
+
+    PackStore packs(pen);
+    REQUIRE(packs.load());
+    REQUIRE(packs.size() == 3);
+    PackEntry a, b;
+    REQUIRE(packs.find("a.txt", a));
+    REQUIRE(packs.find("dir with space/b.txt", b));
+    REQUIRE(a.pack == b.pack);
+    REQUIRE(b.offset == a.offset + a.length); // appended back to back
+    REQUIRE(fs::file_size(packs.pack_path(a.pack)) == 5 + 300000);
+
+    REQUIRE(packs.extract(b, (tmp / "b.out").string()));
+    REQUIRE(read_all(tmp / "b.out") == read_all(tmp / "b.txt"));
+    REQUIRE(stat_path((tmp / "b.out").string()).mtime_ns == 222);
+
+    std::string got;
+    REQUIRE(packs.read(a, [&](const char* p, std::size_t n) { got.append(p, n); return true; }));
+    REQUIRE(got == "alpha");
+
+    PackEntry e;
+    REQUIRE(packs.find("empty.txt", e));
+    REQUIRE(packs.extract(e, (tmp / "empty.out").string()));
+    REQUIRE(fs::file_size(tmp / "empty.out") == 0);
+
+    REQUIRE(packs.erase("a.txt"));
+    REQUIRE_FALSE(packs.erase("a.txt"));
+    REQUIRE((packs.paths() == std::vector<std::string>{"dir with space/b.txt", "empty.txt"}));
+
+    fs::remove_all(tmp);
+}
@@ -0,0 +1,66 @@
+#include "catch.hpp"
+#include "path_arena.hpp"
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace tp2;
+
+TEST_CASE("path_arena: round trip across restart points") {
+    PathArena arena;
+    std::vector<std::string> paths;
+    char buf[64];
+    for (int i = 0; i < 100; ++i) {
+        std::snprintf(buf, sizeof(buf), "dir%d/sub/file_%03d.txt", i / 30, i);
+        paths.emplace_back(buf);
+    }
+    paths.emplace_back("");          // empty suffix right after a long path
+    paths.emplace_back("a");
+    paths.emplace_back("dir with space/ção.txt");
+    for (const auto& p : paths) arena.add(p);
+
+    REQUIRE(arena.size() == paths.size());
+    std::string out;
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        arena.get(static_cast<PathArena::Id>(i), out);
+        REQUIRE(out == paths[i]);
+    }
+    // Decoding out of order must not depend on the previous call.
+    REQUIRE(arena.str(47) == paths[47]);
+    REQUIRE(arena.str(16) == paths[16]);
+    REQUIRE(arena.str(15) == paths[15]);
+}
+
+TEST_CASE("path_arena: join builds base/path in the given buffer") {
+    PathArena arena;
+    arena.add("docs/a.txt");
+    arena.add("docs/b.txt");
+    std::string out = "leftover";
+    arena.join("/mnt/pen", 1, out);
+    REQUIRE(out == "/mnt/pen/docs/b.txt");
+    arena.join("hd", 0, out);
+    REQUIRE(out == "hd/docs/a.txt");
+}
+
+TEST_CASE("path_arena: shared prefixes are stored once") {
+    PathArena arena;
+    std::size_t raw = 0;
+    char buf[64];
+    for (int i = 0; i < 10000; ++i) {
+        std::snprintf(buf, sizeof(buf), "projects/tp2/src/module_%02d/file_%06d.txt", i / 500, i);
+        raw += std::string(buf).size();
+        arena.add(buf);
+    }
+    arena.shrink_to_fit();
+    REQUIRE(arena.bytes_used() * 4 < raw);
+    REQUIRE(arena.str(9999) == "projects/tp2/src/module_19/file_009999.txt");
+}
+
+TEST_CASE("path_arena: invalid id throws") {
+    PathArena arena;
+    REQUIRE(arena.empty());
+    REQUIRE_THROWS_AS(arena.str(0), const std::out_of_range&);
+    arena.add("x");
+    REQUIRE_THROWS_AS(arena.str(1), const std::out_of_range&);
+}
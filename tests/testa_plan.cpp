@@ -0,0 +1,105 @@
+#include "catch.hpp"
+#include "plan.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+static const PlanEntry* find_entry(const BackupPlan& plan, const std::string& path) {
+    for (const auto& e : plan.entries) if (plan.path_of(e) == path) return &e;
+    return nullptr;
+}
+
+TEST_CASE("plan: dry run classifies entries and writes nothing") {
+    using namespace std::chrono_literals;
+    fs::path tmp = fs::current_path() / "_tmp_plan_dry";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd");
+    fs::create_directories(tmp / "pen");
+    auto now = fs::file_time_type::clock::now();
+
+    std::ofstream(tmp / "hd" / "NEW.txt") << std::string(1000, 'n');
+    std::ofstream(tmp / "hd" / "UPD.txt") << std::string(300, 'u');
+    std::ofstream(tmp / "pen" / "UPD.txt") << "old";
+    fs::last_write_time(tmp / "hd" / "UPD.txt", now);
+    fs::last_write_time(tmp / "pen" / "UPD.txt", now - 2s);
+    std::ofstream(tmp / "hd" / "SAME.txt") << "same";
+    std::ofstream(tmp / "pen" / "SAME.txt") << "same";
+    fs::last_write_time(tmp / "hd" / "SAME.txt", now - 5s);
+    fs::last_write_time(tmp / "pen" / "SAME.txt", now - 5s);
+    std::ofstream(tmp / "Backup.parm") << "NEW.txt\nUPD.txt\nSAME.txt\nGONE.txt\n";
+
+    BackupPlan plan;
+    auto r = plan_backup((tmp / "hd").string(), (tmp / "pen").string(), (tmp / "Backup.parm").string(),
+                         Operation::Backup, BackupOptions{}, plan);
+    REQUIRE(r.code == 0);
+    REQUIRE(plan.entries.size() == 4);
+    REQUIRE(find_entry(plan, "NEW.txt")->action == PlanAction::Copy);
+    REQUIRE(find_entry(plan, "NEW.txt")->bytes == 1000);
+    REQUIRE(find_entry(plan, "UPD.txt")->action == PlanAction::Update);
+    REQUIRE(find_entry(plan, "SAME.txt")->action == PlanAction::Skip);
+    REQUIRE(find_entry(plan, "GONE.txt")->action == PlanAction::Missing);
+    REQUIRE(plan.bytes_to_pen == 1300);
+    REQUIRE(plan.pen_write_bps == Approx(kDefaultThroughputBps));
+    REQUIRE(plan.estimated_seconds == Approx(1300.0 / kDefaultThroughputBps));
+
+    // Planning touched nothing on the pen
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "NEW.txt"));
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / ".tp2_manifest"));
+    REQUIRE(format_plan(plan).find("missing") != std::string::npos);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("plan: saved plan round-trips and executes directly") {
+    fs::path tmp = fs::current_path() / "_tmp_plan_saved";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "hd" / "dir with space");
+    fs::create_directories(tmp / "pen");
+    std::ofstream(tmp / "hd" / "dir with space" / "A B.txt") << std::string(200000, 'a');
+    std::ofstream(tmp / "pen" / "STALE.txt") << "stale";
+    std::ofstream(tmp / "Backup.parm") << "dir with space/A B.txt\n";
+    auto hd = (tmp / "hd").string();
+    auto pen = (tmp / "pen").string();
+
+    BackupPlan plan;
+    REQUIRE(plan_backup(hd, pen, (tmp / "Backup.parm").string(), Operation::Mirror, BackupOptions{}, plan).code == 0);
+    REQUIRE(save_plan(plan, (tmp / "run.plan").string()));
+
+    BackupPlan loaded;
+    REQUIRE(load_plan((tmp / "run.plan").string(), loaded));
+    REQUIRE(loaded.op == Operation::Mirror);
+    REQUIRE(loaded.entries.size() == 2);
+    REQUIRE(find_entry(loaded, "dir with space/A B.txt")->action == PlanAction::Copy);
+    REQUIRE(find_entry(loaded, "STALE.txt")->action == PlanAction::Delete);
+
+    auto r = execute_plan(hd, pen, loaded, BackupOptions{});
+    REQUIRE(r.code == 0);
+    REQUIRE(fs::file_size(tmp / "pen" / "dir with space" / "A B.txt") == 200000);
+    REQUIRE_FALSE(fs::exists(tmp / "pen" / "STALE.txt"));
+
+    // The measured throughput now feeds the next estimate
+    ThroughputStats stats = load_throughput_stats(pen);
+    REQUIRE(stats.pen_write_bps > 0);
+    BackupPlan next;
+    REQUIRE(plan_backup(hd, pen, (tmp / "Backup.parm").string(), Operation::Backup, BackupOptions{}, next).code == 0);
+    REQUIRE(next.pen_write_bps == Approx(stats.pen_write_bps));
+    REQUIRE(find_entry(next, "dir with space/A B.txt")->action == PlanAction::Skip);
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("plan: invalid plan files are rejected") {
+    fs::path tmp = fs::current_path() / "_tmp_plan_invalid";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    BackupPlan plan;
+    REQUIRE_FALSE(load_plan((tmp / "none.plan").string(), plan));
+    std::ofstream(tmp / "bad.plan") << "op backup\nexplode pen 1 x\n";
+    REQUIRE_FALSE(load_plan((tmp / "bad.plan").string(), plan));
+    std::ofstream(tmp / "noop.plan") << "copy pen 1 x\n";
+    REQUIRE_FALSE(load_plan((tmp / "noop.plan").string(), plan));
+    fs::remove_all(tmp);
+}
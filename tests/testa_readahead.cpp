@@ -0,0 +1,91 @@
+#include "catch.hpp"
+#include "readahead.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+using namespace tp2;
+namespace fs = std::filesystem;
+
+namespace {
+// Wait (up to 5 s) for the reader to have prefetched n files.
+bool wait_files(const Readahead& ahead, std::uint64_t n) {
+    for (int k = 0; k < 5000 && ahead.stats().files < n; ++k) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return ahead.stats().files >= n;
+}
+
+std::vector<Readahead::Item> make_files(const fs::path& dir, std::size_t count, std::size_t size) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    std::vector<Readahead::Item> items;
+    for (std::size_t i = 0; i < count; ++i) {
+        const fs::path file = dir / ("f" + std::to_string(i));
+        std::ofstream(file) << std::string(size, 'x');
+        items.push_back({file.string(), size});
+    }
+    return items;
+}
+}
+
+TEST_CASE("readahead: stays within the byte budget and runs ahead of slow copies") {
+    const fs::path tmp = fs::current_path() / "_tmp_readahead";
+    auto items = make_files(tmp, 10, 1000);
+    items.push_back({(tmp / "missing").string(), 0}); // not a copy: nothing to read
+    Readahead ahead(3000);
+    {
+        Readahead::Pass pass(&ahead, items);
+        for (std::size_t i = 0; i < 10; ++i) {
+            REQUIRE(wait_files(ahead, i + 1));
+            pass.started(i);
+            pass.finished(i);
+        }
+        pass.started(10);
+        pass.finished(10);
+    }
+    const auto s = ahead.stats();
+    REQUIRE(s.files == 10);
+    REQUIRE(s.bytes == 10000);
+    REQUIRE(s.hits == 10);
+    REQUIRE(s.peak_files <= 3);
+    REQUIRE(s.peak_bytes <= 3000);
+    REQUIRE(s.queued_files == 0);
+    REQUIRE(s.queued_bytes == 0);
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("readahead: skips files the copies took first and caps large ones at the budget") {
+    const fs::path tmp = fs::current_path() / "_tmp_readahead_skip";
+    auto items = make_files(tmp, 3, 5000);
+    Readahead ahead(1000);
+    {
+        Readahead::Pass pass(&ahead, items);
+        REQUIRE(wait_files(ahead, 1)); // file 0 fills the queue
+        pass.started(1);               // a copy gets to file 1 before the reader
+        pass.started(0);
+        pass.finished(0);
+        REQUIRE(wait_files(ahead, 2));
+        pass.finished(1);
+        pass.started(2);
+        pass.finished(2);
+    }
+    const auto s = ahead.stats();
+    REQUIRE(s.files == 2); // 0 and 2
+    REQUIRE(s.bytes == 2000);
+    REQUIRE(s.hits == 2);
+    REQUIRE(s.queued_bytes == 0);
+
+    // A pass left with copies unfinished gives its bytes back; a null owner does nothing.
+    {
+        Readahead::Pass pass(&ahead, items);
+        REQUIRE(wait_files(ahead, 3));
+    }
+    REQUIRE(ahead.stats().queued_files == 0);
+    Readahead::Pass none(nullptr, items);
+    none.started(0);
+    none.finished(0);
+    fs::remove_all(tmp);
+}
@@ -0,0 +1,126 @@
+#include "catch.hpp"
+#include "scheduler.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+TEST_CASE("job file: fields, quotes, weights and relative paths") {
+    fs::path tmp = fs::current_path() / "_tmp_job_file";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    const auto file = (tmp / "jobs.txt").string();
+    std::ofstream(file) << "# nome modo hd pen parm [peso]\n"
+                           "\n"
+                           "fotos backup /home/u/fotos /media/pen1 fotos.parm 3\n"
+                           "; comentário\n"
+                           "docs mirror \"/home/u/meus docs\" /media/pen2 /etc/docs.parm\n";
+    std::vector<Job> jobs;
+    std::string error;
+    REQUIRE(load_jobs(file, jobs, error));
+    REQUIRE(jobs.size() == 2);
+    REQUIRE(jobs[0].name == "fotos");
+    REQUIRE(jobs[0].op == Operation::Backup);
+    REQUIRE(jobs[0].weight == 3);
+    REQUIRE(jobs[0].parm == (tmp / "fotos.parm").string());
+    REQUIRE(jobs[1].op == Operation::Mirror);
+    REQUIRE(jobs[1].hd == "/home/u/meus docs");
+    REQUIRE(jobs[1].parm == "/etc/docs.parm");
+    REQUIRE(jobs[1].weight == 1);
+
+    const std::pair<const char*, const char*> bad[] = {
+        {"a backup /h /p x.parm\nb backup /h /p/ y.parm\n", "already used"},
+        {"a backup /h /p1 x.parm\na backup /h /p2 x.parm\n", "duplicate job name"},
+        {"a copy /h /p x.parm\n", "unknown mode"},
+        {"a backup /h /p x.parm 0\n", "invalid weight"},
+        {"a backup /h /p x.parm -2\n", "invalid weight"},
+        {"a backup /h /p\n", "expected"},
+        {"a backup \"/h /p x.parm\n", "unterminated"},
+        {"# nada\n", "no jobs"},
+    };
+    for (const auto& b : bad) {
+        std::ofstream(file) << b.first;
+        REQUIRE_FALSE(load_jobs(file, jobs, error));
+        INFO(error);
+        REQUIRE(error.find(b.second) != std::string::npos);
+    }
+    REQUIRE_FALSE(load_jobs((tmp / "missing.txt").string(), jobs, error));
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("fair scheduler: dispatch follows the weights") {
+    FairScheduler scheduler(0);
+    const auto heavy = scheduler.add_flow(3, {1, 2});
+    const auto light = scheduler.add_flow(1, {3, 4});
+    for (std::size_t i = 0; i < 400; ++i) {
+        scheduler.push(heavy, i, 1024 * 1024);
+        scheduler.push(light, i, 1024 * 1024);
+    }
+    // While both have work, the heavier flow gets three items for each of the lighter one.
+    std::size_t counts[2] = {0, 0};
+    std::size_t flow = 0, item = 0, expected_item[2] = {0, 0};
+    for (int n = 0; n < 400; ++n) {
+        REQUIRE(scheduler.next(flow, item));
+        REQUIRE(item == expected_item[flow]++); // each flow keeps its order
+        ++counts[flow];
+        scheduler.done(flow);
+    }
+    REQUIRE(counts[heavy] >= 295);
+    REQUIRE(counts[heavy] <= 305);
+
+    // A flow that idled gets no banked credit: it competes from the current clock.
+    const auto late = scheduler.add_flow(1, {5});
+    for (std::size_t i = 0; i < 10; ++i) scheduler.push(late, i, 1024 * 1024);
+    std::size_t late_count = 0;
+    for (int n = 0; n < 20; ++n) {
+        REQUIRE(scheduler.next(flow, item));
+        late_count += flow == late;
+        scheduler.done(flow);
+    }
+    REQUIRE(late_count <= 5);
+    while (scheduler.next(flow, item)) scheduler.done(flow);
+    REQUIRE(scheduler.busy_seconds(heavy) >= 0);
+    REQUIRE_FALSE(scheduler.next(flow, item));
+}
+
+TEST_CASE("fair scheduler: a busy device holds only its own flows") {
+    FairScheduler scheduler(1);
+    const auto a = scheduler.add_flow(1, {7, 8}); // two jobs on the same pen device 8
+    const auto b = scheduler.add_flow(1, {9, 8});
+    const auto c = scheduler.add_flow(1, {10, 11});
+    for (std::size_t i = 0; i < 3; ++i) {
+        scheduler.push(a, i, 100);
+        scheduler.push(b, i, 100);
+        scheduler.push(c, i, 100);
+    }
+    std::size_t flow = 0, item = 0;
+    REQUIRE(scheduler.next(flow, item));
+    const std::size_t first = flow;
+    REQUIRE(first != c);
+    // Device 8 is taken: the next item must come from the flow on other devices.
+    std::size_t second = 0;
+    REQUIRE(scheduler.next(second, item));
+    REQUIRE(second == c);
+
+    // A third caller waits until device 8 is released.
+    std::size_t third = 99;
+    std::thread waiter([&] {
+        std::size_t it = 0;
+        if (scheduler.next(third, it)) scheduler.done(third);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    scheduler.done(second); // frees device 10/11: c may run again, never a or b
+    waiter.join();
+    REQUIRE(third == c);
+    scheduler.done(first);
+    std::size_t dispatched = 3;
+    while (scheduler.next(flow, item)) {
+        scheduler.done(flow);
+        ++dispatched;
+    }
+    REQUIRE(dispatched == 9);
+}
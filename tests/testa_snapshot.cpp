@@ -0,0 +1,166 @@
+#include "catch.hpp"
+#include "snapshot.hpp"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+namespace {
+CatalogRow file(const std::string& path, std::int64_t mtime, std::uint64_t size) {
+    CatalogRow r;
+    r.path = path;
+    r.mtime_ns = mtime;
+    r.size = size;
+    return r;
+}
+}
+
+TEST_CASE("snapshot catalog: unchanged versions share one row and lookups resolve by date") {
+    fs::path tmp = fs::current_path() / "_tmp_snapshot_catalog";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "pen" / kSnapshotDir);
+    const std::string pen = (tmp / "pen").string();
+
+    SnapshotCatalog catalog(pen);
+    std::string label;
+    REQUIRE_FALSE(catalog.resolve("29991231", label));
+
+    REQUIRE(catalog.add_snapshot("20240101-120000", {file("a.txt", 10, 1), file("dir/b.txt", 20, 2)}));
+    REQUIRE(catalog.add_snapshot("20240102-120000", {file("a.txt", 10, 1), file("dir/b.txt", 21, 3)}));
+    REQUIRE(catalog.add_snapshot("20240103-120000", {file("dir/b.txt", 21, 3)}));
+    REQUIRE(catalog.add_snapshot("20240104-120000", {file("a.txt", 10, 1)}));
+
+    // a.txt: one row for days 1-2, a new one after the gap; b.txt: two versions.
+    auto rows = catalog.rows();
+    REQUIRE(rows.size() == 4 + 2 + 2);
+
+    REQUIRE_FALSE(catalog.resolve("20231231", label));
+    REQUIRE(catalog.resolve("20240102", label)); // prefix: until the end of that day
+    REQUIRE(label == "20240102-120000");
+    REQUIRE(catalog.resolve("20240102-115959", label));
+    REQUIRE(label == "20240101-120000");
+    REQUIRE(catalog.resolve("2025", label));
+    REQUIRE(label == "20240104-120000");
+
+    CatalogRow v;
+    REQUIRE(catalog.find("a.txt", "20240102-120000", v));
+    REQUIRE(v.first == "20240101-120000");
+    REQUIRE(v.last == "20240102-120000");
+    REQUIRE_FALSE(catalog.find("a.txt", "20240103-120000", v)); // not in that snapshot
+    REQUIRE(catalog.find("a.txt", "20240104-120000", v));
+    REQUIRE(v.first == "20240104-120000");
+    REQUIRE(catalog.find("dir/b.txt", "20240101-120000", v));
+    REQUIRE(v.mtime_ns == 20);
+    REQUIRE(catalog.find("dir/b.txt", "20240103-120000", v));
+    REQUIRE(v.mtime_ns == 21);
+    REQUIRE(v.size == 3);
+    REQUIRE_FALSE(catalog.find("dir/b.txt", "20240104-120000", v));
+    REQUIRE_FALSE(catalog.find("zzz", "20240104-120000", v));
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("snapshot catalog: binary search over a catalog much larger than the scan window") {
+    fs::path tmp = fs::current_path() / "_tmp_snapshot_catalog_large";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "pen" / kSnapshotDir);
+    const std::string pen = (tmp / "pen").string();
+
+    SnapshotCatalog catalog(pen);
+    const int kFiles = 2000;
+    const char* labels[] = {"20240101-000000", "20240201-000000", "20240301-000000"};
+    for (int s = 0; s < 3; ++s) {
+        std::vector<CatalogRow> files;
+        for (int i = 0; i < kFiles; ++i) {
+            // Every third file changes in every snapshot.
+            std::int64_t mtime = (i % 3 == 0) ? s : 0;
+            files.push_back(file("f/" + std::to_string(i) + ".dat", mtime, static_cast<std::uint64_t>(i)));
+        }
+        REQUIRE(catalog.add_snapshot(labels[s], std::move(files)));
+    }
+    REQUIRE(fs::file_size(tmp / "pen" / kSnapshotDir / SnapshotCatalog::kFileName) > 64 * 1024);
+
+    std::string label;
+    REQUIRE(catalog.resolve("20240215", label));
+    REQUIRE(label == "20240201-000000");
+    for (int i = 0; i < kFiles; i += 37) {
+        CatalogRow v;
+        const std::string rel = "f/" + std::to_string(i) + ".dat";
+        REQUIRE(catalog.find(rel, label, v));
+        REQUIRE(v.path == rel);
+        REQUIRE(v.size == static_cast<std::uint64_t>(i));
+        REQUIRE(v.mtime_ns == ((i % 3 == 0) ? 1 : 0));
+        REQUIRE(v.first == ((i % 3 == 0) ? labels[1] : labels[0]));
+    }
+    CatalogRow v;
+    REQUIRE_FALSE(catalog.find("f/missing.dat", label, v));
+
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("snapshot retention: keep last, daily and weekly") {
+    const std::vector<std::string> labels = {
+        "20240101-090000", // Mon, week 1
+        "20240103-090000", // Wed, week 1
+        "20240108-090000", // Mon, week 2
+        "20240108-180000",
+        "20240109-090000", // Tue, week 2
+        "20240115-090000", // Mon, week 3
+        "20240115-120000",
+    };
+    using V = std::vector<std::string>;
+    REQUIRE(select_retained(labels, 0, 0, 0).empty());
+    REQUIRE((select_retained(labels, 2, 0, 0) == V{"20240115-090000", "20240115-120000"}));
+    REQUIRE((select_retained(labels, 0, 3, 0) == V{"20240108-180000", "20240109-090000", "20240115-120000"}));
+    REQUIRE((select_retained(labels, 0, 0, 2) == V{"20240109-090000", "20240115-120000"}));
+    REQUIRE((select_retained(labels, 1, 1, 3) ==
+             V{"20240103-090000", "20240109-090000", "20240115-120000"}));
+    REQUIRE(select_retained(labels, 100, 0, 0) == labels);
+}
+
+TEST_CASE("snapshot labels: always after the newest, with suffixes that sort as text") {
+    REQUIRE(next_snapshot_label("20241027-013000", "") == "20241027-013000");
+    REQUIRE(next_snapshot_label("20241027-013000", "20241027-012959") == "20241027-013000");
+    // Same second, then a clock that stepped back: still after the newest.
+    REQUIRE(next_snapshot_label("20241027-013000", "20241027-013000") == "20241027-013000-002");
+    REQUIRE(next_snapshot_label("20241027-010000", "20241027-013000-002") == "20241027-013000-003");
+    std::vector<std::string> labels = {"20241027-013000"};
+    for (int i = 0; i < 12; ++i) labels.push_back(next_snapshot_label("20241027-013000", labels.back()));
+    REQUIRE(labels.back() == "20241027-013000-013");
+    REQUIRE(std::is_sorted(labels.begin(), labels.end()));
+}
+
+TEST_CASE("snapshot catalog: removing snapshots shrinks version ranges") {
+    fs::path tmp = fs::current_path() / "_tmp_snapshot_catalog_prune";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "pen" / kSnapshotDir);
+    const std::string pen = (tmp / "pen").string();
+
+    SnapshotCatalog catalog(pen);
+    REQUIRE(catalog.add_snapshot("20240101-000000", {file("a", 1, 1), file("b", 1, 1)}));
+    REQUIRE(catalog.add_snapshot("20240102-000000", {file("a", 1, 1), file("b", 2, 1)}));
+    REQUIRE(catalog.add_snapshot("20240103-000000", {file("a", 1, 1), file("b", 2, 1)}));
+
+    REQUIRE(catalog.remove_snapshots({"20240101-000000", "20240103-000000"}));
+    auto rows = catalog.rows();
+    REQUIRE(rows.size() == 3); // label row, a, b (b's first version is gone)
+    std::string label;
+    REQUIRE(catalog.resolve("2025", label));
+    REQUIRE(label == "20240102-000000");
+    REQUIRE_FALSE(catalog.resolve("20240101", label));
+    CatalogRow v;
+    REQUIRE(catalog.find("a", "20240102-000000", v));
+    REQUIRE(v.first == "20240102-000000");
+    REQUIRE(v.last == "20240102-000000");
+    REQUIRE(catalog.find("b", "20240102-000000", v));
+    REQUIRE(v.mtime_ns == 2);
+
+    // New snapshots still extend the surviving versions.
+    REQUIRE(catalog.add_snapshot("20240104-000000", {file("a", 1, 1)}));
+    REQUIRE(catalog.find("a", "20240104-000000", v));
+    REQUIRE(v.first == "20240102-000000");
+
+    fs::remove_all(tmp);
+}
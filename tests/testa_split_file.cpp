@@ -0,0 +1,116 @@
+#include "catch.hpp"
+#include "checksum.hpp"
+#include "fsutil.hpp"
+#include "split_file.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace tp2;
+namespace fs = std::filesystem;
+
+namespace {
+std::string slurp(const fs::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+}
+
+TEST_CASE("split file: copied in parts, rejoined and read back byte for byte") {
+    const fs::path tmp = fs::current_path() / "_tmp_split";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    std::string data;
+    for (int i = 0; i < 10500; ++i) data += static_cast<char>(i * 7 % 251);
+    std::ofstream(tmp / "src.bin", std::ios::binary) << data;
+    const std::string src = (tmp / "src.bin").string(), dst = (tmp / "dst.bin").string();
+    const std::int64_t mtime = 1600000000LL * 1000000000LL;
+
+    ManifestEntry record;
+    REQUIRE(split_copy(src, dst, 1000, mtime, nullptr, &record));
+    REQUIRE(record.size == data.size());
+    REQUIRE(record.hash == hash64(data.data(), data.size()));
+    REQUIRE(stat_path(dst).mtime_ns == mtime);
+    SplitDescriptor split;
+    REQUIRE(read_split_descriptor(dst, split));
+    REQUIRE(split.size == data.size());
+    REQUIRE(split.parts() == 11);
+    REQUIRE(split_parts_on_disk(dst).size() == 11);
+    REQUIRE(fs::file_size(split_part_path(dst, 10)) == 500);
+
+    std::string streamed;
+    REQUIRE(read_split(dst, split, [&](const char* p, std::size_t n) {
+        streamed.append(p, n);
+        return true;
+    }));
+    REQUIRE(streamed == data);
+
+    std::uint64_t bytes = 0;
+    REQUIRE(join_copy(dst, split, (tmp / "joined.bin").string(), mtime, nullptr, bytes));
+    REQUIRE(bytes == data.size());
+    REQUIRE(slurp(tmp / "joined.bin") == data);
+
+    // A smaller version leaves no parts of the larger one behind; a missing part fails the read.
+    std::ofstream(tmp / "src.bin", std::ios::binary | std::ios::trunc) << data.substr(0, 2500);
+    REQUIRE(split_copy(src, dst, 1000, mtime, nullptr, nullptr));
+    REQUIRE(split_parts_on_disk(dst).size() == 3);
+    REQUIRE(read_split_descriptor(dst, split));
+    fs::remove(split_part_path(dst, 1));
+    REQUIRE_FALSE(read_split(dst, split, [](const char*, std::size_t) { return true; }));
+    REQUIRE_FALSE(read_split_descriptor(src, split)); // an ordinary file
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("split file: coalesced parts are written one at a time under the gate") {
+    const fs::path tmp = fs::current_path() / "_tmp_split_coalesced";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    std::string data;
+    for (int i = 0; i < 25000; ++i) data += static_cast<char>(i * 13 % 251);
+    std::ofstream(tmp / "src.bin", std::ios::binary) << data;
+    const std::string src = (tmp / "src.bin").string(), dst = (tmp / "dst.bin").string();
+    const std::int64_t mtime = 1600000000LL * 1000000000LL;
+    std::mutex gate;
+    // Parts larger and smaller than the erase block, neither a multiple of it.
+    for (std::uint64_t part_size : {10000u, 1000u}) {
+        ManifestEntry record;
+        bool ok = false;
+        gate.lock();
+        std::thread copy([&] { ok = split_copy(src, dst, part_size, mtime, nullptr, &record, {4096, &gate, true}); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        REQUIRE_FALSE(fs::exists(split_part_path(dst, 0))); // waiting for the gate
+        gate.unlock();
+        copy.join();
+        REQUIRE(ok);
+        REQUIRE(gate.try_lock());
+        gate.unlock();
+        REQUIRE(record.size == data.size());
+        REQUIRE(record.hash == hash64(data.data(), data.size()));
+        SplitDescriptor split;
+        REQUIRE(read_split_descriptor(dst, split));
+        REQUIRE(split_parts_on_disk(dst).size() == split.parts());
+        std::string streamed;
+        REQUIRE(read_split(dst, split, [&](const char* p, std::size_t n) {
+            streamed.append(p, n);
+            return true;
+        }));
+        REQUIRE(streamed == data);
+        fs::remove(dst);
+        for (const auto& part : split_parts_on_disk(dst)) fs::remove(part);
+    }
+    fs::remove_all(tmp);
+}
+
+TEST_CASE("split file: part names are told apart from ordinary files") {
+    REQUIRE(split_part_path("dir/a.iso", 7) == "dir/a.iso.tp2-part-007");
+    REQUIRE(is_split_part("dir/a.iso.tp2-part-007"));
+    REQUIRE(is_split_part("a.iso.tp2-part-1234"));
+    REQUIRE_FALSE(is_split_part("a.iso"));
+    REQUIRE_FALSE(is_split_part("a.iso.tp2-part-"));
+    REQUIRE_FALSE(is_split_part("a.iso.tp2-part-00x"));
+    REQUIRE_FALSE(is_split_part("x.tp2-part-001/b.txt"));
+}
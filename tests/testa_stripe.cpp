@@ -0,0 +1,65 @@
+#include "catch.hpp"
+#include "stripe.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <string>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+TEST_CASE("stripe layout: balanced by size and stable once assigned") {
+    StripeLayout layout(4);
+    for (int i = 0; i < 4000; ++i) layout.assign("dir/file" + std::to_string(i), 1000 + (i % 7) * 300);
+    std::uint64_t lo = layout.loads()[0], hi = layout.loads()[0];
+    for (auto bytes : layout.loads()) {
+        lo = std::min(lo, bytes);
+        hi = std::max(hi, bytes);
+    }
+    REQUIRE(hi - lo < hi / 20); // within 5%
+
+    // Large files go to the emptiest pen.
+    const std::size_t emptiest = static_cast<std::size_t>(
+        std::min_element(layout.loads().begin(), layout.loads().end()) - layout.loads().begin());
+    REQUIRE(layout.assign("big.iso", StripeLayout::kLargeFile) == emptiest);
+
+    // An assigned file keeps its pen even when it grows.
+    std::size_t slot = 0;
+    REQUIRE(layout.find("dir/file7", slot));
+    REQUIRE(layout.assign("dir/file7", 10 * StripeLayout::kLargeFile) == slot);
+    REQUIRE_FALSE(layout.find("other", slot));
+}
+
+TEST_CASE("stripe layout: save and load keep position, entries and generation") {
+    fs::path tmp = fs::current_path() / "_tmp_stripe_layout";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp);
+    StripeLayout layout(3);
+    layout.assign("a b/c.txt", 10);
+    layout.assign("d.txt", 20);
+    REQUIRE(layout.save(tmp.string(), 2));
+
+    StripeLayout loaded;
+    std::size_t slot = 0;
+    REQUIRE(loaded.load(tmp.string(), slot));
+    REQUIRE(slot == 2);
+    REQUIRE(loaded.pens() == 3);
+    REQUIRE(loaded.size() == 2);
+    REQUIRE(loaded.generation() == 1);
+    std::size_t pen = 9;
+    REQUIRE(loaded.find("a b/c.txt", pen));
+    std::size_t expected = 0;
+    REQUIRE(layout.find("a b/c.txt", expected));
+    REQUIRE(pen == expected);
+
+    REQUIRE(loaded.retain({"d.txt"}) == 1);
+    REQUIRE(loaded.save(tmp.string(), 2));
+    REQUIRE(loaded.load(tmp.string(), slot));
+    REQUIRE(loaded.size() == 1);
+    REQUIRE(loaded.generation() == 2);
+    std::uint64_t total = 0;
+    for (auto bytes : loaded.loads()) total += bytes;
+    REQUIRE(total == 20);
+
+    REQUIRE_FALSE(StripeLayout().load((tmp / "absent").string(), slot));
+    fs::remove_all(tmp);
+}
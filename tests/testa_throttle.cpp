@@ -0,0 +1,63 @@
+#include "catch.hpp"
+#include "throttle.hpp"
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace tp2;
+
+TEST_CASE("throttle: unlimited limiter never blocks") {
+    RateLimiter limiter(0);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; ++i) limiter.acquire(1 << 20);
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+}
+
+TEST_CASE("throttle: rate holds across several threads") {
+    // 1000 units/s with a 1 s burst: 4 threads x 250 units beyond the burst take ~1 s
+    RateLimiter limiter(1000);
+    limiter.acquire(1000); // drain the initial burst
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() { for (int i = 0; i < 5; ++i) limiter.acquire(50); });
+    }
+    for (auto& t : threads) t.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    REQUIRE(elapsed >= 0.8);
+}
+
+TEST_CASE("throttle: a new rate applies to callers already waiting") {
+    RateLimiter limiter(100);
+    limiter.acquire(100); // drain the initial burst
+    auto start = std::chrono::steady_clock::now();
+    std::thread waiter([&]() { limiter.acquire(1000); }); // ~10 s at the old rate
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    limiter.set_rate(1000000);
+    waiter.join();
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+    limiter.set_rate(0);
+    limiter.acquire(1ULL << 40); // unlimited again
+}
+
+TEST_CASE("throttle: io throttle limits operations and bytes across threads") {
+    IoThrottle throttle({0, 0, 0, 40}); // 40 writes/s
+    for (int i = 0; i < 40; ++i) throttle.write(1); // drain the burst
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 5; ++i) {
+                throttle.write(1 << 20); // bytes are not limited, operations are
+                throttle.read(1 << 20);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    REQUIRE(elapsed >= 0.4); // 20 writes at 40/s
+    REQUIRE(elapsed < 3.0);
+    REQUIRE(throttle.limits().write_ops_per_sec == 40);
+    throttle.set_limits({});
+    REQUIRE_FALSE(throttle.limits().any());
+}
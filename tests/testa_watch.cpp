@@ -0,0 +1,51 @@
+#include "catch.hpp"
+#include "watch.hpp"
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+
+namespace fs = std::filesystem;
+using namespace tp2;
+
+TEST_CASE("watcher: reports listed entries only, and directories that appear later") {
+    fs::path tmp = fs::current_path() / "_tmp_watch";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "docs");
+    ChangeWatcher watcher(tmp.string());
+    REQUIRE(watcher.ok());
+    watcher.add("docs/a.txt");
+    watcher.add("docs/b.txt");
+    watcher.add("later/c.txt");
+    REQUIRE(watcher.unwatched() == 1);
+
+    std::set<std::string> dirty;
+    std::ofstream(tmp / "docs" / "a.txt") << "changed";
+    std::ofstream(tmp / "docs" / "unlisted.txt") << "ignored";
+    REQUIRE(watcher.wait(1000, dirty) > 0);
+    REQUIRE(dirty == std::set<std::string>{"docs/a.txt"});
+
+    // Saving through a temporary file and a rename counts as a change.
+    dirty.clear();
+    std::ofstream(tmp / "docs" / "b.tmp") << "new";
+    fs::rename(tmp / "docs" / "b.tmp", tmp / "docs" / "b.txt");
+    while (watcher.wait(200, dirty) > 0) {}
+    REQUIRE(dirty == std::set<std::string>{"docs/b.txt"});
+
+    // A parent that did not exist is picked up, with what is already in it.
+    dirty.clear();
+    fs::create_directories(tmp / "later");
+    std::ofstream(tmp / "later" / "c.txt") << "c";
+    REQUIRE(watcher.wait(0, dirty) > 0);
+    REQUIRE(dirty.count("later/c.txt") == 1);
+    REQUIRE(watcher.unwatched() == 0);
+
+    // Removing a watched directory marks all its entries.
+    dirty.clear();
+    fs::remove_all(tmp / "docs");
+    while (watcher.wait(200, dirty) > 0) {}
+    REQUIRE(dirty == std::set<std::string>({"docs/a.txt", "docs/b.txt"}));
+    REQUIRE(watcher.unwatched() == 1);
+
+    fs::remove_all(tmp);
+}